@@ -0,0 +1,289 @@
+#!/bin/bash
+
+# The end-to-end benchmarks of rcc, with percentiles, JSON results and a regression check against a baseline.
+#
+# Each metric is measured with g++ and with clang++, if installed:
+#   cold_compile    a cache miss which can't use a PCH, the flags differ from the ones they were built with
+#   pch_compile     a cache miss which uses the PCH
+#   pch_variant     a cache miss which uses the PCH variant built for its flags
+#   stl_compile     a cache miss which uses the common containers, their instantiations are linked from a library
+#   auto_wrap       a cache miss of an expression, which only compiles once it's wrapped into `cout << ... << endl;`
+#   cache_hit       a run of a cached snippet
+#   permanent_run   a run of a permanent snippet
+#   list            `rcc list`
+#
+# The times are the wall-clock times of the whole rcc process, as seen by a shell script calling rcc. The daemon is
+# bypassed, the client and the daemon would be measured together otherwise.
+
+function usage() {
+    cat <<EOF
+Usage: $0 [OPTION]... [RCC]
+
+Run the benchmarks of RCC, the rcc in the PATH by default.
+
+OPTIONS:
+    -h, --help              Display this help and exit.
+    -n, --runs N            Runs of the fast metrics, default to $RUNS.
+    -c, --compile-runs N    Runs of the metrics which compile, default to $COMPILE_RUNS.
+    -o, --output FILE       Write the results to FILE, default to $OUTPUT.
+    -b, --baseline FILE     Compare the results with FILE, default to $BASELINE.
+    -t, --tolerance PCT     Fail if a median is more than PCT percent slower than the baseline, default to $TOLERANCE.
+    -s, --save-baseline     Save the results as the baseline instead of comparing them.
+
+EXAMPLES:
+    $0 -n 100 bin/rcc
+EOF
+    exit 0
+}
+
+BENCH_DIR="$(cd "$(dirname "${BASH_SOURCE[0]}")" && pwd)"
+
+RUNS=50
+COMPILE_RUNS=5
+OUTPUT="$BENCH_DIR/results.json"
+BASELINE="$BENCH_DIR/baseline.json"
+TOLERANCE=20
+SAVE_BASELINE=false
+
+# A median within this many milliseconds of the baseline is never a regression, it's the noise of the fast metrics
+NOISE_MS=0.5
+
+TEMP=$(getopt -o hn:c:o:b:t:s --long help,runs:,compile-runs:,output:,baseline:,tolerance:,save-baseline -n "$0" -- "$@")
+# shellcheck disable=SC2181
+if [[ $? -ne 0 ]]; then
+    echo "Error: there is an error in the argument parsing." >&2
+    usage
+fi
+eval set -- "$TEMP"
+
+while true; do
+    case "$1" in
+    -h | --help)
+        usage
+        ;;
+    -n | --runs)
+        RUNS="$2"
+        shift 2
+        ;;
+    -c | --compile-runs)
+        COMPILE_RUNS="$2"
+        shift 2
+        ;;
+    -o | --output)
+        OUTPUT="$2"
+        shift 2
+        ;;
+    -b | --baseline)
+        BASELINE="$2"
+        shift 2
+        ;;
+    -t | --tolerance)
+        TOLERANCE="$2"
+        shift 2
+        ;;
+    -s | --save-baseline)
+        SAVE_BASELINE=true
+        shift
+        ;;
+    --)
+        shift
+        break
+        ;;
+    *)
+        echo "Internal Error!" >&2
+        exit 1
+        ;;
+    esac
+done
+
+RCC="${1:-rcc}"
+if ! command -v "$RCC" >/dev/null; then
+    echo "Error: $RCC not found." >&2
+    exit 1
+fi
+
+export RCC_NO_DAEMON=1
+
+# A tag to make the snippets unique for this invocation, so that the misses are misses
+tag="bench$$$(date +%s)"
+
+samples_dir=$(mktemp -d)
+permanents=()
+function cleanup() {
+    rm -rf "$samples_dir"
+    for name in "${permanents[@]}"; do
+        "$RCC" --remove-permanent "$name" >/dev/null 2>&1
+    done
+}
+trap cleanup EXIT
+
+################################################################################
+# Measure
+
+# Run a command `runs` times and record the wall-clock time of each run in milliseconds, in the file of the metric.
+# Usage: measure METRIC RUNS COMMAND... where "{}" in the command is replaced by the index of the run.
+function measure() {
+    local metric="$1" runs="$2"
+    shift 2
+
+    local i begin end
+    local -a cmd
+    for ((i = 0; i < runs; i++)); do
+        cmd=("${@//\{\}/$i}")
+        begin=${EPOCHREALTIME/./}
+        if ! "${cmd[@]}" >/dev/null 2>&1; then
+            echo "Error: failed to run: ${cmd[*]}" >&2
+            exit 1
+        fi
+        end=${EPOCHREALTIME/./}
+        echo "$(((end - begin) / 1000)).$(printf "%03d" $(((end - begin) % 1000)))" >>"$samples_dir/$metric"
+    done
+    echo "$metric" >>"$samples_dir/metrics"
+}
+
+# Build the PCH variant of the flags, and wait until it's there.
+# Usage: build_pch_variant CXX FLAGS...
+function build_pch_variant() {
+    local cxx="$1"
+    shift
+
+    local key
+    key=$("$RCC" "--$cxx" --debug --pch-threshold 1 "$@" "cout << \"$tag variant\" << endl;" 2>&1 |
+        sed 's/\x1b\[[0-9;]*m//g' | sed -n 's/.*PCH VARIANT: \([^ ]*\) .*/\1/p' | head -n 1)
+    if [ -z "$key" ]; then
+        echo "Error: no PCH variant for $cxx $*" >&2
+        exit 1
+    fi
+
+    local variant
+    variant="$("$RCC" --print-cache-dir)/templates/rcc_template.hpp.gch/$cxx.variant.$key.gch"
+    for _ in $(seq 600); do
+        [ -f "$variant" ] && return
+        sleep 0.2
+    done
+    echo "Error: the PCH variant $variant wasn't built" >&2
+    exit 1
+}
+
+# The flag -O1 makes the default PCHs unusable, g++ skips them and the PCH test of rcc fails for clang++. The macro of
+# the cold compilations is unique to this invocation and no variant is built for it, a variant of an earlier invocation
+# would be used otherwise. The macro of the variant compilations is the same for all invocations, its variant is only
+# built once.
+function bench_compiler() {
+    local cxx="$1" name="$2"
+    local opt="--$cxx"
+
+    echo "Measuring $name..." >&2
+
+    measure "$name.cold_compile" "$COMPILE_RUNS" \
+        "$RCC" "$opt" --pch-threshold 0 -O1 "-DRCC_BENCH_COLD=$tag" "cout << \"$tag cold {}\" << endl;"
+    measure "$name.pch_compile" "$COMPILE_RUNS" \
+        "$RCC" "$opt" "cout << \"$tag pch {}\" << endl;"
+    build_pch_variant "$cxx" -O1 -DRCC_BENCH_VARIANT
+    measure "$name.pch_variant" "$COMPILE_RUNS" \
+        "$RCC" "$opt" -O1 -DRCC_BENCH_VARIANT "cout << \"$tag variant {}\" << endl;"
+    measure "$name.stl_compile" "$COMPILE_RUNS" \
+        "$RCC" "$opt" "vector<string> v{\"$tag stl {}\"}; map<int, int> m; set<int> s{1}; m[*s.begin()] = 2;
+            cout << v[0] << m.size() << endl;"
+    measure "$name.auto_wrap" "$COMPILE_RUNS" \
+        "$RCC" "$opt" "\"$tag wrap {}\""
+
+    # The promotion to -O2 would compile in the background while the hits are measured
+    "$RCC" "$opt" "cout << \"$tag hit\" << endl;" >/dev/null
+    measure "$name.cache_hit" "$RUNS" \
+        "$RCC" "$opt" --tier-threshold 0 "cout << \"$tag hit\" << endl;"
+
+    local permanent="${tag}_$name"
+    "$RCC" "$opt" --permanent "$permanent" "cout << \"$tag permanent\" << endl;" >/dev/null
+    permanents+=("$permanent")
+    measure "$name.permanent_run" "$RUNS" \
+        "$RCC" --run-permanent "$permanent"
+
+    measure "$name.list" "$RUNS" \
+        "$RCC" "$opt" list
+}
+
+command -v g++ >/dev/null && bench_compiler g++ gcc
+command -v clang++ >/dev/null && bench_compiler clang++ clang
+
+if [ ! -f "$samples_dir/metrics" ]; then
+    echo "Error: neither g++ nor clang++ is installed." >&2
+    exit 1
+fi
+
+################################################################################
+# Report
+
+# Print the statistics of a metric as a JSON object, the percentiles are the nearest-rank ones.
+function stats_json() {
+    sort -n "$samples_dir/$1" | awk '
+        { v[NR] = $1; sum += $1 }
+        function pct(p) { i = int(p * NR + 0.999999); return v[i < 1 ? 1 : i] }
+        END {
+            printf "{\"unit\": \"ms\", \"runs\": %d, \"min\": %.3f, \"p50\": %.3f, \"p90\": %.3f, \"p99\": %.3f, ", NR, v[1], pct(0.5), pct(0.9), pct(0.99)
+            printf "\"max\": %.3f, \"mean\": %.3f}", v[NR], sum / NR
+        }'
+}
+
+# Get a field of a metric from a results file, empty if it's not there.
+function get_field() {
+    local file="$1" metric="$2" field="$3"
+    grep -F "\"$metric\": {" "$file" 2>/dev/null | sed -n "s/.*\"$field\": \([0-9.]*\).*/\1/p"
+}
+
+{
+    echo "{"
+    echo "    \"date\": \"$(date -u +%Y-%m-%dT%H:%M:%SZ)\","
+    echo "    \"host\": \"$(uname -n)\","
+    echo "    \"rcc\": \"$RCC\","
+    echo "    \"metrics\": {"
+    first=true
+    while read -r metric; do
+        $first || echo ","
+        first=false
+        echo -n "        \"$metric\": $(stats_json "$metric")"
+    done <"$samples_dir/metrics"
+    echo ""
+    echo "    }"
+    echo "}"
+} >"$OUTPUT"
+
+printf "%-22s %6s %10s %10s %10s %10s\n" "metric" "runs" "p50 ms" "p90 ms" "p99 ms" "mean ms"
+while read -r metric; do
+    printf "%-22s %6s %10s %10s %10s %10s\n" "$metric" "$(get_field "$OUTPUT" "$metric" runs)" \
+        "$(get_field "$OUTPUT" "$metric" p50)" "$(get_field "$OUTPUT" "$metric" p90)" \
+        "$(get_field "$OUTPUT" "$metric" p99)" "$(get_field "$OUTPUT" "$metric" mean)"
+done <"$samples_dir/metrics"
+echo ""
+echo "Results written to $OUTPUT"
+
+if [ "$SAVE_BASELINE" = true ]; then
+    cp "$OUTPUT" "$BASELINE"
+    echo "Baseline saved to $BASELINE"
+    exit 0
+fi
+
+if [ ! -f "$BASELINE" ]; then
+    echo "No baseline at $BASELINE, save one with --save-baseline"
+    exit 0
+fi
+
+# The medians are compared, the tail percentiles are too noisy for a few runs
+regressions=0
+while read -r metric; do
+    base=$(get_field "$BASELINE" "$metric" p50)
+    current=$(get_field "$OUTPUT" "$metric" p50)
+    if [ -z "$base" ]; then
+        continue
+    fi
+    if awk -v b="$base" -v c="$current" -v t="$TOLERANCE" -v n="$NOISE_MS" 'BEGIN { exit !(c > b * (1 + t / 100) + n) }'; then
+        echo "REGRESSION: $metric p50 $current ms, baseline $base ms"
+        regressions=$((regressions + 1))
+    fi
+done <"$samples_dir/metrics"
+
+if [ $regressions -ne 0 ]; then
+    echo "$regressions metric(s) regressed by more than $TOLERANCE% against $BASELINE"
+    exit 1
+fi
+echo "No regression against $BASELINE"
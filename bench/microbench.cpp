@@ -0,0 +1,159 @@
+// The microbenchmarks of the functions which every rcc invocation runs, e.g. the hashing of the code and the lookup of
+// the permanents. Build and run with `make microbench`, pass a substring of the names to run some of them only.
+//
+// Each benchmark is warmed up, then timed in samples of a batch of calls, where the batch is sized so that a sample
+// takes about a millisecond. The median, the 90th percentile and the minimum of the time per call are reported.
+
+#include "src/path.h"
+#include "src/utils.h"
+#include <algorithm>
+#include <cstdlib>
+#include <functional>
+#include <unistd.h>
+
+using namespace rcc;
+
+static const double SAMPLE_TIME_MS = 1.0; // the time of one sample
+static const double WARMUP_TIME_MS = 50.0; // the time to run a benchmark before it's timed
+static const int NUM_SAMPLES = 50;
+
+// Keep the compiler from optimizing away a computation whose result is not used.
+template <typename T> static void keep(const T &value) {
+    asm volatile("" : : "g"(&value) : "memory");
+}
+
+// Run a benchmark and print the time per call. `bytes` is the size of the input of a call, to print the throughput.
+static void bench(const std::string &filter, const std::string &name, size_t bytes, const std::function<void()> &fn) {
+    if (name.find(filter) == std::string::npos) {
+        return;
+    }
+
+    // Warm up the caches, the branch predictors and the CPU frequency, and find the size of a batch
+    size_t batch = 1;
+    size_t calls = 0;
+    const auto warmup_begin = now();
+    while (duration_ms(warmup_begin) < WARMUP_TIME_MS) {
+        const auto begin = now();
+        for (size_t i = 0; i < batch; i++) {
+            fn();
+        }
+        calls += batch;
+        if (duration_ms(begin) < SAMPLE_TIME_MS) {
+            batch *= 2;
+        }
+    }
+    if (calls == 0) {
+        return;
+    }
+
+    std::vector<double> samples; // nanoseconds per call
+    for (int s = 0; s < NUM_SAMPLES; s++) {
+        const auto begin = now();
+        for (size_t i = 0; i < batch; i++) {
+            fn();
+        }
+        samples.push_back(duration_ms(begin) * 1e6 / batch);
+    }
+    std::sort(samples.begin(), samples.end());
+    const double median = samples[samples.size() / 2];
+    const double p90 = samples[samples.size() * 9 / 10];
+
+    print("{:<40} {:>12.1f} {:>12.1f} {:>12.1f}", name, median, p90, samples.front());
+    if (bytes > 0) {
+        print(" {:>10.1f}", bytes / median * 1e9 / 1048576.0);
+    }
+    print("\n");
+}
+
+// A snippet of `lines` lines of code, like the ones which are hashed on every invocation.
+static std::string gen_code(size_t lines) {
+    std::string code;
+    for (size_t i = 0; i < lines; i++) {
+        code += fmt::format("    vector<int> v{} = {{{}, {}, {}}}; cout << accumulate(v{}.begin(), v{}.end(), 0);\n", i,
+                            i, i * 7, i * 13, i, i);
+    }
+    return code;
+}
+
+int main(int argc, char **argv) {
+    const std::string filter = argc > 1 ? argv[1] : "";
+
+    const std::string small_code = "cout << \"Hello World!\" << endl;";
+    const std::string large_code = gen_code(1000); // about 80 KiB
+    const std::string template_code = "#include \"rcc_template.hpp\"\n\n// $rcc-inc\n\nusing namespace std;\n\n"
+                                      "// $rcc-above-main\n\n// $rcc-func\n\nint main(int argc, char **argv) {\n"
+                                      "    // $rcc-code\n\n    return 0;\n}\n\n// $rcc-id\n";
+
+    // The names of thousands of permanents
+    std::vector<std::string> names;
+    for (int i = 0; i < 5000; i++) {
+        names.push_back(fmt::format("perm_{}_{}", i % 97, i));
+    }
+
+    // A directory of permanents, each one with its source, binary and description
+    char dir_template[] = "/tmp/rcc_microbench.XXXXXX";
+    if (mkdtemp(dir_template) == nullptr) {
+        perror("mkdtemp()");
+        return 1;
+    }
+    const Path dir = std::string(dir_template);
+    for (const auto &name : names) {
+        for (const char *ext : {".cpp", ".bin", ".desc"}) {
+            (dir / (name + ext)).write_file("");
+        }
+    }
+    const Path file_path = dir / "snippet.cpp";
+    file_path.write_file(large_code);
+
+    print("{:<40} {:>12} {:>12} {:>12} {:>10}\n", "benchmark", "median ns", "p90 ns", "min ns", "MiB/s");
+
+    bench(filter, "fnv1a_64_hash_string/small", small_code.size(),
+          [&]() { keep(fnv1a_64_hash_string(small_code)); });
+    bench(filter, "fnv1a_64_hash_string/large", large_code.size(),
+          [&]() { keep(fnv1a_64_hash_string(large_code)); });
+    bench(filter, "hash128_string/small", small_code.size(), [&]() { keep(hash128_string(small_code)); });
+    bench(filter, "hash128_string/large", large_code.size(), [&]() { keep(hash128_string(large_code)); });
+
+    uint64_t val = 0x123456789abcdefULL;
+    bench(filter, "u64_to_string_base64x", 0, [&]() { keep(u64_to_string_base64x(val++)); });
+    bench(filter, "u128_to_string_base64x", 0, [&]() {
+        keep(u128_to_string_base64x({val, ~val}));
+        val++;
+    });
+
+    const std::vector<std::pair<std::string, std::string>> replaces = {
+        {"$rcc-inc", "User includes\n#include <vector>\n#include <numeric>"},
+        {"$rcc-above-main", "User above main\n"},
+        {"$rcc-func", "User functions\n"},
+        {"$rcc-code", "User codes\n" + large_code},
+        {"$rcc-id", "ID: " + u128_to_string_base64x(hash128_string(large_code))},
+    };
+    bench(filter, "safe_replacer::replace", template_code.size() + large_code.size(), [&]() {
+        std::string code = template_code;
+        keep(safe_replacer::replace(code, replaces));
+    });
+
+    const std::vector<std::string> flags(1000, "-DNAME=value");
+    bench(filter, "vector_to_string/1000", 0, [&]() { keep(vector_to_string(flags)); });
+
+    const std::string arg = large_code.substr(0, 4096) + "'quoted' 'args'";
+    bench(filter, "escapeshellarg/4K", arg.size(), [&]() { keep(escapeshellarg(arg)); });
+
+    // The suggestion of a permanent, see RCC::suggest_similar_permanent()
+    bench(filter, "edit_distance/5000_names", 0, [&]() {
+        size_t min_distance = SIZE_MAX;
+        for (const auto &name : names) {
+            min_distance = std::min(min_distance, edit_distance("perm_42_4242x", name));
+        }
+        keep(min_distance);
+    });
+
+    bench(filter, "find_files/15000_files", 0, [&]() { keep(find_files(dir.get_path(), {".bin"})); });
+
+    bench(filter, "Path::read_file/80K", large_code.size(), [&]() { keep(file_path.read_file()); });
+    bench(filter, "Path::write_file/80K", large_code.size(), [&]() { file_path.write_file(large_code); });
+
+    //! Caution: removes files
+    fs::remove_all(dir.get_path());
+    return 0;
+}
@@ -163,6 +163,9 @@ check_error "make $make_mode"
 echo "${YELLOW}Installing rcc to /usr/local/bin/${NORMAL}"
 sudo cp bin/rcc /usr/local/bin/
 check_error "sudo cp rcc /usr/local/bin/"
+# The same binary runs as the daemon when invoked as `rccd`
+sudo ln -sf rcc /usr/local/bin/rccd
+check_error "sudo ln -sf rcc /usr/local/bin/rccd"
 
 # Install zsh completion if zsh is installed
 if command -v zsh &> /dev/null; then
@@ -171,6 +174,12 @@ if command -v zsh &> /dev/null; then
     check_error "cp completions/_rcc_zsh_completion /usr/local/share/zsh/site-functions/"
 fi
 
+# Stop the daemon if it's running, it keeps the old templates in memory
+if command -v rccd &>/dev/null && rccd --status &>/dev/null; then
+    echo "${YELLOW}Stopping rccd${NORMAL}"
+    rccd --stop
+fi
+
 # Remove and then create rcc cache dir
 if [ -d "$CACHE_DIR" ]; then
     echo "${YELLOW}Removing old cache directory \"$CACHE_DIR\"${NORMAL}"
@@ -180,6 +189,13 @@ if [ -d "$CACHE_DIR" ]; then
     check_error "rm -rf \"$CACHE_DIR/templates\"/*.hpp \"$CACHE_DIR/templates\"/*.cpp"
     rm -rf "$CACHE_DIR/templates/clang_pch_test_cache"
     check_error "rm -rf \"$CACHE_DIR/templates/clang_pch_test_cache\""
+    # The templates are copied with their timestamps, make would keep the PCHs and the libraries built from older ones
+    rm -rf "$CACHE_DIR/templates/rcc_template.hpp.gch" "$CACHE_DIR/templates/rcc_template.hpp.flags" \
+        "$CACHE_DIR/templates"/librcc_instances.*
+    check_error "rm -rf \"$CACHE_DIR/templates\"/rcc_template.hpp.gch ... librcc_instances.*"
+    # Detect the linkers again, the toolchain may have changed
+    rm -f "$CACHE_DIR/templates"/rcc_linker.*
+    check_error "rm -f \"$CACHE_DIR/templates\"/rcc_linker.*"
 fi
 echo "${YELLOW}Creating cache directory \"$CACHE_DIR\"${NORMAL}"
 mkdir -p "$CACHE_DIR/cache"
@@ -0,0 +1,42 @@
+#!/bin/bash
+
+# Measure the cache miss time of rcc with each available linker.
+# Usage: scripts/bench_linker.sh [compiler] [runs]
+# Each run compiles a new snippet, so every run is a cache miss.
+
+compiler="${1:-g++}"
+runs="${2:-10}"
+
+linkers="default"
+command -v ld.bfd >/dev/null && linkers="$linkers bfd"
+command -v ld.gold >/dev/null && linkers="$linkers gold"
+command -v ld.lld >/dev/null && linkers="$linkers lld"
+command -v mold >/dev/null && linkers="$linkers mold"
+
+# The daemon is bypassed, the client and the daemon would be measured together otherwise
+export RCC_NO_DAEMON=1
+
+# A tag to make the snippets unique for this invocation
+tag="$$$(date +%s)"
+
+samples=$(mktemp)
+trap 'rm -f "$samples"' EXIT
+
+# The percentiles are the nearest-rank ones, as in bench/bench.sh
+printf "%-10s %12s %12s %12s\n" "linker" "p50 miss ms" "p90 miss ms" "max miss ms"
+for linker in $linkers; do
+    : >"$samples"
+    for ((i = 0; i < runs; i++)); do
+        begin=$(date +%s%N)
+        if ! rcc "--$compiler" --linker "$linker" "cout<<\"$tag $linker $i\"<<endl;" >/dev/null; then
+            echo "rcc failed with linker $linker"
+            exit 1
+        fi
+        end=$(date +%s%N)
+        echo $(((end - begin) / 1000)) >>"$samples"
+    done
+    sort -n "$samples" | awk -v l="$linker" '
+        { v[NR] = $1 / 1000 }
+        function pct(p) { i = int(p * NR + 0.999999); return v[i < 1 ? 1 : i] }
+        END { printf "%-10s %12.2f %12.2f %12.2f\n", l, pct(0.5), pct(0.9), v[NR] }'
+done
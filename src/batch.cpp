@@ -0,0 +1,335 @@
+#include "batch.h"
+#include "cache_gc.h"
+#include "debug_fmt.h"
+#include "json.h"
+#include "launcher.h"
+#include "paths.h"
+#include "rcc.h"
+#include <cstdio>
+#include <deque>
+#include <fcntl.h>
+#include <fstream>
+#include <unistd.h>
+
+namespace rcc {
+
+// A worker compiling an entry, see Batch::run().
+struct BatchWorker {
+    size_t index;
+    pid_t pid;
+    int result_fd; // the worker writes the argument vector to execute the binary to it
+    Path out_path;
+    Path err_path;
+};
+
+// Replay a captured output of a worker and remove the file.
+static void replay_output(const Path &path, FILE *stream) {
+    // A worker which failed early may not have created it, and read_file() exits on a missing file
+    if (!path.exists()) {
+        return;
+    }
+    try {
+        const std::string output = path.read_file();
+        fwrite(output.data(), 1, output.size(), stream);
+        fflush(stream);
+    } catch (const std::exception &e) {
+        gpwarning("Failed to read the output of a batch worker: {}\n", e.what());
+    }
+    IGNORE_RESULT(remove(path.c_str()));
+}
+
+// Start a worker for the entry, its output is captured to files and replayed in the input order.
+//* The worker is a fork of this process, so it needs neither exec nor argv parsing of a new rcc binary. It compiles
+//* the entry like a daemon worker does, and sends back the argument vector to execute the binary.
+static bool start_worker(const std::vector<std::string> &args, BatchWorker &worker) {
+    int fds[2];
+    if (pipe2(fds, O_CLOEXEC) != 0) {
+        gperror("pipe(): {}\n", strerror(errno));
+        return false;
+    }
+
+    fflush(stdout);
+    fflush(stderr);
+
+    const pid_t pid = fork();
+    if (pid < 0) {
+        gperror("fork(): {}\n", strerror(errno));
+        close(fds[0]);
+        close(fds[1]);
+        return false;
+    }
+
+    if (pid == 0) { // in child process
+        close(fds[0]);
+
+        int out_fd = open(worker.out_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        int err_fd = open(worker.err_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        int null_fd = open("/dev/null", O_RDONLY);
+        if (out_fd < 0 || err_fd < 0 || null_fd < 0) {
+            _exit(1);
+        }
+        dup2(null_fd, STDIN_FILENO);
+        dup2(out_fd, STDOUT_FILENO);
+        dup2(err_fd, STDERR_FILENO);
+
+        std::vector<std::string> argv_storage = args;
+        std::vector<char *> argv;
+        for (auto &arg : argv_storage) {
+            argv.push_back(&arg[0]);
+        }
+        argv.push_back(NULL);
+
+        RCC::DeferredRun run;
+        RCC::defer_run_bin(&run);
+
+        const int exit_status = rcc_entry(static_cast<int>(argv_storage.size()), argv.data());
+
+        std::string result;
+        for (const auto &arg : run.exec_argv) {
+            result += arg;
+            result.push_back('\0');
+        }
+        IGNORE_RESULT(write(fds[1], result.data(), result.size()));
+
+        fflush(stdout);
+        fflush(stderr);
+        _exit(exit_status);
+    }
+
+    close(fds[1]);
+    worker.pid = pid;
+    worker.result_fd = fds[0];
+    return true;
+}
+
+// Wait for a worker, return the argument vector to execute the binary, or an empty vector if the entry failed.
+static std::vector<std::string> wait_worker(BatchWorker &worker, int &exit_status) {
+    //* The result is read before waiting, the worker would block on a full pipe otherwise.
+    std::string result;
+    char buf[4096];
+    ssize_t n;
+    while ((n = read(worker.result_fd, buf, sizeof(buf))) != 0) {
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            break;
+        }
+        result.append(buf, n);
+    }
+    close(worker.result_fd);
+
+    const int status = wait_process(worker.pid);
+    exit_status = status != -1 && WIFEXITED(status) ? WEXITSTATUS(status) : 1;
+
+    std::vector<std::string> exec_argv;
+    size_t begin = 0;
+    for (size_t i = 0; i < result.size(); i++) {
+        if (result[i] == '\0') {
+            exec_argv.push_back(result.substr(begin, i - begin));
+            begin = i + 1;
+        }
+    }
+    return exec_argv;
+}
+
+int Batch::run(const Settings &settings) {
+    std::vector<Entry> entries;
+    if (!read_entries(settings.get_batch_file(), entries)) {
+        return 1;
+    }
+
+    const std::vector<std::string> common_args = get_common_args(settings);
+
+    long ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+    const size_t max_jobs = settings.get_jobs() > 0 ? (size_t)settings.get_jobs() : (ncpus > 0 ? (size_t)ncpus : 1);
+
+    gpdebug("BATCH: {} entries, {} jobs\n", entries.size(), max_jobs);
+
+    const Path &dir = Paths::get_instance().get_sub_cache_dir();
+    const std::string prefix = "batch." + std::to_string(getpid()) + ".";
+
+    int batch_status = 0;
+    size_t next = 0;
+    std::deque<BatchWorker> running;
+    while (next < entries.size() || !running.empty()) {
+        // Keep the pool full
+        while (next < entries.size() && running.size() < max_jobs) {
+            const Entry &entry = entries[next];
+
+            std::vector<std::string> args = {settings.get_argv()[0]};
+            args.insert(args.end(), common_args.begin(), common_args.end());
+            args.insert(args.end(), entry.args.begin(), entry.args.end());
+
+            // The arguments to the program of the batch command line go first, then the ones of the entry
+            const std::vector<std::string> &common_user_args = settings.get_user_args();
+            if (!common_user_args.empty() || !entry.user_args.empty()) {
+                args.push_back("--");
+                args.insert(args.end(), common_user_args.begin(), common_user_args.end());
+                args.insert(args.end(), entry.user_args.begin(), entry.user_args.end());
+            }
+
+            BatchWorker worker;
+            worker.index = next;
+            worker.out_path = dir / (prefix + std::to_string(next) + ".out");
+            worker.err_path = dir / (prefix + std::to_string(next) + ".err");
+
+            gpdebug("BATCH ENTRY {} (line {}): {}\n", next, entry.line, Command(args).to_string());
+            if (!start_worker(args, worker)) {
+                //* The workers started so far are waited for and their outputs replayed, so that no worker is left
+                //* behind and no captured output is lost. Their binaries are not run, the batch is aborted.
+                while (!running.empty()) {
+                    int exit_status;
+                    wait_worker(running.front(), exit_status);
+                    replay_output(running.front().out_path, stdout);
+                    replay_output(running.front().err_path, stderr);
+                    running.pop_front();
+                }
+                gperror("Failed to start the batch entry at line {}, the batch is aborted\n", entry.line);
+                return 1;
+            }
+            running.push_back(worker);
+            next++;
+        }
+
+        //* The workers are waited for in the input order, so that the binaries run in the input order.
+        BatchWorker worker = running.front();
+        running.pop_front();
+
+        int exit_status;
+        const std::vector<std::string> exec_argv = wait_worker(worker, exit_status);
+
+        replay_output(worker.out_path, stdout);
+        replay_output(worker.err_path, stderr);
+
+        const size_t line = entries[worker.index].line;
+        if (exec_argv.empty()) {
+            if (exit_status != 0) {
+                gperror("Batch entry at line {} failed with exit status {}\n", line, exit_status);
+            }
+        } else {
+            const int lease_fd = CacheGC::lease(exec_argv[0]);
+            exit_status = RCC::to_exit_status(Command(exec_argv).run());
+            if (lease_fd >= 0) {
+                close(lease_fd);
+            }
+            gpdebug("BATCH ENTRY {} (line {}) EXIT STATUS: {}\n", worker.index, line, exit_status);
+        }
+
+        if (batch_status == 0 && exit_status != 0) {
+            batch_status = exit_status;
+        }
+    }
+
+    return batch_status;
+}
+
+bool Batch::read_entries(const Path &file, std::vector<Entry> &entries) {
+    std::ifstream in(file.c_str());
+    if (!in) {
+        gperror("Failed to open {}: {}\n", file.string(), strerror(errno));
+        return false;
+    }
+
+    std::string line;
+    size_t line_number = 0;
+    while (std::getline(in, line)) {
+        line_number++;
+        if (!line.empty() && line.back() == '\r') {
+            line.pop_back();
+        }
+        if (line.find_first_not_of(" \t") == std::string::npos) {
+            continue;
+        }
+
+        try {
+            entries.push_back(parse_line(line_number, line));
+        } catch (const std::exception &e) {
+            gperror("{}:{}: {}\n", file.string(), line_number, e.what());
+            return false;
+        }
+    }
+    return true;
+}
+
+// Get a string or an array of strings from a JSON record.
+static std::vector<std::string> get_strings(const JsonValue &value, const std::string &field) {
+    if (value.is_string()) {
+        return {value.get_string()};
+    }
+    if (!value.is_array()) {
+        throw std::runtime_error("\"" + field + "\" must be a string or an array of strings");
+    }
+    std::vector<std::string> strings;
+    for (const auto &item : value.get_array()) {
+        if (!item.is_string()) {
+            throw std::runtime_error("\"" + field + "\" must be a string or an array of strings");
+        }
+        strings.push_back(item.get_string());
+    }
+    return strings;
+}
+
+Batch::Entry Batch::parse_line(size_t line_number, const std::string &line) {
+    Entry entry;
+    entry.line = line_number;
+
+    // A plain snippet
+    const size_t first = line.find_first_not_of(" \t");
+    if (line[first] != '{') {
+        entry.args = {"--code", line};
+        return entry;
+    }
+
+    const JsonValue record = JsonValue::parse(line);
+
+    std::vector<std::string> codes, includes, flags;
+    for (const auto &field : record.get_object()) {
+        if (field.first == "code") {
+            codes = get_strings(field.second, field.first);
+        } else if (field.first == "includes") {
+            includes = get_strings(field.second, field.first);
+        } else if (field.first == "flags") {
+            flags = get_strings(field.second, field.first);
+        } else if (field.first == "args") {
+            entry.user_args = get_strings(field.second, field.first);
+        } else {
+            throw std::runtime_error("unknown field \"" + field.first + "\"");
+        }
+    }
+    if (codes.empty()) {
+        throw std::runtime_error("missing \"code\"");
+    }
+
+    // The flags go first, like `rcc -O2 'code'`
+    entry.args = flags;
+    for (const auto &inc : includes) {
+        entry.args.push_back("--include");
+        entry.args.push_back(inc);
+    }
+    for (const auto &code : codes) {
+        entry.args.push_back("--code");
+        entry.args.push_back(code);
+    }
+    return entry;
+}
+
+std::vector<std::string> Batch::get_common_args(const Settings &settings) {
+    std::vector<std::string> args;
+    const int argc = settings.get_argc();
+    char **argv = settings.get_argv();
+    for (int i = 1; i < argc; i++) {
+        const std::string arg = argv[i];
+        if (arg == "--batch" || arg == "-j" || arg == "--jobs") {
+            i++; // skip the value
+            continue;
+        }
+        if (starts_with(arg, "--batch=") || starts_with(arg, "--jobs=") || (starts_with(arg, "-j") && arg.size() > 2)) {
+            continue;
+        }
+        args.push_back(arg);
+    }
+    return args;
+}
+
+} // namespace rcc
@@ -0,0 +1,45 @@
+#ifndef __RCC_BATCH_H__
+#define __RCC_BATCH_H__
+
+#include "path.h"
+#include "settings.h"
+#include <string>
+#include <vector>
+
+namespace rcc {
+
+// Batch mode, `rcc --batch FILE -j N`.
+//
+// Every non-empty line of the file is an entry, either a code snippet or a JSON record like
+//     {"code": "...", "includes": ["..."], "flags": ["..."], "args": ["..."]}
+// where "code" may also be an array of snippets. The entries are compiled by at most N concurrent workers and run in
+// the input order, each one as soon as it and the entries before it are done. A worker is a forked rcc given the
+// command line of its entry, the other options of the batch command line apply to every entry.
+class Batch {
+  public:
+    // Run the batch file in the settings. Return 0 if all the entries compiled and exited with 0, otherwise the first
+    // non-zero exit status.
+    static int run(const Settings &settings);
+
+  private:
+    // A line of the batch file, see read_entries().
+    struct Entry {
+        size_t line;
+        std::vector<std::string> args; // the rcc arguments of the entry
+        std::vector<std::string> user_args; // the arguments to the program of the entry, after "--"
+    };
+
+    // Read the entries of the batch file. Return false on error.
+    static bool read_entries(const Path &file, std::vector<Entry> &entries);
+
+    // Convert a line of the batch file to the rcc arguments. Throw std::runtime_error on invalid records.
+    static Entry parse_line(size_t line_number, const std::string &line);
+
+    // The arguments of the batch command line which apply to every entry, i.e. without --batch, -j and the arguments
+    // to the program.
+    static std::vector<std::string> get_common_args(const Settings &settings);
+};
+
+} // namespace rcc
+
+#endif // __RCC_BATCH_H__
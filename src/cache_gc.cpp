@@ -0,0 +1,247 @@
+#include "cache_gc.h"
+#include "cache_index.h"
+#include "debug_fmt.h"
+#include "header_units.h"
+#include "paths.h"
+#include "pch_variants.h"
+#include "utils.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+
+namespace rcc {
+
+static const uint64_t EXPIRE_SECONDS = 31 * 24 * 3600; // remove the entries which were not used for this long
+static const uint64_t GRACE_SECONDS = 60; // never remove the entries used this recently
+static const uint64_t PASS_INTERVAL_SECONDS = 3600; // look for expired entries this often
+static const uint64_t LEFTOVER_SECONDS = 24 * 3600; // remove the temporary files this old
+static const double STEP_TIME_LIMIT_MS = 2.0; // the time limit of a step
+static const size_t SLICE_SLOTS = 1024; // the slots to look at between two checks of the time limit
+static const int LEASE_FD = 1000; // the lowest descriptor a lease is passed on to a program with, see lease_for_exec()
+
+// Check if a file is locked by another process, i.e. a shared lock can't be taken. The file is locked exclusively on
+// return if `keep` is true and it's not in use, the descriptor is returned in `fd` then.
+static bool is_locked(const Path &path, bool keep, int &fd) {
+    fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return false; // no such file, no lock
+    }
+    if (flock(fd, LOCK_EX | LOCK_NB) != 0) {
+        close(fd);
+        fd = -1;
+        return true;
+    }
+    if (!keep) {
+        close(fd);
+        fd = -1;
+    }
+    return false;
+}
+
+int CacheGC::lease(const Path &bin_path) {
+    //* O_CLOEXEC: the lock must not leak into the programs and compilers rcc runs, see lease_for_exec().
+    const int fd = open(bin_path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return -1;
+    }
+    int ret;
+    while ((ret = flock(fd, LOCK_SH)) == -1 && errno == EINTR) {
+    }
+    // A GC may have removed the binary while we were waiting for the lock
+    struct stat st;
+    if (ret != 0 || fstat(fd, &st) != 0 || st.st_nlink == 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+void CacheGC::lease_for_exec(const Path &bin_path) {
+    // The one of an rcc which runs this one is not ours
+    unsetenv("RCC_LEASE_FD");
+
+    const int fd = lease(bin_path);
+    if (fd < 0) {
+        return;
+    }
+
+    //* F_DUPFD clears the close-on-exec flag, the copy is the lowest free descriptor from LEASE_FD on.
+    const long open_max = sysconf(_SC_OPEN_MAX);
+    const int high_fd = fcntl(fd, F_DUPFD, open_max > LEASE_FD ? LEASE_FD : (int)open_max / 2);
+    close(fd);
+    if (high_fd < 0) {
+        gpdebug("Failed to pass on the lease of {}: {}\n", bin_path.string(), strerror(errno));
+        return;
+    }
+    setenv("RCC_LEASE_FD", std::to_string(high_fd).c_str(), 1);
+}
+
+bool CacheGC::evict(const std::string &name, uint64_t grace_time) {
+    const Path &dir = Paths::get_instance().get_sub_cache_dir();
+    int lock_fd, bin_fd;
+
+    // A compilation in progress holds the lock of the entry
+    if (is_locked(dir / (name + ".lock"), false, lock_fd)) {
+        return false;
+    }
+    // A running binary holds a lease
+    const Path bin_path = dir / (name + ".bin");
+    if (is_locked(bin_path, true, bin_fd)) {
+        return false;
+    }
+
+    //* A hit counted after the entry was looked at, but before the binary was locked, would lease it right after.
+    //* It has to be checked again while the binary is locked, so that lease() sees the removal.
+    CacheIndex &index = CacheIndex::get_instance();
+    CacheIndex::Entry entry;
+    if (index.lookup(name, entry) && entry.last_use >= grace_time) {
+        if (bin_fd >= 0) {
+            close(bin_fd);
+        }
+        return false;
+    }
+
+    //! Caution: removes files
+    //* The lock file stays, a process may be waiting on it. sweep_leftovers() removes it later.
+    for (const char *ext : {".bin", ".cpp", ".fail"}) {
+        const Path path = dir / (name + ext);
+        if (remove(path.c_str()) != 0 && errno != ENOENT) {
+            gpwarning("Failed to remove {}: {}\n", path.string(), strerror(errno));
+        }
+    }
+    index.remove(name);
+    if (bin_fd >= 0) {
+        close(bin_fd);
+    }
+    gpdebug("GC: removed cache entry {}\n", name);
+    return true;
+}
+
+// Remove the files in a directory with one of the extensions, whose last access or modification is before `before`.
+//* `keep_locked`: a lock file is only removed if nobody holds it.
+static void remove_old_files(const Path &dir,
+                             const std::vector<std::string> &extensions,
+                             time_t before,
+                             bool keep_locked = false) {
+    std::error_code ec;
+    for (fs::directory_iterator it(dir.get_path(), ec), end; !ec && it != end; it.increment(ec)) {
+        const Path path = it->path();
+        if (std::find(extensions.begin(), extensions.end(), path.extension()) == extensions.end()) {
+            continue;
+        }
+        struct stat st;
+        if (lstat(path.c_str(), &st) != 0 || !S_ISREG(st.st_mode) || std::max(st.st_atime, st.st_mtime) >= before) {
+            continue;
+        }
+        int fd;
+        if (keep_locked && is_locked(path, false, fd)) {
+            continue;
+        }
+        //! Caution: removes files
+        if (remove(path.c_str()) == 0) {
+            gpdebug("GC: removed {}\n", path.string());
+        }
+    }
+}
+
+void CacheGC::sweep_leftovers() {
+    const Paths &paths = Paths::get_instance();
+    const time_t t = time(nullptr);
+
+    // The temporary files and compiler logs of interrupted compilations, and the locks of removed entries
+    remove_old_files(paths.get_sub_cache_dir(), {".tmp", ".log"}, t - LEFTOVER_SECONDS);
+    remove_old_files(paths.get_sub_cache_dir(), {".lock"}, t - LEFTOVER_SECONDS, true);
+
+    // The objects of the additional sources, see ObjectCache
+    remove_old_files(paths.get_sub_objects_dir(), {".tmp"}, t - LEFTOVER_SECONDS);
+    remove_old_files(paths.get_sub_objects_dir(), {".o", ".d"}, t - EXPIRE_SECONDS);
+
+    // The PCH variants, see PchVariants, and the leftovers and counters of their builds
+    PchVariants::prune();
+    remove_old_files(paths.get_sub_pch_variants_dir(), {".tmp"}, t - LEFTOVER_SECONDS);
+    remove_old_files(paths.get_sub_pch_variants_dir(), {".lock"}, t - LEFTOVER_SECONDS, true);
+    remove_old_files(paths.get_sub_pch_variants_dir(), {".uses"}, t - EXPIRE_SECONDS);
+
+    // The header units, see HeaderUnits, the locks of their builds and the failures, which are tried again after a while
+    HeaderUnits::prune();
+    remove_old_files(paths.get_sub_header_units_dir(), {".lock"}, t - LEFTOVER_SECONDS, true);
+    remove_old_files(paths.get_sub_header_units_dir(), {".failed"}, t - EXPIRE_SECONDS);
+
+    // The clang++ PCH test results, the ones of replaced PCHs or compilers are never read again
+    remove_old_files(paths.get_sub_clang_pch_test_cache_dir(), {""}, t - EXPIRE_SECONDS);
+}
+
+void CacheGC::collect(uint64_t budget_bytes) {
+    CacheIndex &index = CacheIndex::get_instance();
+    if (!index.is_open()) {
+        return;
+    }
+
+    // The fast path of every rcc process, nothing to do unless over budget or due for a pass
+    const uint64_t t = static_cast<uint64_t>(time(nullptr));
+    const bool over_budget = budget_bytes > 0 && index.get_total_size() > budget_bytes;
+    if (!over_budget && t < index.get_gc_time() + PASS_INTERVAL_SECONDS) {
+        return;
+    }
+    if (!index.try_lock_gc()) {
+        return; // another process is collecting
+    }
+
+    const auto time_begin = now();
+    const uint64_t expire_time = t > EXPIRE_SECONDS ? t - EXPIRE_SECONDS : 0;
+    const uint64_t grace_time = t - GRACE_SECONDS;
+
+    uint64_t cursor = index.get_gc_cursor();
+    size_t num_removed = 0;
+    bool wrapped = false;
+    std::vector<CacheIndex::Entry> entries;
+    while (!wrapped && duration_ms(time_begin) < STEP_TIME_LIMIT_MS) {
+        entries.clear();
+        wrapped = index.scan(cursor, SLICE_SLOTS, entries);
+
+        // The expired ones go first
+        std::vector<CacheIndex::Entry> candidates;
+        for (const auto &entry : entries) {
+            if (entry.last_use < expire_time) {
+                num_removed += evict(entry.name, grace_time);
+            } else if (entry.last_use < grace_time) {
+                candidates.push_back(entry);
+            }
+        }
+        if (budget_bytes == 0 || index.get_total_size() <= budget_bytes) {
+            continue;
+        }
+
+        // Then the ones of the least value in this slice, until the budget is met
+        //* The slice is a sample of the whole cache, like an approximated LRU. An entry which took long to compile is
+        //* worth keeping for longer.
+        auto value = [t](const CacheIndex::Entry &e) { return (e.cost_ms + 100.0) / (t - e.last_use + 1.0); };
+        std::sort(candidates.begin(), candidates.end(),
+                  [&](const CacheIndex::Entry &a, const CacheIndex::Entry &b) { return value(a) < value(b); });
+        for (const auto &entry : candidates) {
+            if (index.get_total_size() <= budget_bytes) {
+                break;
+            }
+            num_removed += evict(entry.name, grace_time);
+        }
+    }
+
+    index.set_gc_cursor(cursor);
+    if (wrapped) {
+        index.set_gc_time(t);
+        sweep_leftovers();
+    }
+    index.unlock_gc();
+
+    gpdebug("GC: {} entries removed, {:.1f} MiB left, {:.2f} ms\n", num_removed, index.get_total_size() / 1048576.0,
+            duration_ms(time_begin));
+}
+
+} // namespace rcc
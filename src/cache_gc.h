@@ -0,0 +1,49 @@
+#ifndef __RCC_CACHE_GC_H__
+#define __RCC_CACHE_GC_H__
+
+#include "path.h"
+#include <cstdint>
+#include <string>
+
+#ifndef RCC_CACHE_BUDGET_MIB
+    // The size of the cache entries to keep, in MiB, 0 for no limit.
+    #define RCC_CACHE_BUDGET_MIB 1024
+#endif
+
+namespace rcc {
+
+// The garbage collector of the cache entries, it runs in small steps in the rcc processes themselves.
+//
+// The GC walks the cache index, see CacheIndex, a slice of slots per step. It removes the entries which were not used
+// for 31 days, and while the cache is over its byte budget, the entries of the least value, where the value of an
+// entry is its compile cost divided by the time since its last use. A step has a time limit of a few milliseconds,
+// and is only taken while the cache is over budget or once an hour, so a cache hit usually costs nothing more than
+// reading the total size from the index.
+//
+// An entry in use is never removed: one which is being compiled holds the lock of the entry, a binary which is running
+// holds a lease, see lease(), and an entry used in the last minute is left alone anyway.
+class CacheGC {
+  public:
+    // Take a GC step if needed, with a budget of `budget_bytes` for the entries, 0 for no limit.
+    static void collect(uint64_t budget_bytes);
+
+    // Take a lease of a binary which is about to run as a child. It's a shared lock on the binary, held by a
+    // close-on-exec descriptor, the caller closes it once the program exited. Return the descriptor, or -1.
+    static int lease(const Path &bin_path);
+
+    // Take a lease of a binary which is about to replace rcc by exec. There is no process left to hold it, so the
+    // descriptor is inherited by the program, and lasts until the program and its children exit. It's moved to a high
+    // number, out of the way of the descriptors the program opens, which is exported as RCC_LEASE_FD.
+    static void lease_for_exec(const Path &bin_path);
+
+  private:
+    // Remove an entry unless it's in use. Return true if it's removed.
+    static bool evict(const std::string &name, uint64_t grace_time);
+
+    // Remove the leftovers of interrupted compilations, stale lock files and old object files.
+    static void sweep_leftovers();
+};
+
+} // namespace rcc
+
+#endif // __RCC_CACHE_GC_H__
@@ -0,0 +1,350 @@
+#include "cache_index.h"
+#include "debug_fmt.h"
+#include "paths.h"
+#include "trace.h"
+#include "utils.h"
+#include <cerrno>
+#include <cstring>
+#include <ctime>
+#include <fcntl.h>
+#include <sched.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace rcc {
+
+static_assert(ATOMIC_INT_LOCK_FREE == 2 && ATOMIC_LLONG_LOCK_FREE == 2, "the cache index needs lock-free atomics");
+static_assert((RCC_CACHE_INDEX_SLOTS & (RCC_CACHE_INDEX_SLOTS - 1)) == 0, "RCC_CACHE_INDEX_SLOTS must be a power of 2");
+
+static const char INDEX_MAGIC[8] = {'R', 'C', 'C', 'I', 'N', 'D', 'E', 'X'};
+static const uint32_t INDEX_VERSION = 3;
+
+static uint64_t now_seconds() {
+    return static_cast<uint64_t>(time(nullptr));
+}
+
+CacheIndex &CacheIndex::get_instance() {
+    static CacheIndex instance;
+    return instance;
+}
+
+CacheIndex::CacheIndex() {
+    Trace::Span span("open cache index");
+    if (!open_index(Paths::get_instance().get_cache_index_path())) {
+        gpwarning("The cache index is not available, the cache entries are not tracked\n");
+    }
+}
+
+CacheIndex::~CacheIndex() {
+    if (map != nullptr) {
+        munmap(map, map_size);
+    }
+    if (fd >= 0) {
+        close(fd);
+    }
+}
+
+// Check if the header read from the file is the one of a complete index.
+static bool is_valid_header(const char *magic, uint32_t version, uint32_t num_slots) {
+    return memcmp(magic, INDEX_MAGIC, sizeof(INDEX_MAGIC)) == 0 && version == INDEX_VERSION &&
+           num_slots == RCC_CACHE_INDEX_SLOTS;
+}
+
+bool CacheIndex::open_index(const Path &path) {
+    //* O_CLOEXEC: the compiler and the program that replaces rcc don't need it, the mapping is dropped by exec anyway.
+    fd = open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        gpdebug("open(): {}: {}\n", path.string(), strerror(errno));
+        return false;
+    }
+
+    map_size = sizeof(Header) + sizeof(Slot) * RCC_CACHE_INDEX_SLOTS;
+
+    Header on_disk;
+    const bool valid = pread(fd, &on_disk, sizeof(on_disk), 0) == (ssize_t)sizeof(on_disk) &&
+                       is_valid_header(on_disk.magic, on_disk.version, on_disk.num_slots);
+
+    //* The file is sparse, the untouched slots take no disk space.
+    if (!valid && !init_index()) {
+        return false;
+    }
+    if (map == nullptr) {
+        void *addr = mmap(nullptr, map_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (addr == MAP_FAILED) {
+            gpdebug("mmap(): {}: {}\n", path.string(), strerror(errno));
+            return false;
+        }
+        map = addr;
+        header = static_cast<Header *>(map);
+        slots = reinterpret_cast<Slot *>(header + 1);
+        mask = RCC_CACHE_INDEX_SLOTS - 1;
+    }
+    return true;
+}
+
+bool CacheIndex::init_index() {
+    int ret;
+    while ((ret = flock(fd, LOCK_EX)) == -1 && errno == EINTR) {
+    }
+    if (ret != 0) {
+        return false;
+    }
+
+    // Another process may have created it while we were waiting
+    Header on_disk;
+    if (pread(fd, &on_disk, sizeof(on_disk), 0) == (ssize_t)sizeof(on_disk) &&
+        is_valid_header(on_disk.magic, on_disk.version, on_disk.num_slots)) {
+        flock(fd, LOCK_UN);
+        return true;
+    }
+
+    gpdebug("Creating the cache index\n");
+    if (ftruncate(fd, 0) != 0 || ftruncate(fd, map_size) != 0) {
+        flock(fd, LOCK_UN);
+        return false;
+    }
+    void *addr = mmap(nullptr, map_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (addr == MAP_FAILED) {
+        flock(fd, LOCK_UN);
+        return false;
+    }
+    map = addr;
+    header = static_cast<Header *>(map);
+    slots = reinterpret_cast<Slot *>(header + 1);
+    mask = RCC_CACHE_INDEX_SLOTS - 1;
+    header->version = INDEX_VERSION;
+    header->num_slots = RCC_CACHE_INDEX_SLOTS;
+
+    // Import the entries of the cache directory, e.g. the ones of an older rcc
+    std::error_code ec;
+    const Path &dir = Paths::get_instance().get_sub_cache_dir();
+    for (fs::directory_iterator it(dir.get_path(), ec), end; !ec && it != end; it.increment(ec)) {
+        const Path bin_path = it->path();
+        struct stat st;
+        if (bin_path.extension() != ".bin" || stat(bin_path.c_str(), &st) != 0) {
+            continue;
+        }
+        const std::string name = get_entry_name(bin_path);
+        if (!add(name, get_entry_size(bin_path), 0)) {
+            break; // full
+        }
+        Slot *slot = find(name);
+        slot->ctime = st.st_mtime;
+        slot->last_use = std::max<uint64_t>(st.st_atime, st.st_mtime);
+    }
+
+    //* The magic goes last, a crash before it makes the next process start over.
+    std::atomic_thread_fence(std::memory_order_release);
+    memcpy(header->magic, INDEX_MAGIC, sizeof(INDEX_MAGIC));
+    flock(fd, LOCK_UN);
+    return true;
+}
+
+uint64_t CacheIndex::get_entry_size(const Path &bin_path) {
+    Path cpp_path = bin_path;
+    cpp_path.replace_extension(".cpp");
+    uint64_t size = 0;
+    struct stat st;
+    if (stat(bin_path.c_str(), &st) == 0) {
+        size += st.st_size;
+    }
+    if (stat(cpp_path.c_str(), &st) == 0) {
+        size += st.st_size;
+    }
+    return size;
+}
+
+uint64_t CacheIndex::hash_name(const std::string &name) {
+    return hash128_string(name).low;
+}
+
+uint32_t CacheIndex::wait_ready(const Slot &slot) {
+    //* A slot is BUSY while its name is copied, a few instructions. One which stays BUSY belongs to a process which
+    //* died right there, it's treated as a slot of another entry.
+    uint32_t state = slot.state.load(std::memory_order_acquire);
+    for (int i = 0; state == BUSY && i < 1000; i++) {
+        sched_yield();
+        state = slot.state.load(std::memory_order_acquire);
+    }
+    return state;
+}
+
+CacheIndex::Slot *CacheIndex::find(const std::string &name) const {
+    if (!is_open() || name.size() >= sizeof(Slot::name)) {
+        return nullptr;
+    }
+    const uint64_t start = hash_name(name);
+    for (uint64_t i = 0; i <= mask; i++) {
+        Slot &slot = slots[(start + i) & mask];
+        const uint32_t state = wait_ready(slot);
+        if (state == EMPTY) {
+            return nullptr;
+        }
+        if (state == USED && name == slot.name) {
+            return &slot;
+        }
+    }
+    return nullptr;
+}
+
+CacheIndex::Slot *CacheIndex::find_or_insert(const std::string &name) {
+    if (!is_open() || name.size() >= sizeof(Slot::name)) {
+        return nullptr;
+    }
+    const uint64_t start = hash_name(name);
+    for (int attempt = 0; attempt < 8; attempt++) {
+        // The chain is searched to its end first, a removed slot on the way may be reused
+        Slot *free_slot = nullptr;
+        uint32_t free_state = EMPTY;
+        for (uint64_t i = 0; i <= mask; i++) {
+            Slot &slot = slots[(start + i) & mask];
+            const uint32_t state = wait_ready(slot);
+            if (state == USED && name == slot.name) {
+                return &slot;
+            }
+            if ((state == EMPTY || state == REMOVED) && free_slot == nullptr) {
+                free_slot = &slot;
+                free_state = state;
+            }
+            if (state == EMPTY) {
+                break;
+            }
+        }
+        if (free_slot == nullptr || header->num_used.load() >= (mask + 1) / 4 * 3) {
+            return nullptr; // full, the entry is not tracked
+        }
+
+        // Another process may claim the same slot, look again then
+        if (!free_slot->state.compare_exchange_strong(free_state, BUSY, std::memory_order_acquire)) {
+            continue;
+        }
+        memset(free_slot->name, 0, sizeof(free_slot->name));
+        memcpy(free_slot->name, name.data(), name.size());
+        const uint64_t t = now_seconds();
+        free_slot->size = 0;
+        free_slot->ctime = t;
+        free_slot->last_use = t;
+        free_slot->hits = 0;
+        free_slot->cost_ms = 0;
+        free_slot->tier = 0;
+        free_slot->state.store(USED, std::memory_order_release);
+        header->num_used++;
+        return free_slot;
+    }
+    return nullptr;
+}
+
+bool CacheIndex::lookup(const std::string &name, Entry &entry) const {
+    const Slot *slot = find(name);
+    if (slot == nullptr) {
+        return false;
+    }
+    entry = {name,       slot->size,    slot->ctime, slot->last_use,
+             slot->hits, slot->cost_ms, static_cast<uint32_t>(slot->tier.load())};
+    return true;
+}
+
+bool CacheIndex::add(const std::string &name, uint64_t size, uint64_t cost_ms) {
+    Slot *slot = find_or_insert(name);
+    if (slot == nullptr) {
+        return false;
+    }
+    header->total_size += size - slot->size.exchange(size); // wraps around if it shrinks
+    slot->cost_ms = cost_ms;
+    slot->last_use = now_seconds();
+    return true;
+}
+
+bool CacheIndex::count_hit(const std::string &name, uint64_t &hits, uint32_t &tier) {
+    Slot *slot = find(name);
+    if (slot == nullptr) {
+        return false;
+    }
+    hits = slot->hits.fetch_add(1, std::memory_order_relaxed) + 1;
+    slot->last_use.store(now_seconds(), std::memory_order_relaxed);
+    tier = static_cast<uint32_t>(slot->tier.load());
+    return true;
+}
+
+bool CacheIndex::set_tier(const std::string &name, uint32_t tier) {
+    Slot *slot = find(name);
+    if (slot == nullptr) {
+        return false;
+    }
+    slot->tier = tier;
+    return true;
+}
+
+bool CacheIndex::exchange_tier(const std::string &name, uint32_t expected, uint32_t desired) {
+    Slot *slot = find(name);
+    uint64_t value = expected;
+    return slot != nullptr && slot->tier.compare_exchange_strong(value, desired);
+}
+
+void CacheIndex::remove(const std::string &name) {
+    Slot *slot = find(name);
+    uint32_t expected = USED;
+    if (slot != nullptr && slot->state.compare_exchange_strong(expected, REMOVED)) {
+        header->num_used--;
+        header->total_size -= slot->size;
+    }
+}
+
+std::vector<CacheIndex::Entry> CacheIndex::get_entries() const {
+    std::vector<Entry> entries;
+    if (!is_open()) {
+        return entries;
+    }
+    for (uint64_t i = 0; i <= mask; i++) {
+        const Slot &slot = slots[i];
+        if (slot.state.load(std::memory_order_acquire) == USED) {
+            entries.push_back({slot.name, slot.size, slot.ctime, slot.last_use, slot.hits, slot.cost_ms,
+                               static_cast<uint32_t>(slot.tier.load())});
+        }
+    }
+    return entries;
+}
+
+bool CacheIndex::scan(uint64_t &cursor, size_t max_slots, std::vector<Entry> &entries) const {
+    if (!is_open()) {
+        return true;
+    }
+    for (size_t n = 0; n < max_slots; n++) {
+        const Slot &slot = slots[cursor & mask];
+        if (slot.state.load(std::memory_order_acquire) == USED) {
+            entries.push_back({slot.name, slot.size, slot.ctime, slot.last_use, slot.hits, slot.cost_ms,
+                               static_cast<uint32_t>(slot.tier.load())});
+        }
+        cursor = (cursor + 1) & mask;
+        if (cursor == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool CacheIndex::try_lock_gc() {
+    return is_open() && flock(fd, LOCK_EX | LOCK_NB) == 0;
+}
+
+void CacheIndex::unlock_gc() {
+    flock(fd, LOCK_UN);
+}
+
+void CacheIndex::clear() {
+    if (!is_open()) {
+        return;
+    }
+    // Only the slots ever used are written, the others stay sparse
+    for (uint64_t i = 0; i <= mask; i++) {
+        if (slots[i].state.load(std::memory_order_relaxed) != EMPTY) {
+            slots[i].state.store(EMPTY, std::memory_order_relaxed);
+        }
+    }
+    header->num_used = 0;
+    header->total_size = 0;
+}
+
+} // namespace rcc
@@ -0,0 +1,154 @@
+#ifndef __RCC_CACHE_INDEX_H__
+#define __RCC_CACHE_INDEX_H__
+
+#include "path.h"
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#ifndef RCC_CACHE_INDEX_SLOTS
+    // The number of slots of the cache index, a power of 2. At most 3/4 of them are used.
+    #define RCC_CACHE_INDEX_SLOTS 65536
+#endif
+
+namespace rcc {
+
+// The index of the cache entries, a memory-mapped file in the cache root shared by all rcc processes.
+//
+// A cache entry is the set of files `<name>.{cpp,bin,fail,lock}` in the sub cache directory, where the name is the
+// hash of the code. The index maps the name to the size of the entry, the time it was created and last used, the hits,
+// the time it took to compile and the tier, see Tier. It's an open addressing hash table of fixed-size slots, so lookups, GC, stats
+// and --clean-cache never list the directory.
+//
+// There is no global lock: a slot is claimed with a compare-and-swap of its state, and the counters are updated with
+// atomics. The file is only locked while it's created, which imports the entries found in the directory, and by the
+// GC, which only keeps other GCs away.
+class CacheIndex {
+  public:
+    struct Entry {
+        std::string name;
+        uint64_t size; // bytes of the source and the binary
+        uint64_t ctime; // seconds since the epoch
+        uint64_t last_use; // seconds since the epoch
+        uint64_t hits;
+        uint64_t cost_ms; // the compile time, 0 if unknown
+        uint32_t tier; // see Tier::Level
+    };
+
+    // Get the index of the cache directory, it's mapped on the first call.
+    static CacheIndex &get_instance();
+
+    ~CacheIndex();
+
+    CacheIndex(const CacheIndex &) = delete;
+    CacheIndex &operator=(const CacheIndex &) = delete;
+
+    // Check if the index is usable. Without it, every lookup misses and nothing is recorded.
+    bool is_open() const { return slots != nullptr; }
+
+    // Look up an entry. Return false if it's not in the index.
+    bool lookup(const std::string &name, Entry &entry) const;
+
+    // Add an entry, or update its size and compile cost if it exists. The hits are kept.
+    bool add(const std::string &name, uint64_t size, uint64_t cost_ms);
+
+    // Count a hit of an entry and mark it as used now, get the hits with this one and the tier. Return false if it's
+    // not in the index.
+    bool count_hit(const std::string &name, uint64_t &hits, uint32_t &tier);
+
+    // Set the tier of an entry. Return false if it's not in the index.
+    bool set_tier(const std::string &name, uint32_t tier);
+
+    // Set the tier of an entry if it's `expected`. Return false if it's not in the index or has another tier.
+    bool exchange_tier(const std::string &name, uint32_t expected, uint32_t desired);
+
+    // Remove an entry from the index, the files are left alone.
+    void remove(const std::string &name);
+
+    // Get all the entries.
+    std::vector<Entry> get_entries() const;
+
+    // Get the entries of at most `max_slots` slots starting at `cursor`, which is advanced. Return true if the scan
+    // wrapped around to the first slot. This is how the GC walks the index in small steps.
+    bool scan(uint64_t &cursor, size_t max_slots, std::vector<Entry> &entries) const;
+
+    // The sum of the sizes of the entries.
+    uint64_t get_total_size() const { return is_open() ? header->total_size.load() : 0; }
+
+    // The state of the GC shared by all processes, see CacheGC.
+    uint64_t get_gc_cursor() const { return header->gc_cursor.load(); }
+    void set_gc_cursor(uint64_t cursor) { header->gc_cursor = cursor; }
+    uint64_t get_gc_time() const { return header->gc_time.load(); }
+    void set_gc_time(uint64_t time) { header->gc_time = time; }
+
+    // Lock the index for the GC, so that one process collects at a time. Return false if another one does.
+    bool try_lock_gc();
+    void unlock_gc();
+
+    // Remove all the entries from the index.
+    void clear();
+
+    // The name of the cache entry of a file, i.e. the file name without the extension.
+    static std::string get_entry_name(const Path &path) { return path.stem(); }
+
+    // The sum of the sizes of the source and the binary of a cache entry.
+    static uint64_t get_entry_size(const Path &bin_path);
+
+  private:
+    enum State : uint32_t { EMPTY, BUSY, USED, REMOVED };
+
+    //* The atomics have to be lock-free, so that they live in the shared memory and not in a process-local lock.
+    struct Slot {
+        std::atomic<uint32_t> state;
+        char name[28]; // NUL-terminated, written while BUSY
+        std::atomic<uint64_t> size;
+        std::atomic<uint64_t> ctime;
+        std::atomic<uint64_t> last_use;
+        std::atomic<uint64_t> hits;
+        std::atomic<uint64_t> cost_ms;
+        std::atomic<uint64_t> tier;
+    };
+
+    struct Header {
+        char magic[8];
+        uint32_t version;
+        uint32_t num_slots;
+        std::atomic<uint64_t> num_used;
+        std::atomic<uint64_t> total_size;
+        std::atomic<uint64_t> gc_cursor; // the next slot to look at
+        std::atomic<uint64_t> gc_time; // when the GC last finished a pass over all the slots
+        uint64_t reserved[2];
+    };
+
+    CacheIndex();
+
+    // Map the index file, create and populate it if needed.
+    bool open_index(const Path &path);
+
+    // Initialize the index file and import the entries in the sub cache directory. The file is locked.
+    bool init_index();
+
+    // Find the slot of an entry, or nullptr.
+    Slot *find(const std::string &name) const;
+
+    // Find or claim the slot of an entry, or nullptr if the index is full.
+    Slot *find_or_insert(const std::string &name);
+
+    // Wait until a slot is no longer BUSY, return the state.
+    static uint32_t wait_ready(const Slot &slot);
+
+    static uint64_t hash_name(const std::string &name);
+
+  private:
+    int fd{-1};
+    void *map{nullptr};
+    size_t map_size{0};
+    Header *header{nullptr};
+    Slot *slots{nullptr};
+    uint64_t mask{0};
+};
+
+} // namespace rcc
+
+#endif // __RCC_CACHE_INDEX_H__
@@ -0,0 +1,260 @@
+#include "classifier.h"
+#include <algorithm>
+#include <cctype>
+#include <cstring>
+
+namespace rcc {
+
+// A statement or a declaration starts with one of these, they never start an expression to print.
+static const char *const STATEMENT_KEYWORDS[] = {
+    "if",        "else",     "for",      "while",         "do",           "switch",   "case",      "default",
+    "return",    "break",    "continue", "goto",          "try",          "throw",    "delete",    "using",
+    "typedef",   "namespace", "template", "typename",     "struct",       "class",    "union",     "enum",
+    "static",    "extern",   "const",    "constexpr",     "consteval",    "constinit", "volatile", "inline",
+    "auto",      "register", "mutable",  "thread_local",  "static_assert", "friend",  "virtual",   "explicit",
+    "co_return", "asm",
+};
+
+// A builtin type starts a declaration, unless it's a functional cast like `double(x)` or `int{x}`.
+static const char *const TYPE_KEYWORDS[] = {
+    "int",     "long",   "short",    "char",     "bool",     "float",   "double",
+    "void",    "signed", "unsigned", "wchar_t",  "char8_t",  "char16_t", "char32_t",
+};
+
+// The other keywords, they may be next to an identifier in an expression, e.g. `new Foo` or `a and b`.
+static const char *const OTHER_KEYWORDS[] = {
+    "and",          "or",          "not",        "xor",        "bitand",     "bitor",      "compl",
+    "and_eq",       "or_eq",       "xor_eq",     "not_eq",     "new",        "sizeof",     "alignof",
+    "typeid",       "noexcept",    "decltype",   "this",       "true",       "false",      "nullptr",
+    "operator",     "static_cast", "dynamic_cast", "const_cast", "reinterpret_cast", "co_await", "co_yield",
+    "requires",
+};
+
+template <size_t N> static bool is_one_of(const std::string &word, const char *const (&words)[N]) {
+    return std::find_if(words, words + N, [&](const char *w) { return word == w; }) != words + N;
+}
+
+static bool is_keyword(const std::string &word) {
+    return is_one_of(word, STATEMENT_KEYWORDS) || is_one_of(word, TYPE_KEYWORDS) || is_one_of(word, OTHER_KEYWORDS);
+}
+
+// An identifier like FOO or REP may be a macro, which may end a statement by itself.
+static bool is_macro_like(const std::string &word) {
+    bool has_letter = false;
+    for (char c : word) {
+        if (std::islower((unsigned char)c)) {
+            return false;
+        }
+        has_letter = has_letter || std::isupper((unsigned char)c);
+    }
+    return has_letter && word.size() >= 2;
+}
+
+static bool is_identifier_char(char c) {
+    return std::isalnum((unsigned char)c) || c == '_';
+}
+
+const char *SnippetClassifier::kind_to_string(Kind kind) {
+    switch (kind) {
+    case EXPRESSION: return "expression";
+    case STATEMENT: return "statement";
+    default: return "unsure";
+    }
+}
+
+bool SnippetClassifier::skip_literal(const std::string &code, size_t &i) {
+    // The encoding prefix, u8, u, U or L
+    while (i < code.size() && code[i] != '"' && code[i] != '\'' && code[i] != 'R') {
+        i++;
+    }
+
+    // A raw string, R"delimiter( ... )delimiter"
+    if (code[i] == 'R') {
+        const size_t open = code.find('(', i + 2);
+        if (open == std::string::npos) {
+            return false;
+        }
+        const std::string end = ")" + code.substr(i + 2, open - i - 2) + "\"";
+        const size_t close = code.find(end, open + 1);
+        if (close == std::string::npos) {
+            return false;
+        }
+        i = close + end.size();
+        return true;
+    }
+
+    const char quote = code[i++];
+    while (i < code.size() && code[i] != quote) {
+        if (code[i] == '\\') {
+            i++;
+        } else if (code[i] == '\n') {
+            return false;
+        }
+        i++;
+    }
+    if (i >= code.size()) {
+        return false;
+    }
+    i++; // the closing quote
+    return true;
+}
+
+bool SnippetClassifier::tokenize(const std::string &code, std::vector<Token> &tokens) {
+    int depth = 0;
+    bool line_start = true;
+    size_t i = 0;
+    while (i < code.size()) {
+        const char c = code[i];
+        if (c == '\n') {
+            line_start = true;
+            i++;
+            continue;
+        }
+        if (std::isspace((unsigned char)c)) {
+            i++;
+            continue;
+        }
+
+        // Comments
+        if (code.compare(i, 2, "//") == 0) {
+            i = code.find('\n', i);
+            i = i == std::string::npos ? code.size() : i;
+            continue;
+        }
+        if (code.compare(i, 2, "/*") == 0) {
+            i = code.find("*/", i + 2);
+            if (i == std::string::npos) {
+                return false;
+            }
+            i += 2;
+            continue;
+        }
+
+        // Whatever a preprocessor directive does, it's beyond a tokenizer
+        if (c == '#' && line_start) {
+            return false;
+        }
+        line_start = false;
+
+        const size_t begin = i;
+        if (std::isalpha((unsigned char)c) || c == '_') {
+            while (i < code.size() && is_identifier_char(code[i])) {
+                i++;
+            }
+            const std::string word = code.substr(begin, i - begin);
+            const bool is_prefix = word == "R" || word == "u8" || word == "u" || word == "U" || word == "L" ||
+                                   word == "u8R" || word == "uR" || word == "UR" || word == "LR";
+            if (is_prefix && i < code.size() && (code[i] == '"' || (code[i] == '\'' && word.back() != 'R'))) {
+                i = begin;
+                if (!skip_literal(code, i)) {
+                    return false;
+                }
+                tokens.push_back({LITERAL, code.substr(begin, i - begin), depth});
+            } else {
+                tokens.push_back({IDENTIFIER, word, depth});
+            }
+        } else if (std::isdigit((unsigned char)c) || (c == '.' && i + 1 < code.size() && std::isdigit(code[i + 1]))) {
+            // Numbers with digit separators, suffixes, exponents and user-defined literals like 1'000'000ull or 1e-3
+            while (i < code.size()) {
+                const char d = code[i];
+                if ((d == '+' || d == '-') && std::strchr("eEpP", code[i - 1]) != nullptr) {
+                    i++;
+                } else if (is_identifier_char(d) || d == '.' || d == '\'') {
+                    i++;
+                } else {
+                    break;
+                }
+            }
+            tokens.push_back({LITERAL, code.substr(begin, i - begin), depth});
+        } else if (c == '"' || c == '\'') {
+            if (!skip_literal(code, i)) {
+                return false;
+            }
+            tokens.push_back({LITERAL, code.substr(begin, i - begin), depth});
+        } else if (code.compare(i, 2, "::") == 0 || code.compare(i, 2, "->") == 0 || code.compare(i, 2, "<<") == 0 ||
+                   code.compare(i, 2, ">>") == 0 || code.compare(i, 2, "<=") == 0 || code.compare(i, 2, ">=") == 0) {
+            tokens.push_back({PUNCTUATOR, code.substr(i, 2), depth});
+            i += 2;
+        } else {
+            if (c == ')' || c == ']' || c == '}') {
+                depth--;
+            }
+            tokens.push_back({PUNCTUATOR, std::string(1, c), depth});
+            if (c == '(' || c == '[' || c == '{') {
+                depth++;
+            }
+            i++;
+        }
+    }
+    return depth == 0;
+}
+
+SnippetClassifier::Kind SnippetClassifier::classify(const std::string &code) {
+    std::vector<Token> tokens;
+    if (!tokenize(code, tokens)) {
+        return UNSURE;
+    }
+    for (const auto &token : tokens) {
+        if (token.depth < 0) {
+            return UNSURE; // unbalanced brackets
+        }
+    }
+
+    // Nothing to print, or a complete statement
+    if (tokens.empty() || tokens.back().text == ";" || tokens.back().text == "}") {
+        return STATEMENT;
+    }
+
+    const Token &first = tokens.front();
+    if (first.type == IDENTIFIER) {
+        if (is_one_of(first.text, STATEMENT_KEYWORDS)) {
+            return STATEMENT;
+        }
+        if (is_one_of(first.text, TYPE_KEYWORDS) &&
+            (tokens.size() == 1 || (tokens[1].text != "(" && tokens[1].text != "{"))) {
+            return STATEMENT;
+        }
+    }
+
+    bool unsure = false;
+    bool seen_less = false;
+    for (size_t i = 0; i < tokens.size(); i++) {
+        const Token &token = tokens[i];
+        if (token.depth != 0) {
+            continue;
+        }
+        const Token *next = i + 1 < tokens.size() ? &tokens[i + 1] : nullptr;
+
+        if (token.text == ";") {
+            return STATEMENT; // more than one statement
+        }
+
+        if (token.type == IDENTIFIER) {
+            // A declaration like `string s` or `Foo x`
+            if (next && next->type == IDENTIFIER && !is_keyword(token.text) && !is_keyword(next->text)) {
+                return STATEMENT;
+            }
+            // A macro at the start or at the end, like `REP(i, n) x`, `FOO` or `FOO(x)`, may complete the statement
+            if (is_macro_like(token.text)) {
+                if (!next) {
+                    unsure = true;
+                } else if (next->text == "(") {
+                    size_t close = i + 2;
+                    while (close < tokens.size() && !(tokens[close].depth == 0 && tokens[close].text == ")")) {
+                        close++;
+                    }
+                    unsure = unsure || i == 0 || close + 1 == tokens.size();
+                }
+            }
+        } else if (token.text == "<") {
+            seen_less = true;
+        } else if ((token.text == ">" || token.text == ">>") && seen_less && next && next->type == IDENTIFIER &&
+                   !is_keyword(next->text)) {
+            unsure = true; // `vector<int> v` or `a < b > c`
+        }
+    }
+
+    return unsure ? UNSURE : EXPRESSION;
+}
+
+} // namespace rcc
@@ -0,0 +1,47 @@
+#ifndef __RCC_CLASSIFIER_H__
+#define __RCC_CLASSIFIER_H__
+
+#include <string>
+#include <vector>
+
+namespace rcc {
+
+// A lexical classifier of code snippets, it decides the auto-wrap without a trial compilation.
+//
+// A snippet which does not end with ';' or '}' only compiles as is if a macro supplies the end of the statement, so
+// the question is whether `cout << (snippet) << endl;` compiles. The snippet is tokenized, skipping comments and
+// literals, and only the tokens outside of any brackets are looked at:
+//     - a ';', a leading statement keyword, a declaration like `int x` or `Foo x` make it a STATEMENT,
+//     - an all-caps identifier may be a macro, a `vector<int> v` may be a declaration, these are UNSURE,
+//     - anything else is an EXPRESSION.
+// A wrong STATEMENT only changes the compiler errors shown, as neither variant compiles then. A macro may make an
+// EXPRESSION wrong, e.g. `say(7)` with `#define say(x) cout << x;`, the original code is compiled after the auto-wrapped
+// one failed then, see RCC::try_code_normal().
+class SnippetClassifier {
+  public:
+    enum Kind { EXPRESSION, STATEMENT, UNSURE };
+
+    // Classify the code snippet.
+    static Kind classify(const std::string &code);
+
+    static const char *kind_to_string(Kind kind);
+
+  private:
+    enum TokenType { IDENTIFIER, LITERAL, PUNCTUATOR };
+
+    struct Token {
+        TokenType type;
+        std::string text;
+        int depth; // the bracket depth of the token, 0 at the top level
+    };
+
+    // Split the code into tokens. Return false on a preprocessor directive or unterminated comments and literals.
+    static bool tokenize(const std::string &code, std::vector<Token> &tokens);
+
+    // Skip a string or character literal starting at `i`, including a raw string. Return false if unterminated.
+    static bool skip_literal(const std::string &code, size_t &i);
+};
+
+} // namespace rcc
+
+#endif // __RCC_CLASSIFIER_H__
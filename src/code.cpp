@@ -1,85 +1,494 @@
 #include "code.h"
+#include "cache_index.h"
 #include "debug_fmt.h"
+#include "header_units.h"
+#include "launcher.h"
+#include "objects.h"
+#include "pch_variants.h"
 #include "rcc.h"
+#include "tier.h"
+#include "trace.h"
+#include <cstdio>
+#include <fcntl.h>
+#include <sstream>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
 
 namespace rcc {
 
 // Init the output cpp and bin paths.
-// This requires the full_code to be generated first.
+//* The name is a hash of what the full code is generated from, which is only generated on a miss.
 void RCCode::init_cpp_bin_paths() {
-    if (!full_code_generated) {
-        gen_full_code();
-    }
+    Trace::Span span("hash");
     // the output cpp file and executable file's name
-    const std::string filename = RCC::gen_first_hash_filename(settings, full_code);
+    const std::string filename =
+        RCC::gen_first_hash_filename(settings, code, has_functions ? functions : settings.get_functions(), objects);
     paths.get_src_bin_full_path(filename, cpp_path, bin_path);
 }
 
-// Check if the binary is cached and the content matches.
-//* The file hash may collide, so we need to check the content as well.
+// Check if the binary is cached.
+//* The file name is a 128-bit hash of the full code, which does not collide in practice, so a hit is one stat() of the
+//* binary. A binary is only ever published by rename(), a regular non-empty executable file is a complete one. The
+//* paranoid mode compares the cached source byte-for-byte as well.
 bool RCCode::is_cached() {
-    if (bin_path.exists()) {
-        if (!full_code_generated) {
-            gen_full_code();
-        }
+    Trace::Span span("cache lookup", code_name);
+    CacheIndex &index = CacheIndex::get_instance();
+    const std::string name = CacheIndex::get_entry_name(bin_path);
+    CacheIndex::Entry entry;
+    const bool indexed = index.lookup(name, entry);
 
-        const std::string code_old = cpp_path.read_file();
-        if (code_old == full_code) {
-            return true;
+    struct stat st;
+    if (stat(bin_path.c_str(), &st) != 0 || !S_ISREG(st.st_mode) || st.st_size == 0 || !(st.st_mode & S_IXUSR)) {
+        if (indexed) {
+            index.remove(name); // removed behind our back
         }
+        return false;
+    }
+    //* An object is only replaced by one compiled for a changed header, the binaries linked before are stale.
+    for (const auto &object : objects) {
+        struct stat obj_st;
+        const bool newer = stat(object.c_str(), &obj_st) == 0 &&
+                           (obj_st.st_mtim.tv_sec != st.st_mtim.tv_sec ? obj_st.st_mtim.tv_sec > st.st_mtim.tv_sec
+                                                                       : obj_st.st_mtim.tv_nsec > st.st_mtim.tv_nsec);
+        if (objects_changed || newer) {
+            gpdebug("The {} binary is older than its object {}\n", code_name, object.string());
+            return false;
+        }
+    }
+    if (!indexed) {
+        index.add(name, CacheIndex::get_entry_size(bin_path), 0); // e.g. the index was full
+    }
+    if (!settings.get_flag_paranoid()) {
+        return true;
+    }
 
-        gpdebug(red_bold, "WARNING: hash collided but content does not match!\n");
-        gpdebug("{}:\n{}", styled("Old Code", fg(color::red)), code_old);
-        gpdebug("{}:\n{}", styled("New Code", fg(color::red)), full_code);
+    if (!full_code_generated) {
+        gen_full_code();
     }
+    const std::string code_old = cpp_path.exists() ? cpp_path.read_file() : "";
+    if (code_old == full_code) {
+        return true;
+    }
+
+    gpdebug(red_bold, "WARNING: hash collided but content does not match!\n");
+    gpdebug("{}:\n{}", styled("Old Code", fg(color::red)), code_old);
+    gpdebug("{}:\n{}", styled("New Code", fg(color::red)), full_code);
     return false;
 }
 
 // Write the full code to the cpp file and compile it.
 // This requires the full_code to be generated first.
 bool RCCode::compile(bool silent) {
+    const auto ts = fg(color::dodger_blue) | emphasis::bold;
+    gpdebug(ts, ">>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>\n");
+
+    //* The output is captured the same way as a background compilation, so that a failure can be recorded.
+    const bool result = start_compile(silent) && wait_compile();
+
+    gpdebug(ts, "<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<\n");
+
+    return result;
+}
+
+// Write the full code to the cpp file and start compiling it in the background.
+bool RCCode::start_compile(bool silent) {
+    if (!write_cpp_file()) {
+        return false;
+    }
+
+    compile_silent = silent;
+    compile_uses_header_units = !header_units_failed && cs.uses_header_units();
+    init_tmp_bin_path();
+    Command cmd = RCC::gen_compile_cmd(cpp_path, tmp_bin_path, objects, cs, compile_uses_header_units);
+    compile_cmd = cmd.to_string();
+
+    // The output goes to a file, keep the colors if it will be replayed to a terminal.
+    if (!silent && isatty(fileno(stderr))) {
+        cmd.arg("-fdiagnostics-color=always");
+    }
+    compile_log_path = tmp_bin_path.string() + ".log";
+    cmd.redirect_output(compile_log_path);
+    // The compiler runs its own children (cc1plus, as, ld), kill_process() kills them all
+    cmd.new_process_group();
+
+    gpdebug(fg(terminal_color::yellow) | emphasis::bold, "Compiling {} code\n", code_name);
+    gpdebug("{}\n", cmd.to_string());
+
+    compile_begin = now();
+    compile_pid = cmd.spawn();
+    if (compile_pid < 0) {
+        gpwarning("posix_spawn(): {}\n", strerror(errno));
+        return false;
+    }
+
+    // The default PCHs don't cover the flags or the includes, count them while the compiler runs
+    if (!compile_uses_header_units && cs.needs_pch_variant()) {
+        PchVariants::count_use(cs.get_pch_signature(), settings.get_pch_threshold());
+    }
+    if (cs.wants_header_units()) {
+        HeaderUnits::build_if_needed(cs);
+    }
+    return true;
+}
+
+// Check if a compilation which imported the header unit failed because of it: the compiler crashed, or the diagnostics
+// point at the files of the header unit, e.g. it can't read the compiled header unit.
+bool RCCode::is_header_unit_failure(int status, const std::string &output) const {
+    if (status == -1 || WIFSIGNALED(status) || output.find("internal compiler error") != std::string::npos ||
+        output.find("PLEASE submit a bug report") != std::string::npos) {
+        return true;
+    }
+
+    const std::string units_dir = HeaderUnits::get_units_dir(cs.get_header_units_key()).string() + "/";
+    std::istringstream lines(output);
+    std::string line;
+    while (std::getline(lines, line)) {
+        const size_t pos = line.find(units_dir);
+        if (pos != std::string::npos && line.find("error", pos) != std::string::npos) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Wait for the background compilation started by start_compile(), return true if it succeeded.
+bool RCCode::wait_compile() {
+    if (compile_pid < 0) {
+        return false;
+    }
+
+    const pid_t pid = compile_pid;
+    const int status = wait_process(compile_pid);
+    compile_pid = -1;
+
+    bool result = status != -1 && WIFEXITED(status) && WEXITSTATUS(status) == 0;
+
+    std::string output;
+    if (!compile_silent || !result) {
+        try {
+            output = compile_log_path.read_file();
+        } catch (const std::exception &e) {
+            gpwarning("Failed to read the compiler output: {}\n", e.what());
+        }
+    }
+
+    // The failure may be the one of the header unit, e.g. g++ crashes on some code with it, compile again with the PCH.
+    //* An error of the code itself is not compiled again, it would fail the same way with the PCH.
+    if (!result && compile_uses_header_units && is_header_unit_failure(status, output)) {
+        IGNORE_RESULT(remove(tmp_bin_path.c_str()));
+        IGNORE_RESULT(remove(compile_log_path.c_str()));
+        gpdebug("Compiling {} code again with the PCH\n", code_name);
+
+        header_units_failed = true;
+        result = start_compile(compile_silent) && wait_compile();
+        if (result) {
+            HeaderUnits::mark_failed(cs.get_header_units_key(),
+                                     "a compilation failed with it and succeeded with the PCH");
+        }
+        return result;
+    }
+
+    if (result) {
+        result = publish_bin();
+    } else {
+        IGNORE_RESULT(remove(tmp_bin_path.c_str()));
+    }
+
+    // Replay the captured compiler output, the warnings of a successful compilation as well
+    if (!compile_silent) {
+        fflush(stdout);
+        fwrite(output.data(), 1, output.size(), stderr);
+        fflush(stderr);
+        if (!result) {
+            RCC::report_compile_failure(settings, cpp_path, bin_path, compile_cmd);
+        }
+    }
+    if (!result) {
+        failure_output = output;
+        record_failure(output);
+    } else if (failure_cache) {
+        IGNORE_RESULT(remove(get_failure_path().c_str()));
+    }
+    IGNORE_RESULT(remove(compile_log_path.c_str()));
+
+    compile_duration = duration_ms(compile_begin);
+    //* On the track of the compiler, the compilations of the candidates overlap.
+    Trace::add("compile and link", compile_begin, now(), code_name, pid);
+    debug_print_compile_result(result, compile_duration);
+
+    return result;
+}
+
+// Kill the background compilation started by start_compile() and remove the partial binary.
+void RCCode::cancel_compile() {
+    if (compile_pid < 0) {
+        return;
+    }
+
+    kill_process(compile_pid);
+    compile_pid = -1;
+
+    gpdebug("COMPILATION {} ({})\n", styled("CANCELLED", fg(terminal_color::yellow) | emphasis::bold), code_name);
+
+    IGNORE_RESULT(remove(tmp_bin_path.c_str()));
+    IGNORE_RESULT(remove(compile_log_path.c_str()));
+}
+
+// Move the compiled source and binary to the paths of the other code.
+bool RCCode::move_to(const RCCode &other) {
+    //* rename() replaces the destination atomically, so a permanent binary which is running will not be affected.
+    if (rename(cpp_path.c_str(), other.cpp_path.c_str()) != 0 || rename(bin_path.c_str(), other.bin_path.c_str()) != 0) {
+        gperror("Failed to move {} code to {}: {}\n", code_name, other.bin_path.string(), strerror(errno));
+        return false;
+    }
+    return true;
+}
+
+// The sidecar file of a failed compilation.
+Path RCCode::get_failure_path() const {
+    Path path = bin_path;
+    path.replace_extension(".fail");
+    return path;
+}
+
+// The header of a failure record, the diagnostics follow it.
+//* The diagnostics are colored if they were compiled for a terminal, so they are only replayed to the same kind.
+static std::string gen_failure_header(const Settings &settings) {
+    return compiler_support::get_toolchain_fingerprint(settings.get_compiler()) +
+           (isatty(fileno(stderr)) ? " color\n" : " plain\n");
+}
+
+// Record the failed compilation with the compiler output.
+void RCCode::record_failure(const std::string &output) {
+    if (!failure_cache || !RCC::is_hermetic(settings)) {
+        return;
+    }
+
+    //* The source of the failed code stays next to the record, it tells a known failure from a hash collision.
+    const Path path = get_failure_path();
+    const Path tmp_path = path.string() + "." + std::to_string(getpid()) + ".tmp";
+    try {
+        tmp_path.write_file(gen_failure_header(settings) + output);
+    } catch (const std::exception &e) {
+        gpwarning("Failed to record the compile failure: {}\n", e.what());
+        IGNORE_RESULT(remove(tmp_path.c_str()));
+        return;
+    }
+    if (rename(tmp_path.c_str(), path.c_str()) != 0) {
+        IGNORE_RESULT(remove(tmp_path.c_str()));
+        return;
+    }
+    gpdebug("Recorded the compile failure of the {} code\n", code_name);
+}
+
+// Check if the code is known to fail with the current toolchain.
+bool RCCode::is_known_failure() {
+    if (!failure_cache || !RCC::is_hermetic(settings)) {
+        return false;
+    }
+
+    const Path failure_path = get_failure_path();
+    if (!failure_path.exists() || !cpp_path.exists()) {
+        return false; // no record
+    }
+    std::string record;
+    try {
+        record = failure_path.read_file();
+    } catch (const std::exception &e) {
+        return false;
+    }
+
+    const std::string header = gen_failure_header(settings);
+    if (record.compare(0, header.size(), header) != 0) {
+        gpdebug("The compile failure record of the {} code is stale\n", code_name);
+        return false;
+    }
+
+    if (!full_code_generated) {
+        gen_full_code();
+    }
+    try {
+        if (cpp_path.read_file() != full_code) {
+            return false;
+        }
+    } catch (const std::exception &e) {
+        return false;
+    }
+
+    failure_output = record.substr(header.size());
+    return true;
+}
+
+// Replay the recorded diagnostics of a known failure.
+void RCCode::replay_failure() {
+    gpdebug(fg(terminal_color::yellow) | emphasis::bold, "The {} code is known to fail, replaying the diagnostics\n",
+            code_name);
+    fflush(stdout);
+    fwrite(failure_output.data(), 1, failure_output.size(), stderr);
+    const bool header_units = !header_units_failed && cs.uses_header_units();
+    RCC::report_compile_failure(settings, cpp_path, bin_path,
+                                RCC::gen_compile_cmd(cpp_path, bin_path, objects, cs, header_units).to_string());
+}
+
+// Lock the cache entry of the code, wait if another process holds it.
+bool RCCode::lock_entry(FileLock &lock) const {
+    Path lock_path = bin_path;
+    lock_path.replace_extension(".lock");
+
+    if (lock.lock(lock_path, false)) {
+        return true;
+    }
+    if (errno != EWOULDBLOCK) {
+        gpwarning("Failed to lock {}: {}\n", lock_path.string(), strerror(errno));
+        return false;
+    }
+
+    gpdebug(fg(terminal_color::yellow) | emphasis::bold, "Waiting for another rcc to compile the {} code\n",
+            code_name);
+    const auto time_begin = now();
+    Trace::Span span("wait for lock", code_name);
+    if (!lock.lock(lock_path, true)) {
+        gpwarning("Failed to lock {}: {}\n", lock_path.string(), strerror(errno));
+        return false;
+    }
+    gpdebug("WAITED: {:.2f} ms\n", duration_ms(time_begin));
+    return true;
+}
+
+// Run the binary executable, return the exit status of the executable, or 1 on error.
+int RCCode::run_bin() {
+    return RCC::run_bin(settings, cpp_path, bin_path);
+}
+
+// Count a hit of the cached binary, promote the cache entry once it is hot enough.
+void RCCode::count_hit() {
+    // The entries built with the optimization flags of the user are left alone
+    const uint64_t threshold = settings.is_unoptimized() ? settings.get_tier_threshold() : 0;
+
+    Tier::Stats stats;
+    const bool promote = Tier::count_hit(bin_path, threshold, stats);
+    if (stats.level == Tier::BASELINE && !settings.is_unoptimized()) {
+        Tier::set_level(bin_path, Tier::FIXED);
+        stats.level = Tier::FIXED;
+    }
+    gpdebug("HITS: {}, TIER: {}\n", stats.hits, Tier::level_to_string(stats.level));
+
+    if (promote) {
+        start_promotion();
+    }
+}
+
+// Add the compiled binary to the cache index with its size and compile cost.
+void RCCode::add_to_index() const {
+    CacheIndex::get_instance().add(CacheIndex::get_entry_name(bin_path), CacheIndex::get_entry_size(bin_path),
+                                   static_cast<uint64_t>(compile_duration));
+}
+
+// Recompile the code with -O2 in a detached low-priority process.
+void RCCode::start_promotion() {
+    gpdebug(fg(terminal_color::yellow) | emphasis::bold, "Promoting {} code to -O2 in the background\n", code_name);
+
+    const pid_t pid = detach_background();
+    if (pid < 0) {
+        gpwarning("fork(): {}\n", strerror(errno));
+        Tier::set_level(bin_path, Tier::BASELINE);
+        return;
+    }
+    if (pid > 0) {
+        return;
+    }
+
+    // The objects of the additional sources are up to date unless they changed since the baseline was built, an
+    // edited source has an object of another name, the binary of another key then
+    ObjectCache object_cache(settings, cs);
+    bool result = object_cache.build() && object_cache.get_objects().size() == objects.size();
+    for (size_t i = 0; result && i < objects.size(); i++) {
+        result = object_cache.get_objects()[i].string() == objects[i].string();
+    }
+    if (result) {
+        init_tmp_bin_path();
+        Command cmd = RCC::gen_compile_cmd(cpp_path, tmp_bin_path, object_cache.get_objects(), cs,
+                                           cs.uses_header_units());
+        cmd.arg("-O2").redirect_output("/dev/null");
+        result = cmd.run() == 0;
+    }
+
+    //* The entry may have been removed meanwhile, the binary is only replaced if it's still there.
+    if (result && is_cached()) {
+        result = publish_bin();
+
+        // The compile cost stays the one of the baseline, which is what a rebuild costs
+        CacheIndex::Entry entry;
+        if (result && CacheIndex::get_instance().lookup(CacheIndex::get_entry_name(bin_path), entry)) {
+            CacheIndex::get_instance().add(entry.name, CacheIndex::get_entry_size(bin_path), entry.cost_ms);
+        }
+    } else {
+        IGNORE_RESULT(remove(tmp_bin_path.c_str()));
+        result = false;
+    }
+    Tier::set_level(bin_path, result ? Tier::OPTIMIZED : Tier::FAILED);
+    _exit(0);
+}
+
+// Write the full code to the cpp file, return false on error.
+bool RCCode::write_cpp_file() {
     if (!full_code_generated) {
         gen_full_code();
     }
 
+    //* Write to a temporary file and rename it, so that a concurrent rcc never reads a partial file.
+    const Path tmp_cpp_path = cpp_path.string() + "." + std::to_string(getpid()) + ".tmp";
     try {
         // Write c++ code to the cpp file
-        cpp_path.write_file(full_code);
+        tmp_cpp_path.write_file(full_code);
     } catch (std::exception &e) {
-        gperror("Failed to write code to file: %s", e.what());
+        gperror("Failed to write code to file: {}\n", e.what());
+        IGNORE_RESULT(remove(tmp_cpp_path.c_str()));
         return false;
     }
+    if (rename(tmp_cpp_path.c_str(), cpp_path.c_str()) != 0) {
+        gperror("Failed to write code to file: {}: {}\n", cpp_path.string(), strerror(errno));
+        IGNORE_RESULT(remove(tmp_cpp_path.c_str()));
+        return false;
+    }
+    return true;
+}
 
-    const auto ts = fg(color::dodger_blue) | emphasis::bold;
-    gpdebug(ts, ">>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>\n");
-    gpdebug(fg(terminal_color::yellow) | emphasis::bold, "Compiling {} code\n", code_name);
-
-    const auto time_begin = now();
+// The compiler writes to a temporary binary, which is renamed into place by publish_bin().
+void RCCode::init_tmp_bin_path() {
+    tmp_bin_path = bin_path.string() + "." + std::to_string(getpid()) + ".tmp";
+}
 
-    bool result = RCC::compile_file(settings, cpp_path, bin_path, cs, silent);
+// Rename the compiled temporary binary into place, return false on error.
+//* rename() is atomic, so the other processes see either no binary or the complete one, never a partial one.
+bool RCCode::publish_bin() {
+    if (rename(tmp_bin_path.c_str(), bin_path.c_str()) != 0) {
+        gperror("Failed to move the binary to {}: {}\n", bin_path.string(), strerror(errno));
+        IGNORE_RESULT(remove(tmp_bin_path.c_str()));
+        return false;
+    }
+    return true;
+}
 
+// Print the debug messages after the compilation finished.
+void RCCode::debug_print_compile_result(bool result, double duration) const {
     if (result) {
         gpdebug("COMPILATION {} ({})", styled("OK", green_bold), code_name);
     } else {
         gpdebug("COMPILATION {} ({})", styled("FAILED", red_bold), code_name);
     }
-    double duration = duration_ms(time_begin);
     gpdebug_ex(", {}: {:.2f} ms\n", styled("TIME", fg(terminal_color::yellow) | emphasis::bold),
                colored_duration(100, 600, duration));
-    gpdebug(ts, "<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<\n");
-
-    return result;
-}
-
-// Run the binary executable, return the exit status of the executable, or 1 on error.
-int RCCode::run_bin() {
-    return RCC::run_bin(settings, cpp_path, bin_path);
 }
 
 // Generate the full code with the given code and settings.
 void RCCode::gen_full_code() {
+    Trace::Span span("expand template");
     full_code = cs.gen_code(paths.get_template_file_path(), settings.get_additional_includes(),
-                            settings.get_above_main(), settings.get_functions(), code, identifier);
+                            settings.get_above_main(), has_functions ? functions : settings.get_functions(), code,
+                            identifier);
     full_code_generated = true;
 }
 
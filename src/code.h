@@ -2,6 +2,7 @@
 #define __RCC_CODE_H__
 
 #include "compiler_support.h"
+#include "lock.h"
 #include "paths.h"
 #include "settings.h"
 #include <string>
@@ -19,11 +20,11 @@ class RCCode {
         : settings(settings), paths(paths), identifier(identifier), cs(cs), code(code), code_name(code_name) {}
 
     // Init the output cpp and bin paths.
-    // This requires the full_code to be generated first.
+    // The names are a hash of the inputs of the full code, which is not generated until it's needed.
     void init_cpp_bin_paths();
 
-    // Check if the binary is cached and the content matches.
-    //* The file hash may collide, so we need to check the content as well.
+    // Check if the binary is cached and was linked after its objects. The content is compared as well in the paranoid
+    // mode.
     bool is_cached();
 
     // Write the full code to the cpp file and compile it.
@@ -31,13 +32,91 @@ class RCCode {
     // Silent mode: no output of compiler errors, and no output after the compilation failed.
     bool compile(bool silent);
 
+    // Write the full code to the cpp file and start compiling it in the background.
+    // The compiler output is captured and only replayed by wait_compile(), so that the output of a compilation
+    // which loses the race does not show up. Return false if the compilation could not be started.
+    // Silent mode: no output of compiler errors, and no output after the compilation failed.
+    bool start_compile(bool silent);
+
+    // Wait for the background compilation started by start_compile(), return true if it succeeded.
+    bool wait_compile();
+
+    // Kill the background compilation started by start_compile() and remove the partial binary.
+    void cancel_compile();
+
+    // Move the compiled source and binary to the paths of the other code, e.g. to publish the winner of a
+    // speculative compilation as a permanent. Return true if successful.
+    bool move_to(const RCCode &other);
+
+    // Record the failed compilations of the code with their diagnostics in a sidecar file next to the binary, see
+    // is_known_failure(). The failures of codes which depend on local files are never recorded.
+    void use_failure_cache() { failure_cache = true; }
+
+    // Check if the code is known to fail with the current toolchain, so that it doesn't need to be compiled again.
+    bool is_known_failure();
+
+    // Replay the diagnostics of a known failure, or of the last failed compilation, as if it was compiled again.
+    void replay_failure();
+
+    // Lock the cache entry of the code with a sidecar lock file next to the binary, so that only one process
+    // compiles it. Wait if another process holds it. Return false if the lock file can't be locked.
+    bool lock_entry(FileLock &lock) const;
+
     // Run the binary executable, return the exit status of the executable, or 1 on error.
     int run_bin();
 
+    // Count a hit of the cached binary, and promote the cache entry to an optimized build in the background once it
+    // is hot enough, see Tier.
+    void count_hit();
+
+    // Add the compiled binary to the cache index with its size and compile cost, see CacheIndex.
+    void add_to_index() const;
+
+    const std::string &get_code_name() const { return code_name; }
+    const Path &get_bin_path() const { return bin_path; }
+
+    // Use the given functions instead of the ones in the settings, e.g. the snippet functions of a bundle.
+    void set_functions(const std::vector<std::string> &functions) {
+        this->functions = functions;
+        has_functions = true;
+    }
+
+    // Link the given object files instead of compiling the additional sources, see ObjectCache. The objects are a
+    // part of the cache key, so they are set before init_cpp_bin_paths(). `changed` tells that one of them went stale
+    // since it was compiled, the cached binary is not used then.
+    void set_objects(const std::vector<Path> &objects, bool changed = false) {
+        this->objects = objects;
+        objects_changed = changed;
+    }
+
   private:
     // Generate the full code with the given code and settings.
     void gen_full_code();
 
+    // Write the full code to the cpp file, return false on error.
+    bool write_cpp_file();
+
+    // The compiler writes to a temporary binary, which is renamed into place by publish_bin().
+    void init_tmp_bin_path();
+
+    // Rename the compiled temporary binary into place, return false on error.
+    bool publish_bin();
+
+    // Check if a compilation with the header unit failed because of it, given its status and output.
+    bool is_header_unit_failure(int status, const std::string &output) const;
+
+    // Recompile the code with -O2 in a detached low-priority process, which replaces the binary if it succeeds.
+    void start_promotion();
+
+    // Record the failed compilation with the compiler output, see use_failure_cache().
+    void record_failure(const std::string &output);
+
+    // The sidecar file of a failed compilation.
+    Path get_failure_path() const;
+
+    // Print the debug messages after the compilation finished.
+    void debug_print_compile_result(bool result, double duration) const;
+
   protected:
     const Settings &settings;
     const Paths &paths;
@@ -48,7 +127,24 @@ class RCCode {
     std::string full_code;
     Path cpp_path;
     Path bin_path;
+    Path tmp_bin_path;
     bool full_code_generated{false};
+    std::vector<Path> objects;
+    bool objects_changed{false};
+    std::vector<std::string> functions;
+    bool has_functions{false};
+    bool failure_cache{false};
+    std::string failure_output; // the diagnostics of a known failure or of the last failed compilation
+
+    // The state of the background compilation, see start_compile().
+    pid_t compile_pid{-1};
+    bool compile_silent{false};
+    bool compile_uses_header_units{false}; // the compilation imports the header unit, see HeaderUnits
+    bool header_units_failed{false};       // a compilation failed with the header unit, the next ones use the PCH
+    std::string compile_cmd;
+    Path compile_log_path;
+    std::chrono::high_resolution_clock::time_point compile_begin;
+    double compile_duration{0}; // milliseconds, set by wait_compile()
 };
 
 class RCCodePermanent : public RCCode {
@@ -1,50 +1,429 @@
 #include "compiler_support.h"
+#include "daemon.h"
 #include "debug_fmt.h"
 #include "fmt.h"
+#include "header_units.h"
+#include "launcher.h"
 #include "paths.h"
+#include "pch_variants.h"
+#include "trace.h"
 #include "utils.h"
 #include <algorithm>
+#include <climits>
+#include <fcntl.h>
+#include <cstdlib>
+#include <fstream>
 #include <iostream>
+#include <map>
+#include <sys/stat.h>
+#include <unistd.h>
 
 namespace rcc {
 
-class safe_replacer {
-  private:
-    struct pos {
-        size_t p;
-        size_t index;
-    };
-
-  public:
-    static size_t replace(std::string &str, const std::vector<std::pair<std::string, std::string>> &replaces) {
-        // Find all occurrences of the strings to be replaced and store their positions along with their indices in the
-        // replaces vector
-        std::vector<pos> positions;
-        for (size_t i = 0; i < replaces.size(); i++) {
-            size_t p = str.find(replaces[i].first);
-            while (p != std::string::npos) {
-                positions.push_back({p, i});
-                p = str.find(replaces[i].first, p + replaces[i].first.size());
+// The clang PCH test results kept in memory, see linux_clang::preload_test_pch_cache().
+static std::map<std::string, bool> clang_pch_test_memory;
+
+std::vector<std::string> compiler_support::filter_link_flags(const std::vector<std::string> &flags) {
+    std::vector<std::string> filtered;
+    for (size_t i = 0; i < flags.size(); i++) {
+        const std::string &flag = flags[i];
+        // `-l foo` and `-L dir` take the next argument
+        if (flag == "-l" || flag == "-L") {
+            i++;
+            continue;
+        }
+        if (starts_with(flag, "-l") || starts_with(flag, "-L") || starts_with(flag, "-Wl,") || flag == "-static" ||
+            flag == "-shared" || flag == "-rdynamic" || flag == "-s") {
+            continue;
+        }
+        filtered.push_back(flag);
+    }
+    return filtered;
+}
+
+// The linkers to try for "auto", the fastest first, with their program names.
+static const std::vector<std::pair<std::string, std::string>> FAST_LINKERS = {
+    {"mold", "mold"}, {"lld", "ld.lld"}, {"gold", "ld.gold"}};
+
+// Find a program in the PATH, return its full path or an empty string if not found.
+//* The PCH fingerprint looks up the compiler on every cache hit with includes, so the answer is remembered. The PATH
+//* is a part of the key, a daemon worker runs with the environment of its client.
+static std::string find_in_path(const std::string &program) {
+    static std::map<std::string, std::string> found; // PATH + '\0' + program -> full path
+
+    const char *PATH = getenv("PATH");
+    if (PATH == NULL) {
+        return "";
+    }
+    const std::string dirs = PATH;
+    const std::string key = dirs + '\0' + program;
+    auto it = found.find(key);
+    if (it != found.end()) {
+        return it->second;
+    }
+    std::string &result = found[key];
+    size_t begin = 0;
+    while (begin <= dirs.size()) {
+        size_t end = dirs.find(':', begin);
+        if (end == std::string::npos) {
+            end = dirs.size();
+        }
+        const std::string dir = dirs.substr(begin, end - begin);
+        const std::string full_path = (dir.empty() ? "." : dir) + "/" + program;
+        if (access(full_path.c_str(), X_OK) == 0) {
+            return result = full_path;
+        }
+        begin = end + 1;
+    }
+    return result;
+}
+
+// Check if a program can be found in the PATH.
+static bool is_in_path(const std::string &program) {
+    return !find_in_path(program).empty();
+}
+
+std::string compiler_support::get_file_identity(const std::string &path) {
+    struct stat st;
+    if (stat(path.c_str(), &st) != 0) {
+        return "";
+    }
+    return fmt::format(":{}:{}.{}", (long long)st.st_size, (long long)st.st_mtim.tv_sec, (long long)st.st_mtim.tv_nsec);
+}
+
+bool compiler_support::is_local_include(const std::string &inc) {
+    static std::map<std::string, bool> local; // include -> exists
+
+    auto it = local.find(inc);
+    if (it != local.end()) {
+        return it->second;
+    }
+    return local[inc] = Path(inc).exists();
+}
+
+// Append the identity of a file to a fingerprint, i.e. its path, size and modification time.
+static void append_file_identity(std::string &fingerprint, const std::string &path) {
+    fingerprint += path + compiler_support::get_file_identity(path) + '\n';
+}
+
+std::string compiler_support::get_toolchain_fingerprint(const std::string &compiler) {
+    const Paths &paths = Paths::get_instance();
+
+    //* The compiler is usually a symlink like g++ -> g++-12, which stays the same across an upgrade.
+    std::string fingerprint;
+    const std::string compiler_path = find_in_path(compiler);
+    char real_path[PATH_MAX];
+    append_file_identity(fingerprint, realpath(compiler_path.c_str(), real_path) ? real_path : compiler_path);
+
+    // The template is part of the generated code, but the header and the PCH are not
+    append_file_identity(fingerprint, paths.get_template_header_path().string());
+    append_file_identity(fingerprint, paths.get_template_pch_path().string());
+
+    // The search paths of the compiler and the linker
+    for (const char *name : {"CPATH", "CPLUS_INCLUDE_PATH", "LIBRARY_PATH", "GCC_EXEC_PREFIX", "COMPILER_PATH"}) {
+        const char *value = getenv(name);
+        fingerprint += fmt::format("{}={}\n", name, value ? value : "");
+    }
+
+    return u64_to_string_base64x(fnv1a_64_hash_string(fingerprint));
+}
+
+std::string compiler_support::get_pch_fingerprint(const std::string &compiler) {
+    //* Unlike the toolchain fingerprint, the PCH directory is left out, a new variant in it must not change the key
+    //* of the others.
+    std::string fingerprint;
+    for (const auto &file : get_pch_files(compiler)) {
+        append_file_identity(fingerprint, file);
+    }
+    return fingerprint;
+}
+
+std::vector<std::string> compiler_support::get_pch_files(const std::string &compiler) {
+    static std::map<std::string, std::string> real_paths; // compiler path -> real path
+
+    const std::string compiler_path = find_in_path(compiler);
+    auto it = real_paths.find(compiler_path);
+    if (it == real_paths.end()) {
+        char real_path[PATH_MAX];
+        it = real_paths.emplace(compiler_path, realpath(compiler_path.c_str(), real_path) ? real_path : compiler_path)
+                 .first;
+    }
+    return {it->second, Paths::get_instance().get_template_header_path().string()};
+}
+
+// Check if a flag only changes the diagnostics of the compiler, a PCH built without it is still used.
+static bool is_diagnostic_flag(const std::string &flag) {
+    return (starts_with(flag, "-W") && !starts_with(flag, "-Wp,")) || flag == "-w" || starts_with(flag, "-pedantic") ||
+           starts_with(flag, "-fdiagnostics-") || starts_with(flag, "-fmax-errors") || flag == "-v" || flag == "-H";
+}
+
+std::vector<std::string> compiler_support::get_pch_flags() const {
+    std::vector<std::string> flags;
+    for (const auto &flag : settings.get_std_cxxflags()) {
+        if (!is_diagnostic_flag(flag)) {
+            flags.push_back(flag);
+        }
+    }
+    const std::vector<std::string> instances_flags = get_instances_flags();
+    flags.insert(flags.end(), instances_flags.begin(), instances_flags.end());
+    for (const auto &flag : filter_link_flags(settings.get_additional_flags())) {
+        if (!is_diagnostic_flag(flag)) {
+            flags.push_back(flag);
+        }
+    }
+    return flags;
+}
+
+std::vector<std::string> compiler_support::get_pch_includes() const {
+    std::vector<std::string> includes;
+    for (const auto &inc : settings.get_additional_includes()) {
+        if (is_local_include(inc)) {
+            return {};
+        }
+        // It's in the template header, see gen_additional_includes()
+        if (inc != "bits/stdc++.h") {
+            includes.push_back(inc);
+        }
+    }
+    return includes;
+}
+
+PchVariants::Signature compiler_support::get_pch_signature() const {
+    return {compiler_name, get_pch_flags(), get_pch_includes(), Path()};
+}
+
+std::string compiler_support::get_std_name() const {
+    const std::string &std = settings.get_std();
+    return starts_with(std, "-std=") ? std.substr(5) : std;
+}
+
+Path compiler_support::get_instances_library() const {
+    //* A static link takes the archive, the shared library would pull the shared libstdc++ in. So does a permanent,
+    //* it outlives the shared library, which a reinstall removes and rebuilds.
+    bool link_static = !settings.get_permanent().empty();
+    for (const auto *flags : {&settings.get_cxxflags(), &settings.get_additional_flags()}) {
+        for (const auto &flag : *flags) {
+            link_static = link_static || starts_with(flag, "-static");
+        }
+    }
+    return Paths::get_instance().get_sub_templates_dir() /
+           ("librcc_instances." + compiler_name + "." + get_std_name() + (link_static ? ".a" : ".so"));
+}
+
+// Check if the flags change the code or the ABI of the containers, or can't link the library of the instantiations.
+static bool changes_containers(const Settings &settings) {
+    static const std::vector<std::string> prefixes = {"-D_GLIBCXX", "-U_GLIBCXX",      "-D_LIBCPP", "-stdlib=",
+                                                      "-fsanitize", "-fno-exceptions", "-m",        "-nostd"};
+    for (const auto *flags : {&settings.get_cxxflags(), &settings.get_additional_flags()}) {
+        for (const auto &flag : *flags) {
+            for (const auto &prefix : prefixes) {
+                if (starts_with(flag, prefix)) {
+                    return true;
+                }
             }
         }
+    }
+    return false;
+}
+
+bool compiler_support::links_instances() const {
+    struct stat st;
+    return !changes_containers(settings) && stat(get_instances_library().c_str(), &st) == 0;
+}
+
+std::string compiler_support::get_instances_identity() const {
+    if (changes_containers(settings)) {
+        return "none";
+    }
+    const Path library = get_instances_library();
+    const std::string identity = get_file_identity(library.string());
+    return identity.empty() ? "none" : library.string() + identity;
+}
+
+std::vector<std::string> compiler_support::get_instances_flags() const {
+    if (!links_instances()) {
+        return {};
+    }
+    return {"-DRCC_EXTERN_TEMPLATES"};
+}
+
+std::vector<std::string> compiler_support::get_instances_link_args() const {
+    if (!links_instances()) {
+        return {};
+    }
+    //* The shared library is found where it was built, so the snippets keep running from any directory.
+    const Path library = get_instances_library();
+    if (library.extension() == ".a") {
+        return {library.string()};
+    }
+    return {library.string(), "-Wl,-rpath," + Paths::get_instance().get_sub_templates_dir().string()};
+}
+
+bool compiler_support::wants_header_units() const {
+    if (!settings.get_flag_modules() || settings.has_included_stdcpp()) {
+        return false;
+    }
+
+    // c++20, c++2a, gnu++23, ... but not c++98 or c++17
+    const std::string &std = settings.get_std();
+    const size_t pos = std.find("++");
+    return pos != std::string::npos && pos + 2 < std.size() && std[pos + 2] == '2';
+}
+
+const std::string &compiler_support::get_header_units_key() const {
+    if (header_units_key.empty()) {
+        header_units_key = HeaderUnits::get_key(compiler_name, get_pch_flags());
+    }
+    return header_units_key;
+}
+
+bool compiler_support::uses_header_units() const {
+    return wants_header_units() && HeaderUnits::is_ready(get_header_units_key());
+}
+
+const std::string &compiler_support::resolve_linker(const std::string &compiler, const std::string &linker) {
+    static std::map<std::string, std::string> resolved; // compiler -> linker
+
+    if (linker != "auto") {
+        return linker;
+    }
+
+    auto it = resolved.find(compiler);
+    if (it != resolved.end()) {
+        return it->second;
+    }
 
-        // If no occurrences were found, return 0
-        if (positions.empty()) {
-            return 0;
+    const Path cache_path = Paths::get_instance().get_sub_templates_dir() / ("rcc_linker." + compiler);
+    std::string detected;
+    try {
+        if (cache_path.exists()) {
+            detected = cache_path.read_file();
+        }
+    } catch (const std::exception &e) {
+        gpwarning("Failed to read {}: {}\n", cache_path.string(), e.what());
+    }
+
+    if (detected.empty()) {
+        detected = detect_linker(compiler);
+        try {
+            //* Write to a temporary file and rename it, so a concurrent rcc never reads a partial file.
+            const Path tmp_path = cache_path.string() + "." + std::to_string(getpid()) + ".tmp";
+            tmp_path.write_file(detected);
+            if (rename(tmp_path.c_str(), cache_path.c_str()) != 0) {
+                IGNORE_RESULT(remove(tmp_path.c_str()));
+            }
+        } catch (const std::exception &e) {
+            gpwarning("Failed to write {}: {}\n", cache_path.string(), e.what());
         }
+    }
+
+    gpdebug("LINKER: {}\n", detected);
+    return resolved[compiler] = detected;
+}
+
+std::string compiler_support::detect_linker(const std::string &compiler) {
+    const Paths &paths = Paths::get_instance();
 
-        // Sort positions by position in reverse order so that replacements do not interfere with each other
-        std::sort(positions.begin(), positions.end(), [](const pos &a, const pos &b) { return a.p > b.p; });
+    // A linker may be installed but not supported by the compiler, e.g. g++ < 12 does not know mold.
+    // So link a tiny program with each of them.
+    const std::string suffix = "." + std::to_string(getpid());
+    const Path src_path = paths.get_sub_cache_dir() / ("rcc_linker_test" + suffix + ".cpp");
+    const Path bin_path = paths.get_sub_cache_dir() / ("rcc_linker_test" + suffix + ".bin");
+    try {
+        src_path.write_file("int main() { return 0; }\n");
+    } catch (const std::exception &e) {
+        gpwarning("Failed to write {}: {}\n", src_path.string(), e.what());
+        return "default";
+    }
 
-        // Replace all occurrences in reverse order
-        for (auto &p : positions) {
-            str.replace(p.p, replaces[p.index].first.size(), replaces[p.index].second);
+    std::string detected = "default";
+    for (const auto &linker : FAST_LINKERS) {
+        if (!is_in_path(linker.second)) {
+            continue;
         }
 
-        // Return the number of replacements made
-        return positions.size();
+        Command test_cmd({compiler, "-fuse-ld=" + linker.first, "-o", bin_path.string(), src_path.string()});
+        test_cmd.redirect_output("/dev/null");
+        gpdebug("Testing linker {}: {}\n", linker.first, test_cmd.to_string());
+        if (test_cmd.run() == 0) {
+            detected = linker.first;
+            break;
+        }
     }
-};
+
+    IGNORE_RESULT(remove(src_path.c_str()));
+    IGNORE_RESULT(remove(bin_path.c_str()));
+    return detected;
+}
+
+std::string compiler_support::get_linker_flag() const {
+    const std::string &linker = resolve_linker(compiler_name, settings.get_linker());
+    return linker == "default" ? "" : "-fuse-ld=" + linker;
+}
+
+const std::string &compiler_support::read_template(const Path &template_filename) {
+    static std::string cached_filename;
+    static std::string cached_content;
+    static struct stat cached_st = {};
+
+    struct stat st;
+    if (stat(template_filename.c_str(), &st) == 0 && cached_filename == template_filename.string() &&
+        st.st_ino == cached_st.st_ino && st.st_size == cached_st.st_size &&
+        st.st_mtim.tv_sec == cached_st.st_mtim.tv_sec && st.st_mtim.tv_nsec == cached_st.st_mtim.tv_nsec) {
+        return cached_content;
+    }
+
+    cached_content = template_filename.read_file();
+    cached_filename = template_filename.string();
+    cached_st = st;
+    return cached_content;
+}
+
+std::string compiler_support::get_template_fingerprint(const Path &template_filename) {
+    static std::string cached_identity;
+    static std::string cached_fingerprint;
+
+    struct stat st;
+    if (stat(template_filename.c_str(), &st) != 0) {
+        return ""; // the template is checked during installation, and reading it will fail later
+    }
+    const std::string identity = fmt::format("{}:{}:{}:{}.{}", (unsigned long long)st.st_dev,
+                                             (unsigned long long)st.st_ino, (long long)st.st_size,
+                                             (long long)st.st_mtim.tv_sec, (long long)st.st_mtim.tv_nsec);
+    if (identity == cached_identity) {
+        return cached_fingerprint;
+    }
+
+    // The sidecar file holds "<identity> <fingerprint>"
+    const Path memo_path = template_filename.string() + ".fingerprint";
+    char buf[256];
+    std::string memo;
+    int fd = open(memo_path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd >= 0) {
+        const ssize_t n = pread(fd, buf, sizeof(buf), 0);
+        close(fd);
+        memo.assign(buf, n > 0 ? n : 0);
+    }
+    const size_t space = memo.find(' ');
+    if (space != std::string::npos && memo.compare(0, space, identity) == 0) {
+        cached_fingerprint = memo.substr(space + 1);
+    } else {
+        gpdebug("Fingerprinting the template {}\n", template_filename.string());
+        cached_fingerprint = u128_to_string_base64x(hash128_string(read_template(template_filename)));
+        try {
+            //* Write to a temporary file and rename it, so a concurrent rcc never reads a partial file.
+            const Path tmp_path = memo_path.string() + "." + std::to_string(getpid()) + ".tmp";
+            tmp_path.write_file(identity + " " + cached_fingerprint);
+            if (rename(tmp_path.c_str(), memo_path.c_str()) != 0) {
+                IGNORE_RESULT(remove(tmp_path.c_str()));
+            }
+        } catch (const std::exception &e) {
+            gpwarning("Failed to write {}: {}\n", memo_path.string(), e.what());
+        }
+    }
+    cached_identity = identity;
+    return cached_fingerprint;
+}
 
 std::string compiler_support::gen_additional_includes(const std::vector<std::string> &additional_includes) const {
     std::string includes = "";
@@ -61,7 +440,7 @@ std::string compiler_support::gen_additional_includes(const std::vector<std::str
             //* clang++ seems to have a problem with including multiple PCHs, so we use a similar strategy as g++
             // includes += "#include \"rcc_bits_stdc++.hpp\"\n";
         } else {
-            if (Path(inc).exists()) {
+            if (is_local_include(inc)) {
                 includes += "#include \"" + inc + "\"\n";
             } else {
                 includes += "#include <" + inc + ">\n";
@@ -80,7 +459,7 @@ std::string compiler_support::gen_code(const Path &template_filename,
                                        const std::vector<std::string> &functions,
                                        const std::string &commandline_code,
                                        const std::string &identifier) const {
-    std::string temp = template_filename.read_file();
+    std::string temp = read_template(template_filename);
 
     // The template file should be checked during installation
     // so do not check it here
@@ -111,70 +490,245 @@ std::string compiler_support::gen_code(const Path &template_filename,
     return temp;
 }
 
-std::string linux_gcc::get_compile_command(const std::vector<Path> &sources, const Path &bin_path) const {
-    const std::string &cxxflags = settings.get_std_cxxflags_as_string();
-    const std::string &additional_flags = settings.get_additional_flags_as_string();
+std::vector<std::string> linux_gcc::get_compile_args(const std::vector<Path> &sources,
+                                                    const Path &bin_path,
+                                                    bool header_units) const {
+    const std::vector<std::string> &additional_flags = settings.get_additional_flags();
 
     const Paths &paths = Paths::get_instance();
 
-    std::string compile_cmd = "g++";
-    if (!cxxflags.empty()) {
-        compile_cmd += " " + cxxflags;
-    }
+    std::vector<std::string> args = {"g++"};
+    const std::vector<std::string> cxxflags = settings.get_std_cxxflags();
+    args.insert(args.end(), cxxflags.begin(), cxxflags.end());
+    const std::vector<std::string> instances_flags = get_instances_flags();
+    args.insert(args.end(), instances_flags.begin(), instances_flags.end());
 
     if (settings.has_included_stdcpp()) {
-        compile_cmd += " -DINCLUDE_BITS_STDCPP_H";
+        args.push_back("-DINCLUDE_BITS_STDCPP_H");
     }
 
     if (!settings.get_additional_includes().empty()) {
-        compile_cmd += " -I.";
+        args.push_back("-I.");
+    }
+    args.push_back("-I" + paths.get_sub_templates_dir().string());
+
+    if (header_units) {
+        //* The generated code includes the template header itself, after the prelude which imports the header unit.
+        const std::vector<std::string> unit_args =
+            get_header_unit_args(HeaderUnits::get_units_dir(get_header_units_key()));
+        args.insert(args.end(), unit_args.begin(), unit_args.end());
+    } else {
+        args.push_back("-include");
+        args.push_back(paths.get_template_header_path().string());
+        const std::vector<std::string> pch_args = get_pch_args();
+        args.insert(args.end(), pch_args.begin(), pch_args.end());
     }
-    compile_cmd += " -I" + paths.get_sub_templates_dir().quote_if_needed();
 
-    compile_cmd += " -include " + paths.get_template_header_path().quote_if_needed();
+    const std::string linker_flag = get_linker_flag();
+    if (!linker_flag.empty()) {
+        args.push_back(linker_flag);
+    }
 
-    compile_cmd += " -o " + bin_path.quote_if_needed();
+    args.push_back("-o");
+    args.push_back(bin_path.string());
     for (const auto &source : sources) {
-        compile_cmd += " " + source.quote_if_needed();
+        args.push_back(source.string());
+    }
+    const std::vector<std::string> instances_link_args = get_instances_link_args();
+    args.insert(args.end(), instances_link_args.begin(), instances_link_args.end());
+    args.insert(args.end(), additional_flags.begin(), additional_flags.end());
+    return args;
+}
+
+std::vector<std::string> linux_gcc::get_compile_object_args(const Path &source,
+                                                            const Path &obj_path,
+                                                            const Path &dep_path) const {
+    const std::vector<std::string> additional_flags = filter_link_flags(settings.get_additional_flags());
+
+    const Paths &paths = Paths::get_instance();
+
+    std::vector<std::string> args = {"g++"};
+    const std::vector<std::string> cxxflags = settings.get_std_cxxflags();
+    args.insert(args.end(), cxxflags.begin(), cxxflags.end());
+    const std::vector<std::string> instances_flags = get_instances_flags();
+    args.insert(args.end(), instances_flags.begin(), instances_flags.end());
+
+    if (settings.has_included_stdcpp()) {
+        args.push_back("-DINCLUDE_BITS_STDCPP_H");
+    }
+
+    if (!settings.get_additional_includes().empty()) {
+        args.push_back("-I.");
     }
-    if (!additional_flags.empty()) {
-        compile_cmd += " " + additional_flags;
+    args.push_back("-I" + paths.get_sub_templates_dir().string());
+
+    // The template header is included into every source of the binary, so it is part of the object as well
+    args.push_back("-include");
+    args.push_back(paths.get_template_header_path().string());
+    const std::vector<std::string> pch_args = get_pch_args();
+    args.insert(args.end(), pch_args.begin(), pch_args.end());
+
+    args.insert(args.end(), {"-MMD", "-MF", dep_path.string()});
+    args.insert(args.end(), {"-c", "-o", obj_path.string(), source.string()});
+    args.insert(args.end(), additional_flags.begin(), additional_flags.end());
+    return args;
+}
+
+std::vector<std::string> linux_gcc::get_pch_flags() const {
+    std::vector<std::string> flags = compiler_support::get_pch_flags();
+    if (settings.has_included_stdcpp()) {
+        flags.push_back("-DINCLUDE_BITS_STDCPP_H");
     }
-    return compile_cmd;
+    return flags;
 }
 
-std::string linux_clang::get_compile_command(const std::vector<Path> &sources, const Path &bin_path) const {
-    const std::string &cxxflags = settings.get_std_cxxflags_as_string();
-    const std::string &additional_flags = settings.get_additional_flags_as_string();
+bool linux_gcc::needs_pch_variant() const {
+    //! Should be consistent with the flags to compile the PCHs in template/Makefile.
+    //* The instances flags are those of get_pch_flags(), the default flags don't ask for a variant of their own when the
+    //* library is missing.
+    std::vector<std::string> default_flags = {RCC_CXXSTD, "-g0", "-O0"};
+    const std::vector<std::string> instances_flags = get_instances_flags();
+    default_flags.insert(default_flags.end(), instances_flags.begin(), instances_flags.end());
+
+    return !get_pch_includes().empty() || compiler_support::get_pch_flags() != default_flags;
+}
+
+std::vector<std::string> linux_gcc::get_header_unit_build_args(const Path &dir) const {
+    std::vector<std::string> args = {"g++"};
+    const std::vector<std::string> flags = get_pch_flags();
+    args.insert(args.end(), flags.begin(), flags.end());
+    args.insert(args.end(), {"-fmodules-ts", "-fmodule-mapper=" + (dir / "mapper").string(), "-fmodule-header",
+                             "-x", "c++-header", (dir / "rcc_units.hpp").string()});
+    return args;
+}
+
+std::vector<std::string> linux_gcc::get_header_unit_args(const Path &dir) const {
+    return {"-fmodules-ts", "-fmodule-mapper=" + (dir / "mapper").string(), "-include",
+            (dir / "rcc_import.hpp").string()};
+}
+
+std::vector<std::string> linux_gcc::get_pch_args() const {
+    if (!needs_pch_variant()) {
+        return {};
+    }
+    const std::string variant = PchVariants::find(get_pch_signature());
+    if (variant.empty()) {
+        return {};
+    }
+    return {PchVariants::get_macro_flag(variant)};
+}
+
+std::vector<std::string> linux_clang::get_compile_args(const std::vector<Path> &sources,
+                                                      const Path &bin_path,
+                                                      bool header_units) const {
+    const std::vector<std::string> &additional_flags = settings.get_additional_flags();
 
     const Paths &paths = Paths::get_instance();
 
-    auto &pch_path = paths.get_template_pch_path();
+    std::vector<std::string> args = {"clang++"};
+    const std::vector<std::string> cxxflags = settings.get_std_cxxflags();
+    args.insert(args.end(), cxxflags.begin(), cxxflags.end());
+    const std::vector<std::string> instances_flags = get_instances_flags();
+    args.insert(args.end(), instances_flags.begin(), instances_flags.end());
+
+    if (!settings.get_additional_includes().empty()) {
+        args.push_back("-I.");
+    }
+    args.push_back("-I" + paths.get_sub_templates_dir().string());
+
+    const std::vector<std::string> pch_args =
+        header_units ? get_header_unit_args(HeaderUnits::get_units_dir(get_header_units_key())) : get_pch_args();
+    args.insert(args.end(), pch_args.begin(), pch_args.end());
+
+    const std::string linker_flag = get_linker_flag();
+    if (!linker_flag.empty()) {
+        args.push_back(linker_flag);
+    }
 
-    std::string compile_cmd = "clang++";
-    if (!cxxflags.empty()) {
-        compile_cmd += " " + cxxflags;
+    args.push_back("-o");
+    args.push_back(bin_path.string());
+    for (const auto &source : sources) {
+        args.push_back(source.string());
     }
+    const std::vector<std::string> instances_link_args = get_instances_link_args();
+    args.insert(args.end(), instances_link_args.begin(), instances_link_args.end());
+    args.insert(args.end(), additional_flags.begin(), additional_flags.end());
+    return args;
+}
+
+std::vector<std::string> linux_clang::get_compile_object_args(const Path &source,
+                                                              const Path &obj_path,
+                                                              const Path &dep_path) const {
+    const std::vector<std::string> additional_flags = filter_link_flags(settings.get_additional_flags());
+
+    const Paths &paths = Paths::get_instance();
+
+    std::vector<std::string> args = {"clang++"};
+    const std::vector<std::string> cxxflags = settings.get_std_cxxflags();
+    args.insert(args.end(), cxxflags.begin(), cxxflags.end());
+    const std::vector<std::string> instances_flags = get_instances_flags();
+    args.insert(args.end(), instances_flags.begin(), instances_flags.end());
 
     if (!settings.get_additional_includes().empty()) {
-        compile_cmd += " -I.";
+        args.push_back("-I.");
     }
-    compile_cmd += " -I" + paths.get_sub_templates_dir().quote_if_needed();
+    args.push_back("-I" + paths.get_sub_templates_dir().string());
+
+    const std::vector<std::string> pch_args = get_pch_args();
+    args.insert(args.end(), pch_args.begin(), pch_args.end());
 
+    args.insert(args.end(), {"-MMD", "-MF", dep_path.string()});
+    args.insert(args.end(), {"-c", "-o", obj_path.string(), source.string()});
+    args.insert(args.end(), additional_flags.begin(), additional_flags.end());
+    return args;
+}
+
+std::vector<std::string> linux_clang::get_pch_args() const {
     // Test if the generated PCH is compatible with the given flags.
     // Note: not like g++, clang++ treats PCH mismatch as an error. So we need to test it.
-    if (test_pch(settings.get_std(), settings.get_cxxflags(), settings.get_additional_flags())) {
-        compile_cmd += " -include-pch " + pch_path.quote_if_needed();
+    const bool default_usable = test_default_pch();
+    const std::string default_pch = get_default_pch().string();
+    if (default_usable && get_pch_includes().empty()) {
+        return {"-include-pch", default_pch};
     }
 
-    compile_cmd += " -o " + bin_path.quote_if_needed();
-    for (const auto &source : sources) {
-        compile_cmd += " " + source.quote_if_needed();
+    //* A chained PCH brings the one it's chained to along.
+    const std::string variant = PchVariants::find(get_pch_signature());
+    if (!variant.empty()) {
+        return {PchVariants::get_macro_flag(variant), "-include-pch",
+                PchVariants::get_variant_path(compiler_name, variant).string()};
     }
-    if (!additional_flags.empty()) {
-        compile_cmd += " " + additional_flags;
+    if (default_usable) {
+        return {"-include-pch", default_pch};
     }
-    return compile_cmd;
+    return {};
+}
+
+std::vector<std::string> linux_clang::get_header_unit_build_args(const Path &dir) const {
+    std::vector<std::string> args = {"clang++"};
+    const std::vector<std::string> flags = get_pch_flags();
+    args.insert(args.end(), flags.begin(), flags.end());
+    args.insert(args.end(), {"-fmodule-header", "-x", "c++-header", (dir / "rcc_units.hpp").string(), "-o",
+                             (dir / "rcc_units.pcm").string()});
+    return args;
+}
+
+std::vector<std::string> linux_clang::get_header_unit_args(const Path &dir) const {
+    return {"-fmodule-file=" + (dir / "rcc_units.pcm").string(), "-include", (dir / "rcc_import.hpp").string()};
+}
+
+PchVariants::Signature linux_clang::get_pch_signature() const {
+    PchVariants::Signature signature = compiler_support::get_pch_signature();
+    if (!signature.includes.empty() &&
+        test_default_pch()) {
+        signature.base = get_default_pch();
+    }
+    return signature;
+}
+
+bool linux_clang::needs_pch_variant() const {
+    return !get_pch_includes().empty() ||
+           !test_default_pch();
 }
 
 std::vector<std::string> linux_clang::filter_pch_flags(const std::vector<std::string> &flags) const {
@@ -209,13 +763,21 @@ std::vector<std::string> linux_clang::filter_pch_flags(const std::vector<std::st
             continue;
         }
 
+        // The diagnostics and the linker do not matter to the PCH either
+        if (starts_with(flag, "-fdiagnostics-") || starts_with(flag, "-fcolor-diagnostics") ||
+            starts_with(flag, "-fno-color-diagnostics") || starts_with(flag, "-ferror-limit") ||
+            starts_with(flag, "-fuse-ld=")) {
+            continue;
+        }
+
         filtered_flags.push_back(flag);
     }
 
     return filtered_flags;
 }
 
-bool linux_clang::get_test_pch_from_cache(const std::string &std,
+bool linux_clang::get_test_pch_from_cache(const std::string &identity,
+                                          const std::string &std,
                                           const std::vector<std::string> &cxxflags,
                                           const std::vector<std::string> &additional_flags,
                                           bool &result) const {
@@ -228,9 +790,16 @@ bool linux_clang::get_test_pch_from_cache(const std::string &std,
     const std::string cxxflags_str = vector_to_string(cxxflags, " ");
     const std::string additional_flags_str = vector_to_string(additional_flags, " ");
 
-    const std::string to_hash = std + cxxflags_str + additional_flags_str;
+    const std::string key = identity + "\n" + std + "\n" + cxxflags_str + "\n" + additional_flags_str;
 
-    std::string out_name = u64_to_string_base64x(fnv1a_64_hash_string(to_hash));
+    // Check the results in memory first
+    auto it = clang_pch_test_memory.find(key);
+    if (it != clang_pch_test_memory.end()) {
+        result = it->second;
+        return true;
+    }
+
+    std::string out_name = u64_to_string_base64x(fnv1a_64_hash_string(key));
 
     Path outpath = paths.get_sub_clang_pch_test_cache_dir() / out_name;
 
@@ -245,15 +814,16 @@ bool linux_clang::get_test_pch_from_cache(const std::string &std,
             return false;
         }
 
-        std::string std_read, cxxflags_read, additional_flags_read, result_read;
-        if (!std::getline(file, std_read) || !std::getline(file, cxxflags_read) ||
+        std::string identity_read, std_read, cxxflags_read, additional_flags_read, result_read;
+        if (!std::getline(file, identity_read) || !std::getline(file, std_read) || !std::getline(file, cxxflags_read) ||
             !std::getline(file, additional_flags_read) || !std::getline(file, result_read)) {
             return false;
         }
 
         file.close();
 
-        if (std_read != std || cxxflags_read != cxxflags_str || additional_flags_read != additional_flags_str) {
+        if (identity_read != identity || std_read != std || cxxflags_read != cxxflags_str ||
+            additional_flags_read != additional_flags_str) {
             gpdebug("Clang test PCH cache file content mismatch");
             return false;
         }
@@ -266,7 +836,8 @@ bool linux_clang::get_test_pch_from_cache(const std::string &std,
     }
 }
 
-void linux_clang::save_test_pch_to_cache(const std::string &std,
+void linux_clang::save_test_pch_to_cache(const std::string &identity,
+                                         const std::string &std,
                                          const std::vector<std::string> &cxxflags,
                                          const std::vector<std::string> &additional_flags,
                                          bool result) const {
@@ -275,15 +846,19 @@ void linux_clang::save_test_pch_to_cache(const std::string &std,
     const std::string cxxflags_str = vector_to_string(cxxflags, " ");
     const std::string additional_flags_str = vector_to_string(additional_flags, " ");
 
-    const std::string to_hash = std + cxxflags_str + additional_flags_str;
+    const std::string key = identity + "\n" + std + "\n" + cxxflags_str + "\n" + additional_flags_str;
 
-    std::string out_name = u64_to_string_base64x(fnv1a_64_hash_string(to_hash));
+    std::string out_name = u64_to_string_base64x(fnv1a_64_hash_string(key));
 
     Path outpath = paths.get_sub_clang_pch_test_cache_dir() / out_name;
 
     try {
         std::ofstream out_file(outpath.string());
-        out_file << std << "\n"
+        if (!out_file && Paths::restore_dir(outpath.parent_path())) {
+            out_file.open(outpath.string());
+        }
+        out_file << identity << "\n"
+                 << std << "\n"
                  << cxxflags_str << "\n"
                  << additional_flags_str << "\n"
                  << (result ? "true" : "false") << "\n";
@@ -291,47 +866,218 @@ void linux_clang::save_test_pch_to_cache(const std::string &std,
     } catch (const std::exception &e) {
         gpwarning(fg(terminal_color::red), "Failed to write clang pch test file: {}\n", e.what());
     }
+
+    // Let the daemon remember it as well
+    remember_test_pch(key, result);
+    Daemon::learn(Daemon::LEARN_PCH_TEST, key, result ? "true" : "false");
+}
+
+void linux_clang::preload_test_pch_cache() {
+    const Paths &paths = Paths::get_instance();
+
+    try {
+        for (const auto &entry : fs::directory_iterator(paths.get_sub_clang_pch_test_cache_dir().get_path())) {
+            std::ifstream file(entry.path().string());
+
+            std::string identity_read, std_read, cxxflags_read, additional_flags_read, result_read;
+            if (std::getline(file, identity_read) && std::getline(file, std_read) &&
+                std::getline(file, cxxflags_read) && std::getline(file, additional_flags_read) &&
+                std::getline(file, result_read)) {
+                remember_test_pch(identity_read + "\n" + std_read + "\n" + cxxflags_read + "\n" +
+                                      additional_flags_read,
+                                  result_read == "true");
+            }
+        }
+    } catch (const std::exception &e) {
+        gpwarning("Failed to preload clang pch test results: {}\n", e.what());
+    }
+}
+
+void linux_clang::remember_test_pch(const std::string &key, bool result) {
+    clang_pch_test_memory[key] = result;
+}
+
+Path linux_clang::get_default_pch() const {
+    // The PCH built by template/Makefile with CXX=clang++, e.g. clang++.c++17.<signature>.default.gch
+    const std::string prefix = "clang++." + get_std_name() + ".";
+
+    // The newest one, in case the flags of the Makefile changed
+    Path pch;
+    time_t pch_time = 0;
+    std::error_code ec;
+    for (fs::directory_iterator it(Paths::get_instance().get_template_pch_path().get_path(), ec), end;
+         !ec && it != end; it.increment(ec)) {
+        const std::string name = it->path().filename().string();
+        struct stat st;
+        if (starts_with(name, prefix) && ends_with(name, ".default.gch") && stat(it->path().c_str(), &st) == 0 &&
+            (pch.empty() || st.st_mtime > pch_time)) {
+            pch = it->path();
+            pch_time = st.st_mtime;
+        }
+    }
+    return pch;
+}
+
+std::string linux_clang::get_pch_identity(const Path &pch) const {
+    std::string identity = get_pch_fingerprint(compiler_name);
+    append_file_identity(identity, pch.string());
+    return u64_to_string_base64x(fnv1a_64_hash_string(identity));
+}
+
+// Read the flags a PCH was built with, which template/Makefile records next to the PCH directory.
+// Return false if they were not recorded.
+static bool read_recorded_flags(const Path &pch, std::vector<std::string> &flags) {
+    const Path path = Paths::get_instance().get_sub_templates_dir() / "rcc_template.hpp.flags" / (pch.filename() + ".flags");
+    std::ifstream file(path.string());
+    std::string flag;
+    while (file >> flag) {
+        flags.push_back(flag);
+    }
+    return !flags.empty();
+}
+
+// The class of an optimization level, clang++ records whether the code is optimized and for the size.
+static std::string get_optimization_class(const std::vector<std::string> &flags) {
+    std::string level = "0";
+    for (const auto &flag : flags) {
+        if (starts_with(flag, "-O")) {
+            level = flag.substr(2);
+        }
+    }
+    if (level == "0" || level == "s" || level == "z" || level == "fast") {
+        return level;
+    }
+    return "1"; // -O, -O1, -O2, -O3, -Og
+}
+
+// Get the macros defined or undefined by the flags, "-D X" is the same as "-DX".
+static std::vector<std::string> get_macro_flags(const std::vector<std::string> &flags) {
+    std::vector<std::string> macros;
+    for (size_t i = 0; i < flags.size(); i++) {
+        if ((flags[i] == "-D" || flags[i] == "-U") && i + 1 < flags.size()) {
+            macros.push_back(flags[i] + flags[i + 1]);
+            i++;
+        } else if (starts_with(flags[i], "-D") || starts_with(flags[i], "-U")) {
+            macros.push_back(flags[i]);
+        }
+    }
+    return macros;
+}
+
+// Get the flags other than the debug information and the optimization level, sorted.
+static std::vector<std::string> get_other_flags(const std::vector<std::string> &flags) {
+    std::vector<std::string> other;
+    for (const auto &flag : flags) {
+        if (!starts_with(flag, "-g") && !starts_with(flag, "-O")) {
+            other.push_back(flag);
+        }
+    }
+    std::sort(other.begin(), other.end());
+    return other;
+}
+
+linux_clang::PchVerdict linux_clang::judge_pch_flags(const std::vector<std::string> &recorded,
+                                                     const std::vector<std::string> &flags) {
+    // The language standard and the optimization are language options, which clang++ checks
+    std::string recorded_std, std;
+    for (const auto &flag : recorded) {
+        recorded_std = starts_with(flag, "-std=") ? flag : recorded_std;
+    }
+    for (const auto &flag : flags) {
+        std = starts_with(flag, "-std=") ? flag : std;
+    }
+    if (recorded_std != std || get_optimization_class(recorded) != get_optimization_class(flags)) {
+        return PchVerdict::INCOMPATIBLE;
+    }
+
+    // A macro of the PCH which is not defined the same way on the command line is an error
+    const std::vector<std::string> recorded_macros = get_macro_flags(recorded);
+    const std::vector<std::string> macros = get_macro_flags(flags);
+    for (const auto &macro : recorded_macros) {
+        if (std::find(macros.begin(), macros.end(), macro) == macros.end()) {
+            return PchVerdict::INCOMPATIBLE;
+        }
+    }
+
+    // The debug information is not checked, e.g. the defaults of rcc are the flags of the PCH without -g0
+    if (get_other_flags(recorded) == get_other_flags(flags)) {
+        return PchVerdict::COMPATIBLE;
+    }
+
+    //* The rest, e.g. a new macro or a -f flag, may or may not matter to the PCH, only clang++ knows.
+    return PchVerdict::UNKNOWN;
+}
+
+bool linux_clang::test_default_pch() const {
+    std::vector<std::string> additional_flags = settings.get_additional_flags();
+    const std::vector<std::string> instances_flags = get_instances_flags();
+    additional_flags.insert(additional_flags.end(), instances_flags.begin(), instances_flags.end());
+    return test_pch(settings.get_std(), settings.get_cxxflags(), additional_flags);
 }
 
 bool linux_clang::test_pch(const std::string &std,
                            const std::vector<std::string> &cxxflags,
                            const std::vector<std::string> &additional_flags) const {
+    Trace::Span span("test pch");
     auto time_begin = now();
 
+    const Path gch_path = get_default_pch();
+    if (gch_path.empty()) {
+        gpdebug("No clang++ PCH for {}\n", std);
+        return false;
+    }
+
     auto filtered_cxxflags = filter_pch_flags(cxxflags);
     auto filtered_additional_flags = filter_pch_flags(additional_flags);
 
-    // TODO: return true if the flags are defaults
+    // Compare the flags with the ones the PCH was built with, which answers for the defaults and most of the others
+    std::vector<std::string> recorded_flags;
+    if (read_recorded_flags(gch_path, recorded_flags)) {
+        std::vector<std::string> flags = {std};
+        flags.insert(flags.end(), filtered_cxxflags.begin(), filtered_cxxflags.end());
+        flags.insert(flags.end(), filtered_additional_flags.begin(), filtered_additional_flags.end());
+
+        const PchVerdict verdict = judge_pch_flags(filter_pch_flags(recorded_flags), flags);
+        if (verdict != PchVerdict::UNKNOWN) {
+            const bool result = verdict == PchVerdict::COMPATIBLE;
+            gpdebug("PCH test result by the recorded flags: {}, {}: ({:.2f} ms)\n", result ? "true" : "false",
+                    styled("TIME", fg(terminal_color::yellow) | emphasis::bold),
+                    colored_duration(10, 20, duration_ms(time_begin)));
+            return result;
+        }
+    }
 
     // If already in cache, return the cached result.
+    //* The results are only valid for the PCH and the compiler they were tested with.
+    const std::string identity = get_pch_identity(gch_path);
     bool result;
-    if (get_test_pch_from_cache(std, filtered_cxxflags, filtered_additional_flags, result)) {
+    if (get_test_pch_from_cache(identity, std, filtered_cxxflags, filtered_additional_flags, result)) {
         const double duration = duration_ms(time_begin);
         gpdebug("clang pch test cached, {}: ({:.2f} ms)\n",
                 styled("TIME", fg(terminal_color::yellow) | emphasis::bold), colored_duration(10, 20, duration));
         return result;
     }
 
-    const Paths &paths = Paths::get_instance();
-
-    auto &gch_path = paths.get_template_pch_path();
-
     // -E: preprocess only, -P: remove line markers
-    const std::string test_cmd = "clang++ " + std + " " + vector_to_string(filtered_cxxflags, " ", "", true) +
-                                 "-x c++ -E -P -include-pch " + gch_path.quote_if_needed() + " /dev/null " +
-                                 vector_to_string(filtered_additional_flags, " ", "", true) + "> /dev/null 2>&1";
+    Command test_cmd;
+    test_cmd.arg("clang++")
+        .arg(std)
+        .args(filtered_cxxflags)
+        .args({"-x", "c++", "-E", "-P", "-include-pch", gch_path.string(), "/dev/null"})
+        .args(filtered_additional_flags)
+        .redirect_output("/dev/null");
 
-    result = system_s(test_cmd) == 0;
+    result = test_cmd.run() == 0;
 
     const auto ts = result ? fg(terminal_color::green) : fg(terminal_color::red);
     gpdebug("PCH test result: {}\n", styled(result ? "true" : "false", ts));
-    gpmsgdump("TEST CMD: {}\n", test_cmd);
+    gpmsgdump("TEST CMD: {}\n", test_cmd.to_string());
 
     const double duration = duration_ms(time_begin);
     gpdebug("{}: {:.2f} ms\n", styled("PCH TEST TIME", fg(terminal_color::yellow) | emphasis::bold),
             colored_duration(60, 200, duration));
 
-    save_test_pch_to_cache(std, filtered_cxxflags, filtered_additional_flags, result);
+    save_test_pch_to_cache(identity, std, filtered_cxxflags, filtered_additional_flags, result);
 
     return result;
 }
@@ -9,8 +9,8 @@
 namespace rcc {
 
 // Abstract base class for compiler support.
-// Each subclass implements the get_compile_command() method for a specific compiler.
-// The get_compile_command() method returns a string that can be executed to compile
+// Each subclass implements the get_compile_args() method for a specific compiler.
+// The get_compile_args() method returns an argument vector that can be launched to compile
 // the given sources into a binary using that compiler.
 class compiler_support {
   public:
@@ -33,16 +33,120 @@ class compiler_support {
                                  const std::string &commandline_code,
                                  const std::string &identifier) const;
 
-    // Generate the compile command to compile the given sources into a binary using that compiler.
-    virtual std::string get_compile_command(const std::vector<Path> &sources, const Path &bin_path) const = 0;
+    // Generate the argument vector to compile the given sources into a binary using that compiler, importing the header
+    // unit instead of the PCH if `header_units` is true, see uses_header_units().
+    virtual std::vector<std::string> get_compile_args(const std::vector<Path> &sources,
+                                                      const Path &bin_path,
+                                                      bool header_units) const = 0;
+
+    // Generate the argument vector to compile a single source into an object file, the make-style dependencies are
+    // written to dep_path. The link-only flags in the additional flags are left out.
+    virtual std::vector<std::string> get_compile_object_args(const Path &source,
+                                                             const Path &obj_path,
+                                                             const Path &dep_path) const = 0;
+
+    // Resolve the linker for the compiler. "auto" is resolved to the fastest linker that works with the compiler,
+    // detected at the first use and cached in the templates directory. Return "default" if the compiler's default
+    // linker is used.
+    static const std::string &resolve_linker(const std::string &compiler, const std::string &linker);
+
+    // Get a fingerprint of the toolchain, i.e. the compiler binary, the template header and PCH, and the environment
+    // variables which change the search paths. A compile failure recorded with another fingerprint is stale.
+    static std::string get_toolchain_fingerprint(const std::string &compiler);
+
+    // Get a fingerprint of what a PCH is built from besides the flags, i.e. the compiler binary and the template
+    // header, see PchVariants.
+    static std::string get_pch_fingerprint(const std::string &compiler);
+
+    // Get the files the PCH fingerprint is made of, i.e. the real path of the compiler and the template header.
+    static std::vector<std::string> get_pch_files(const std::string &compiler);
+
+    // Get the identity of a file, i.e. its size and modification time, or an empty string if it does not exist.
+    static std::string get_file_identity(const std::string &path);
+
+    // Check if an include is a local header, i.e. it exists relative to the working directory, otherwise it's a system
+    // one. The answer is remembered for the life of the process, the cache key and the generated code have to agree.
+    static bool is_local_include(const std::string &inc);
+
+    // Get the flags which a PCH has to be built with to be used by the compilations with the settings, i.e. the
+    // flags without the ones that only matter to the linker or to the diagnostics.
+    virtual std::vector<std::string> get_pch_flags() const;
+
+    // Get the system headers of the settings to precompile with the template header. Empty if a local header is
+    // included, the headers are included in the given order and a local one may change what the others see.
+    std::vector<std::string> get_pch_includes() const;
+
+    // Get the signature of the PCH variant of the settings, see PchVariants.
+    virtual PchVariants::Signature get_pch_signature() const;
+
+    // Check if the default PCHs can't be used with the settings, or if there are headers to precompile, so that a
+    // PCH variant is needed, see PchVariants.
+    virtual bool needs_pch_variant() const = 0;
+
+    // Check if the settings ask for the header unit of the template, and it can replace the PCH, i.e. with C++20 or
+    // later and without `bits/stdc++.h`, see HeaderUnits.
+    bool wants_header_units() const;
+
+    // Get the key of the header unit of the settings, see HeaderUnits.
+    const std::string &get_header_units_key() const;
+
+    // Check if the compilations can import the header unit instead of the PCH, i.e. it's wanted and built.
+    //* Only the generated code is compiled with it, it can fall back to the PCH, see RCCode::wait_compile().
+    bool uses_header_units() const;
+
+    // Get the library of the instantiations of RCC_INSTANCES in the template header for the compiler and the standard,
+    // built by template/Makefile, the archive if the snippets are linked statically or made permanent.
+    Path get_instances_library() const;
+
+    // Check if the snippets link the instantiations of the library, i.e. it's built and the flags don't change the
+    // code or the ABI of the containers.
+    bool links_instances() const;
+
+    // Get the identity of the library the snippets link, i.e. its path, size and modification time, or "none" if they
+    // don't link it. A part of the cache key, see RCC::gen_first_hash_filename().
+    std::string get_instances_identity() const;
+
+    // Get the argument vector to build the header unit `rcc_units.hpp` in the directory.
+    virtual std::vector<std::string> get_header_unit_build_args(const Path &dir) const = 0;
+
+    // Get the flags to import the header unit in the directory, in place of the template header and its PCH.
+    virtual std::vector<std::string> get_header_unit_args(const Path &dir) const = 0;
+
+    // Read the template file. The content is kept in memory and reused until the file changes, so that a
+    // long-running process (the daemon) does not read it again for every request.
+    static const std::string &read_template(const Path &template_filename);
+
+    // Get a fingerprint of the template content, a part of the cache key, see RCC::gen_first_hash_filename().
+    // It's remembered in a sidecar file with the identity of the template, i.e. its inode, size and modification
+    // time, so that the template is only read and hashed again when it changes. A cache hit never reads the template.
+    static std::string get_template_fingerprint(const Path &template_filename);
 
   protected:
+    // Get the standard of the settings without `-std=`, e.g. "c++17".
+    std::string get_std_name() const;
+
+    // Get the flags to declare the instantiations of the library extern, empty if it's not linked.
+    std::vector<std::string> get_instances_flags() const;
+
+    // Get the arguments to link the library of the instantiations, empty if it's not linked.
+    std::vector<std::string> get_instances_link_args() const;
+
+    // Get the `-fuse-ld=` flag of the linker in the settings, or an empty string for the default linker.
+    std::string get_linker_flag() const;
+
+    // Detect the fastest linker that works with the compiler, see resolve_linker().
+    static std::string detect_linker(const std::string &compiler);
+
+    // Return the flags without the ones that only matter to the linker, e.g. -l, -L and -Wl.
+    static std::vector<std::string> filter_link_flags(const std::vector<std::string> &flags);
+
     static size_t safe_replace(std::string &str, size_t pos, const std::string &from, const std::string &to);
     std::string gen_additional_includes(const std::vector<std::string> &additional_includes) const;
 
   protected:
     std::string compiler_name; // the name of the compiler, e.g., "g++"
     const Settings &settings; // reference to the settings object so that the compiler can access all settings
+    mutable std::string header_units_key; // see get_header_units_key()
 };
 
 // Subclass for Linux g++ compiler.
@@ -53,8 +157,28 @@ class linux_gcc : public compiler_support {
     // Virtual destructor to allow proper cleanup of derived classes.
     virtual ~linux_gcc() = default;
 
-    // Generate the compile command for the Linux g++ compiler.
-    virtual std::string get_compile_command(const std::vector<Path> &sources, const Path &bin_path) const override;
+    // Generate the compile arguments for the Linux g++ compiler.
+    virtual std::vector<std::string> get_compile_args(const std::vector<Path> &sources,
+                                                      const Path &bin_path,
+                                                      bool header_units) const override;
+
+    // Generate the arguments to compile a source into an object file for the Linux g++ compiler.
+    virtual std::vector<std::string> get_compile_object_args(const Path &source,
+                                                             const Path &obj_path,
+                                                             const Path &dep_path) const override;
+
+    virtual std::vector<std::string> get_pch_flags() const override;
+
+    // g++ picks a PCH in the PCH directory by itself, a variant is needed if the flags differ from the default ones.
+    virtual bool needs_pch_variant() const override;
+
+    // g++ writes and reads the header unit where the module mapper of the directory says.
+    virtual std::vector<std::string> get_header_unit_build_args(const Path &dir) const override;
+    virtual std::vector<std::string> get_header_unit_args(const Path &dir) const override;
+
+  protected:
+    // Get the flags to use the PCH variant of the settings if it's built, g++ finds the PCH by itself.
+    std::vector<std::string> get_pch_args() const;
 };
 
 // Subclass for Linux clang++ compiler.
@@ -65,24 +189,71 @@ class linux_clang : public compiler_support {
     // Virtual destructor to allow proper cleanup of derived classes.
     virtual ~linux_clang() = default;
 
-    // Generate the compile command for the Linux clang++ compiler.
-    virtual std::string get_compile_command(const std::vector<Path> &sources, const Path &bin_path) const override;
+    // Generate the compile arguments for the Linux clang++ compiler.
+    virtual std::vector<std::string> get_compile_args(const std::vector<Path> &sources,
+                                                      const Path &bin_path,
+                                                      bool header_units) const override;
+
+    // Generate the arguments to compile a source into an object file for the Linux clang++ compiler.
+    virtual std::vector<std::string> get_compile_object_args(const Path &source,
+                                                             const Path &obj_path,
+                                                             const Path &dep_path) const override;
+
+    // Load all the PCH test results from the cache directory into memory.
+    static void preload_test_pch_cache();
+
+    // Remember a PCH test result in memory, the key is generated by get_test_pch_from_cache().
+    static void remember_test_pch(const std::string &key, bool result);
+
+    // The variant of an include set is chained to the default PCH if it passes the test.
+    virtual PchVariants::Signature get_pch_signature() const override;
+
+    // clang++ is given the PCH explicitly, a variant is needed if the default PCH fails the test.
+    virtual bool needs_pch_variant() const override;
+
+    // clang++ is given the header unit explicitly.
+    virtual std::vector<std::string> get_header_unit_build_args(const Path &dir) const override;
+    virtual std::vector<std::string> get_header_unit_args(const Path &dir) const override;
 
   protected:
+    // Get the flags to include the default PCH if it passes the test, otherwise the variant of the settings if it's
+    // built.
+    std::vector<std::string> get_pch_args() const;
+
+    // The answer of judge_pch_flags().
+    enum class PchVerdict { COMPATIBLE, INCOMPATIBLE, UNKNOWN };
+
     // Return flags that will cause PCH mismatch.
     std::vector<std::string> filter_pch_flags(const std::vector<std::string> &flags) const;
 
-    bool get_test_pch_from_cache(const std::string &std,
+    // Get the default PCH of the standard, built by template/Makefile, or an empty path if there is none.
+    Path get_default_pch() const;
+
+    // Get the identity of the PCH and of the compiler, a PCH test result of another one is stale.
+    std::string get_pch_identity(const Path &pch) const;
+
+    // Decide if a PCH built with the recorded flags can be used with the flags without running the compiler, both
+    // filtered by filter_pch_flags().
+    static PchVerdict judge_pch_flags(const std::vector<std::string> &recorded, const std::vector<std::string> &flags);
+
+    bool get_test_pch_from_cache(const std::string &identity,
+                                 const std::string &std,
                                  const std::vector<std::string> &cxxflags,
                                  const std::vector<std::string> &additional_flags,
                                  bool &result) const;
-    void save_test_pch_to_cache(const std::string &std,
+    void save_test_pch_to_cache(const std::string &identity,
+                                const std::string &std,
                                 const std::vector<std::string> &cxxflags,
                                 const std::vector<std::string> &additional_flags,
                                 bool result) const;
 
+    // Test if the default PCH is compatible with the flags of the settings.
+    bool test_default_pch() const;
+
     // Test if the generated PCH is compatible with the given flags.
     // Note: not like g++, clang++ treats PCH mismatch as an error. So we need to test it.
+    // The flags are judged against the ones the PCH was built with first, clang++ is only run when that can't tell,
+    // and its answer is cached with the identity of the PCH and of the compiler.
     bool test_pch(const std::string &std,
                   const std::vector<std::string> &cxxflags,
                   const std::vector<std::string> &additional_flags) const;
@@ -0,0 +1,994 @@
+#include "daemon.h"
+#include "cache_gc.h"
+#include "compiler_support.h"
+#include "debug_fmt.h"
+#include "launcher.h"
+#include "libs/CLI11.hpp"
+#include "paths.h"
+#include "rcc.h"
+#include "settings.h"
+#include "tier.h"
+#include "utils.h"
+#include <algorithm>
+#include <csignal>
+#include <ctime>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <unordered_map>
+
+extern char **environ;
+
+namespace rcc {
+
+static const uint32_t PROTOCOL_MAGIC = 0x52434431; // "RCD1"
+
+enum RequestType : char { REQUEST_RUN = 'R', REQUEST_STOP = 'S', REQUEST_PING = 'P' };
+enum ReplyType : char { REPLY_EXEC = 'E', REPLY_EXIT = 'X' };
+
+// A request from a client.
+struct Request {
+    char type;
+    std::string cwd;
+    std::vector<std::string> argv;
+    std::vector<std::string> env;
+    int fds[3];
+};
+
+// A connection whose request is being received, see receive_request().
+struct Connection {
+    int sock;
+    std::string buf;
+    int fds[3];
+    time_t deadline; // the connection is dropped if the request is not complete by then
+};
+
+// A worker serving a request. Its client is watched, the worker is interrupted if the client goes away.
+struct Worker {
+    pid_t pid;
+    int sock; // the socket of the client, -1 once it hung up
+    time_t kill_time; // when to kill the worker if it's still running after the interrupt, 0 if not interrupted
+};
+
+// The write end of the pipe to report learned facts to the daemon, only valid inside a worker.
+static int learn_fd = -1;
+
+// Set by the signal handler to stop the daemon.
+static volatile sig_atomic_t stop_requested = 0;
+
+/*==========================================================================*/
+// * Serialization
+
+static void put_u32(std::string &buf, uint32_t val) {
+    buf.append(reinterpret_cast<const char *>(&val), sizeof(val));
+}
+
+static void put_string(std::string &buf, const std::string &str) {
+    put_u32(buf, static_cast<uint32_t>(str.size()));
+    buf.append(str);
+}
+
+static void put_strings(std::string &buf, const std::vector<std::string> &strs) {
+    put_u32(buf, static_cast<uint32_t>(strs.size()));
+    for (const auto &str : strs) {
+        put_string(buf, str);
+    }
+}
+
+// A reader over a received buffer. All the getters return false if the buffer is too short.
+class BufferReader {
+  public:
+    explicit BufferReader(const std::string &buf) : buf(buf), pos(0) {}
+
+    bool get_u32(uint32_t &val) {
+        if (buf.size() - pos < sizeof(val)) {
+            return false;
+        }
+        memcpy(&val, buf.data() + pos, sizeof(val));
+        pos += sizeof(val);
+        return true;
+    }
+
+    bool get_string(std::string &str) {
+        uint32_t len;
+        if (!get_u32(len) || buf.size() - pos < len) {
+            return false;
+        }
+        str.assign(buf, pos, len);
+        pos += len;
+        return true;
+    }
+
+    bool get_strings(std::vector<std::string> &strs) {
+        uint32_t count;
+        if (!get_u32(count)) {
+            return false;
+        }
+        strs.resize(count);
+        for (auto &str : strs) {
+            if (!get_string(str)) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+  private:
+    const std::string &buf;
+    size_t pos;
+};
+
+// Write all the bytes, return false on error.
+static bool write_all(int fd, const char *data, size_t len) {
+    while (len > 0) {
+        ssize_t n = send(fd, data, len, MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        data += n;
+        len -= n;
+    }
+    return true;
+}
+
+// Read exactly `len` bytes, return false on error or EOF.
+static bool read_all(int fd, char *data, size_t len) {
+    while (len > 0) {
+        ssize_t n = read(fd, data, len);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return false;
+        }
+        data += n;
+        len -= n;
+    }
+    return true;
+}
+
+// Send a message framed as magic + length + payload.
+// The file descriptors (if any) are attached to the first byte of the message.
+static bool send_message(int sock, const std::string &payload, const int *fds = nullptr, size_t nfds = 0) {
+    std::string buf;
+    put_u32(buf, PROTOCOL_MAGIC);
+    put_u32(buf, static_cast<uint32_t>(payload.size()));
+    buf.append(payload);
+
+    if (nfds == 0) {
+        return write_all(sock, buf.data(), buf.size());
+    }
+
+    // Send the first byte along with the file descriptors, then the rest
+    char control[CMSG_SPACE(sizeof(int) * 3)] = {};
+    struct iovec iov = {&buf[0], 1};
+    struct msghdr msg = {};
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = CMSG_SPACE(sizeof(int) * nfds);
+
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int) * nfds);
+    memcpy(CMSG_DATA(cmsg), fds, sizeof(int) * nfds);
+
+    ssize_t n;
+    while ((n = sendmsg(sock, &msg, MSG_NOSIGNAL)) < 0 && errno == EINTR) {
+    }
+    if (n != 1) {
+        return false;
+    }
+    return write_all(sock, buf.data() + 1, buf.size() - 1);
+}
+
+// Receive a message sent by send_message(). Received file descriptors are stored in `fds`, the unused slots are -1.
+static bool recv_message(int sock, std::string &payload, int *fds = nullptr, size_t nfds = 0) {
+    char header[8];
+    for (size_t i = 0; i < nfds; i++) {
+        fds[i] = -1;
+    }
+
+    // Receive the first byte along with the file descriptors
+    char control[CMSG_SPACE(sizeof(int) * 3)] = {};
+    struct iovec iov = {header, 1};
+    struct msghdr msg = {};
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+
+    ssize_t n;
+    while ((n = recvmsg(sock, &msg, MSG_CMSG_CLOEXEC)) < 0 && errno == EINTR) {
+    }
+    if (n != 1) {
+        return false;
+    }
+
+    for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+        if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS) {
+            size_t count = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+            int *received = reinterpret_cast<int *>(CMSG_DATA(cmsg));
+            for (size_t i = 0; i < count; i++) {
+                if (i < nfds) {
+                    fds[i] = received[i];
+                } else {
+                    close(received[i]);
+                }
+            }
+        }
+    }
+
+    uint32_t magic, len;
+    if (!read_all(sock, header + 1, sizeof(header) - 1)) {
+        return false;
+    }
+    memcpy(&magic, header, sizeof(magic));
+    memcpy(&len, header + sizeof(magic), sizeof(len));
+    if (magic != PROTOCOL_MAGIC) {
+        return false;
+    }
+
+    payload.resize(len);
+    return len == 0 || read_all(sock, &payload[0], len);
+}
+
+// Receive what's available of a message sent by send_message() on a non-blocking socket. The file descriptors come
+// with the first byte. Return 1 when the message is complete, 0 if more is to come, or -1 on error or EOF.
+static int receive_request(Connection &conn, std::string &payload) {
+    char data[65536];
+    char control[CMSG_SPACE(sizeof(int) * 3)] = {};
+    struct iovec iov = {data, sizeof(data)};
+    struct msghdr msg = {};
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+
+    ssize_t n;
+    while ((n = recvmsg(conn.sock, &msg, MSG_CMSG_CLOEXEC)) < 0 && errno == EINTR) {
+    }
+    if (n < 0) {
+        return errno == EAGAIN || errno == EWOULDBLOCK ? 0 : -1;
+    }
+    if (n == 0) {
+        return -1;
+    }
+
+    for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+        if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS) {
+            size_t count = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+            int *received = reinterpret_cast<int *>(CMSG_DATA(cmsg));
+            for (size_t i = 0; i < count; i++) {
+                if (i < 3 && conn.fds[i] < 0) {
+                    conn.fds[i] = received[i];
+                } else {
+                    close(received[i]);
+                }
+            }
+        }
+    }
+    conn.buf.append(data, n);
+
+    uint32_t magic, len;
+    if (conn.buf.size() < sizeof(magic) + sizeof(len)) {
+        return 0;
+    }
+    memcpy(&magic, conn.buf.data(), sizeof(magic));
+    memcpy(&len, conn.buf.data() + sizeof(magic), sizeof(len));
+    if (magic != PROTOCOL_MAGIC) {
+        return -1;
+    }
+    if (conn.buf.size() < sizeof(magic) + sizeof(len) + len) {
+        return 0;
+    }
+    payload = conn.buf.substr(sizeof(magic) + sizeof(len), len);
+    return 1;
+}
+
+/*==========================================================================*/
+// * Socket
+
+static Path get_socket_path() {
+    const Path cache_dir = Paths::locate_cache_dir();
+    return cache_dir.empty() ? Path() : cache_dir / DAEMON_SOCKET_NAME;
+}
+
+// Fill the socket address, return false if the path is too long.
+static bool fill_sockaddr(const Path &socket_path, struct sockaddr_un &addr) {
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    const std::string path = socket_path.string();
+    if (path.empty() || path.size() >= sizeof(addr.sun_path)) {
+        return false;
+    }
+    memcpy(addr.sun_path, path.c_str(), path.size());
+    return true;
+}
+
+// Connect to the daemon, return the socket, or -1 if the daemon is not running.
+static int connect_daemon(const Path &socket_path) {
+    struct sockaddr_un addr;
+    if (!fill_sockaddr(socket_path, addr)) {
+        return -1;
+    }
+
+    int sock = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (sock < 0) {
+        return -1;
+    }
+    if (connect(sock, reinterpret_cast<struct sockaddr *>(&addr), sizeof(addr)) != 0) {
+        close(sock);
+        return -1;
+    }
+    return sock;
+}
+
+// Send a control request (stop, ping) to the daemon, return true if the daemon answered.
+static bool send_control_request(const Path &socket_path, RequestType type) {
+    int sock = connect_daemon(socket_path);
+    if (sock < 0) {
+        return false;
+    }
+
+    std::string payload(1, type);
+    std::string reply;
+    bool ok = send_message(sock, payload) && recv_message(sock, reply);
+    close(sock);
+    return ok;
+}
+
+/*==========================================================================*/
+// * Client
+
+bool Daemon::is_daemon_name(const char *argv0) {
+    const char *base = strrchr(argv0, '/');
+    return strcmp(base == NULL ? argv0 : base + 1, "rccd") == 0;
+}
+
+bool Daemon::forward(int argc, char **argv, int &exit_status) {
+    if (getenv("RCC_NO_DAEMON") != NULL) {
+        return false;
+    }
+
+    int sock = connect_daemon(get_socket_path());
+    if (sock < 0) {
+        return false; // Not running, fall back to the in-process path
+    }
+
+    char cwd[PATH_MAX];
+    if (getcwd(cwd, PATH_MAX) == NULL) {
+        close(sock);
+        return false;
+    }
+
+    std::string payload(1, REQUEST_RUN);
+    put_string(payload, cwd);
+    put_strings(payload, std::vector<std::string>(argv, argv + argc));
+    std::vector<std::string> env;
+    for (char **e = environ; *e != NULL; e++) {
+        env.push_back(*e);
+    }
+    put_strings(payload, env);
+
+    const int fds[3] = {STDIN_FILENO, STDOUT_FILENO, STDERR_FILENO};
+    if (!send_message(sock, payload, fds, 3)) {
+        close(sock);
+        return false; // Nothing has been done yet, it's safe to fall back
+    }
+
+    std::string reply;
+    if (!recv_message(sock, reply) || reply.empty()) {
+        close(sock);
+        gperror("The rcc daemon closed the connection unexpectedly\n");
+        exit_status = 1;
+        return true;
+    }
+    close(sock);
+
+    const std::string data = reply.substr(1);
+    BufferReader reader(data);
+
+    if (reply[0] == REPLY_EXEC) {
+        std::vector<std::string> exec_argv;
+        if (!reader.get_strings(exec_argv) || exec_argv.empty()) {
+            gperror("Invalid reply from the rcc daemon\n");
+            exit_status = 1;
+            return true;
+        }
+
+        CacheGC::lease_for_exec(exec_argv[0]);
+        Command(exec_argv).exec();
+
+        gperror("exec(): {}: {}\n", exec_argv[0], strerror(errno));
+        exit_status = 1;
+        return true;
+    }
+
+    uint32_t status;
+    if (reply[0] != REPLY_EXIT || !reader.get_u32(status)) {
+        gperror("Invalid reply from the rcc daemon\n");
+        exit_status = 1;
+        return true;
+    }
+    exit_status = static_cast<int>(status);
+    return true;
+}
+
+void Daemon::learn(LearnType type, const std::string &key, const std::string &value) {
+    if (learn_fd < 0) {
+        return;
+    }
+
+    std::string message(1, type);
+    put_string(message, key);
+    put_string(message, value);
+
+    std::string frame;
+    put_u32(frame, static_cast<uint32_t>(message.size()));
+    frame.append(message);
+
+    //* Writes no larger than PIPE_BUF are atomic, so the messages from concurrent workers never interleave.
+    //* Larger facts are simply not reported.
+    if (frame.size() <= PIPE_BUF) {
+        IGNORE_RESULT(write(learn_fd, frame.data(), frame.size()));
+    }
+}
+
+/*==========================================================================*/
+// * Server
+
+// The state kept in memory by the daemon.
+class DaemonState {
+  public:
+    DaemonState() : template_mtime{} {}
+
+    // Check the template file, forget the learned binaries if it changed.
+    void check_template() {
+        struct stat st;
+        if (stat(Paths::get_instance().get_template_file_path().c_str(), &st) != 0) {
+            return;
+        }
+        if (st.st_mtim.tv_sec != template_mtime.tv_sec || st.st_mtim.tv_nsec != template_mtime.tv_nsec) {
+            template_mtime = st.st_mtim;
+            exec_memo.clear();
+            compiler_support::read_template(Paths::get_instance().get_template_file_path());
+        }
+    }
+
+    // Look up the binary that the request runs, return an empty string if unknown, no longer exists or one of the
+    // files its cache key depends on changed since.
+    std::string lookup_exec(const std::string &key) const {
+        auto it = exec_memo.find(key);
+        if (it == exec_memo.end()) {
+            return "";
+        }
+        //* The same check as RCCode::is_cached(), a binary being published is never half-written.
+        const MemoEntry &entry = it->second;
+        struct stat st;
+        if (stat(entry.bin.c_str(), &st) != 0 || !S_ISREG(st.st_mode) || st.st_size == 0 || !(st.st_mode & S_IXUSR)) {
+            return "";
+        }
+        for (const auto &file : entry.key_files) {
+            if (compiler_support::get_file_identity(file.first) != file.second) {
+                gpdebug("Forgot binary {}, {} changed\n", entry.bin, file.first);
+                return "";
+            }
+        }
+        return entry.bin;
+    }
+
+    // Apply the facts reported by the workers.
+    void read_learned(int fd) {
+        char buf[PIPE_BUF];
+        ssize_t n = read(fd, buf, sizeof(buf));
+        if (n <= 0) {
+            return;
+        }
+        pending.append(buf, n);
+
+        uint32_t len;
+        while (pending.size() >= sizeof(len)) {
+            memcpy(&len, pending.data(), sizeof(len));
+            if (pending.size() < sizeof(len) + len) {
+                break;
+            }
+
+            const std::string message = pending.substr(sizeof(len) + 1, len - 1);
+            const char type = pending[sizeof(len)];
+            pending.erase(0, sizeof(len) + len);
+
+            std::string key, value;
+            BufferReader reader(message);
+            if (!reader.get_string(key) || !reader.get_string(value)) {
+                continue;
+            }
+
+            if (type == Daemon::LEARN_EXEC) {
+                // The binary, then the key files with their identities
+                std::vector<std::string> fields;
+                BufferReader value_reader(value);
+                if (!value_reader.get_strings(fields) || fields.empty() || fields.size() % 2 != 1) {
+                    continue;
+                }
+                MemoEntry &entry = exec_memo[key];
+                entry.bin = fields[0];
+                entry.key_files.clear();
+                for (size_t i = 1; i < fields.size(); i += 2) {
+                    entry.key_files.emplace_back(fields[i], fields[i + 1]);
+                }
+                gpdebug("Learned binary {}\n", entry.bin);
+            } else if (type == Daemon::LEARN_PCH_TEST) {
+                linux_clang::remember_test_pch(key, value == "true");
+            }
+        }
+    }
+
+  private:
+    struct MemoEntry {
+        std::string bin;
+        std::vector<std::pair<std::string, std::string>> key_files; // the files and their identities when learned
+    };
+
+    struct timespec template_mtime;
+    // Request key => the binary the request runs.
+    std::unordered_map<std::string, MemoEntry> exec_memo;
+    // Partially received messages from the workers.
+    std::string pending;
+};
+
+// Generate the key of a request. Requests with the same key run the same binary.
+static std::string gen_request_key(const Request &req) {
+    std::string to_hash = req.cwd;
+    for (const auto &arg : req.argv) {
+        to_hash += '\0' + arg;
+    }
+    to_hash += '\1';
+    for (const auto &e : req.env) {
+        to_hash += '\0' + e;
+    }
+    //* A 128-bit hash, a collision here would run the wrong binary.
+    return u128_to_string_base64x(hash128_string(to_hash));
+}
+
+// The arguments to pass to the binary, anything after "--".
+static std::vector<std::string> get_user_args(const std::vector<std::string> &argv) {
+    std::vector<std::string> user_args;
+    for (size_t i = 1; i < argv.size(); i++) {
+        if (argv[i] == "--") {
+            user_args.assign(argv.begin() + i + 1, argv.end());
+            break;
+        }
+    }
+    return user_args;
+}
+
+static bool parse_request(const std::string &payload, Request &req) {
+    if (payload.empty()) {
+        return false;
+    }
+    req.type = payload[0];
+    if (req.type != REQUEST_RUN) {
+        return true;
+    }
+
+    const std::string data = payload.substr(1);
+    BufferReader reader(data);
+    return reader.get_string(req.cwd) && reader.get_strings(req.argv) && reader.get_strings(req.env) &&
+           !req.argv.empty();
+}
+
+static bool send_exec_reply(int sock, const std::vector<std::string> &exec_argv) {
+    std::string payload(1, REPLY_EXEC);
+    put_strings(payload, exec_argv);
+    return send_message(sock, payload);
+}
+
+static bool send_exit_reply(int sock, int exit_status) {
+    std::string payload(1, REPLY_EXIT);
+    put_u32(payload, static_cast<uint32_t>(exit_status));
+    return send_message(sock, payload);
+}
+
+// Count a hit of a cache entry answered by the daemon itself, see Tier. Return false if the entry may still be
+// promoted, the request goes to a worker then, which knows the threshold of the command line.
+static bool count_memo_hit(const std::string &bin) {
+    Tier::Stats stats;
+    if (!Tier::read(bin, stats)) {
+        return true; // a permanent
+    }
+    if (stats.level == Tier::BASELINE) {
+        return false;
+    }
+    Tier::count_hit(bin, 0, stats);
+    return true;
+}
+
+// Serve a request in a forked worker. Never returns.
+static void run_worker(int sock, Request &req, const std::string &key) {
+    //* The daemon interrupts the process group if the client goes away, e.g. with Control-C while the binary runs.
+    setpgid(0, 0);
+    fcntl(sock, F_SETFL, fcntl(sock, F_GETFL) & ~O_NONBLOCK);
+
+    // The standard streams of the client become ours
+    for (int i = 0; i < 3; i++) {
+        if (req.fds[i] >= 0) {
+            dup2(req.fds[i], i);
+            close(req.fds[i]);
+        }
+    }
+
+    // Restore the default signal dispositions, they are inherited by the compilers and binaries
+    signal(SIGPIPE, SIG_DFL);
+    signal(SIGTERM, SIG_DFL);
+    signal(SIGINT, SIG_DFL);
+
+    if (chdir(req.cwd.c_str()) != 0) {
+        gperror("chdir(): {}: {}\n", req.cwd, strerror(errno));
+        send_exit_reply(sock, 1);
+        _exit(1);
+    }
+    Paths::get_instance().update_cwd();
+
+    // Take over the environment of the client
+    clearenv();
+    for (const auto &e : req.env) {
+        size_t eq = e.find('=');
+        if (eq != std::string::npos) {
+            setenv(e.substr(0, eq).c_str(), e.substr(eq + 1).c_str(), 1);
+        }
+    }
+
+    debug_level = DBG_LEVEL::WARNING;
+
+    std::vector<char *> argv;
+    for (auto &arg : req.argv) {
+        argv.push_back(&arg[0]);
+    }
+    argv.push_back(NULL);
+
+    RCC::DeferredRun run;
+    RCC::defer_run_bin(&run);
+
+    const int exit_status = rcc_entry(static_cast<int>(req.argv.size()), argv.data());
+
+    fflush(stdout);
+    fflush(stderr);
+
+    //* The client is done once it has the reply, an interrupt of the daemon after that must not print anything.
+    sigset_t interrupts;
+    sigemptyset(&interrupts);
+    sigaddset(&interrupts, SIGINT);
+
+    if (run.exec_argv.empty()) {
+        sigprocmask(SIG_BLOCK, &interrupts, nullptr);
+        send_exit_reply(sock, exit_status);
+    } else {
+        // Only plain runs are remembered, anything with side effects or debug output has to go through a worker.
+        //* A binary which depends on local files, e.g. the objects of --compile-with, is looked up by a worker every
+        //* time, the key of the command line does not tell when they changed.
+        const bool side_effects =
+            std::find(req.argv.begin(), req.argv.end(), "--clean-cache") != req.argv.end();
+        if (!side_effects && run.memoizable && debug_level <= DBG_LEVEL::WARNING) {
+            std::vector<std::string> fields = {run.exec_argv[0]};
+            for (const auto &file : run.key_files) {
+                fields.push_back(file);
+                fields.push_back(compiler_support::get_file_identity(file));
+            }
+            std::string value;
+            put_strings(value, fields);
+            Daemon::learn(Daemon::LEARN_EXEC, key, value);
+        }
+
+        sigprocmask(SIG_BLOCK, &interrupts, nullptr);
+        send_exec_reply(sock, run.exec_argv);
+    }
+
+    _exit(0);
+}
+
+static void stop_signal_handler(int s) {
+    (void)s;
+    stop_requested = 1;
+}
+
+// Close the sockets of the other clients in a worker.
+static void close_other_sockets(const std::vector<Connection> &connections, const std::vector<Worker> &workers) {
+    for (const auto &conn : connections) {
+        close(conn.sock);
+    }
+    for (const auto &worker : workers) {
+        if (worker.sock >= 0) {
+            close(worker.sock);
+        }
+    }
+}
+
+// Handle a received request, the connection is taken over. Return false if the daemon should stop.
+static bool handle_request(Connection &conn,
+                           const std::string &payload,
+                           int listen_fd,
+                           int learn_pipe[2],
+                           DaemonState &state,
+                           std::vector<Connection> &connections,
+                           std::vector<Worker> &workers) {
+    const int sock = conn.sock;
+    Request req;
+    std::copy(conn.fds, conn.fds + 3, req.fds);
+
+    bool keep_running = true;
+    bool keep_sock = false;
+    if (!parse_request(payload, req)) {
+        // Dropped
+    } else if (req.type == REQUEST_STOP) {
+        send_exit_reply(sock, 0);
+        keep_running = false;
+    } else if (req.type == REQUEST_PING) {
+        send_exit_reply(sock, 0);
+    } else {
+        const std::string key = gen_request_key(req);
+
+        // Answer by ourselves if we know which binary it runs
+        state.check_template();
+        const std::string bin = state.lookup_exec(key);
+        if (!bin.empty() && count_memo_hit(bin)) {
+            std::vector<std::string> exec_argv = {bin};
+            const std::vector<std::string> user_args = get_user_args(req.argv);
+            exec_argv.insert(exec_argv.end(), user_args.begin(), user_args.end());
+            send_exec_reply(sock, exec_argv);
+        } else {
+            pid_t pid = fork();
+            if (pid == 0) {
+                close(listen_fd);
+                close(learn_pipe[0]);
+                close_other_sockets(connections, workers);
+                learn_fd = learn_pipe[1];
+                run_worker(sock, req, key);
+            } else if (pid < 0) {
+                gpwarning("fork(): {}\n", strerror(errno));
+                send_exit_reply(sock, 1);
+            } else {
+                workers.push_back({pid, sock, 0});
+                keep_sock = true;
+            }
+        }
+    }
+
+    for (int fd : req.fds) {
+        if (fd >= 0) {
+            close(fd);
+        }
+    }
+    if (!keep_sock) {
+        close(sock);
+    }
+    return keep_running;
+}
+
+// Accept a connection of the same user, its request is received by receive_request().
+static void accept_connection(int listen_fd, std::vector<Connection> &connections) {
+    int sock = accept4(listen_fd, NULL, NULL, SOCK_CLOEXEC | SOCK_NONBLOCK);
+    if (sock < 0) {
+        return;
+    }
+
+    // Only serve the same user
+    struct ucred cred;
+    socklen_t cred_len = sizeof(cred);
+    if (getsockopt(sock, SOL_SOCKET, SO_PEERCRED, &cred, &cred_len) != 0 || cred.uid != getuid()) {
+        close(sock);
+        return;
+    }
+
+    // Don't let a stuck client hold its connection forever
+    connections.push_back({sock, "", {-1, -1, -1}, time(nullptr) + 2});
+}
+
+// Drop a connection, close the descriptors received so far.
+static void drop_connection(Connection &conn) {
+    for (int fd : conn.fds) {
+        if (fd >= 0) {
+            close(fd);
+        }
+    }
+    close(conn.sock);
+}
+
+int Daemon::serve(int argc, char **argv) {
+    bool foreground = false;
+    bool stop = false;
+    bool status = false;
+
+    CLI::App app{"RCCD - The resident rcc daemon"};
+    app.allow_non_standard_option_names();
+    app.add_flag("-f,--foreground", foreground, "Do not detach from the terminal");
+    app.add_flag("--stop", stop, "Stop the running daemon");
+    app.add_flag("--status", status, "Check if the daemon is running");
+    app.add_flag("-d0{0},-d1{1},-d2{2},-d3{3},-d4{4},-d5{5},--debug{3}", debug_level, "Debug level")
+        ->check(CLI::Range(0, 5))
+        ->option_text("LEVEL");
+    CLI11_PARSE(app, argc, argv);
+
+    // Validate the cache directory once, the workers inherit it
+    Paths &paths = Paths::get_instance();
+    const Path &socket_path = paths.get_daemon_socket_path();
+
+    if (stop) {
+        if (!send_control_request(socket_path, REQUEST_STOP)) {
+            gperror("rccd is not running\n");
+            return 1;
+        }
+        print("rccd stopped\n");
+        return 0;
+    }
+
+    const bool running = send_control_request(socket_path, REQUEST_PING);
+    if (status) {
+        print("rccd is {}\n", running ? "running" : "not running");
+        return running ? 0 : 1;
+    }
+    if (running) {
+        gperror("rccd is already running\n");
+        return 1;
+    }
+
+    struct sockaddr_un addr;
+    if (!fill_sockaddr(socket_path, addr)) {
+        gperror("Socket path is too long: {}\n", socket_path.string());
+        return 1;
+    }
+
+    // Remove the socket left by a daemon which did not exit cleanly
+    unlink(socket_path.c_str());
+
+    int listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (listen_fd < 0 || bind(listen_fd, reinterpret_cast<struct sockaddr *>(&addr), sizeof(addr)) != 0 ||
+        chmod(socket_path.c_str(), S_IRUSR | S_IWUSR) != 0 || listen(listen_fd, 64) != 0) {
+        gperror("Failed to listen on {}: {}\n", socket_path.string(), strerror(errno));
+        return 1;
+    }
+
+    int learn_pipe[2];
+    if (pipe2(learn_pipe, O_CLOEXEC) != 0) {
+        gperror("pipe(): {}\n", strerror(errno));
+        return 1;
+    }
+
+    if (!foreground) {
+        fflush(stdout);
+        fflush(stderr);
+        pid_t pid = fork();
+        if (pid < 0) {
+            gperror("fork(): {}\n", strerror(errno));
+            return 1;
+        } else if (pid > 0) {
+            return 0; // The socket is ready, clients can connect now
+        }
+        setsid();
+        int null_fd = open("/dev/null", O_RDWR);
+        if (null_fd >= 0) {
+            dup2(null_fd, STDIN_FILENO);
+            dup2(null_fd, STDOUT_FILENO);
+            dup2(null_fd, STDERR_FILENO);
+            close(null_fd);
+        }
+    }
+
+    signal(SIGPIPE, SIG_IGN);
+    struct sigaction sa = {};
+    sa.sa_handler = stop_signal_handler;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGTERM, &sa, nullptr);
+    sigaction(SIGINT, &sa, nullptr);
+
+    // Warm up
+    DaemonState state;
+    state.check_template();
+    linux_clang::preload_test_pch_cache();
+    compiler_support::resolve_linker("g++", "auto");
+    compiler_support::resolve_linker("clang++", "auto");
+
+    gpinfo("rccd is listening on {}\n", socket_path.string());
+
+    //* The requests are received from non-blocking sockets as they come, so a slow or stuck client never holds up the
+    //* others.
+    std::vector<Connection> connections;
+    std::vector<Worker> workers;
+    bool keep_running = true;
+    while (keep_running && !stop_requested) {
+        std::vector<struct pollfd> pfds = {{listen_fd, POLLIN, 0}, {learn_pipe[0], POLLIN, 0}};
+        for (const auto &conn : connections) {
+            pfds.push_back({conn.sock, POLLIN, 0});
+        }
+        //* A client never sends anything after its request, the socket only becomes readable when it goes away.
+        for (const auto &worker : workers) {
+            pfds.push_back({worker.sock, static_cast<short>(worker.sock >= 0 ? POLLIN : 0), 0});
+        }
+        const bool waiting = !connections.empty() || !workers.empty();
+        int n = poll(pfds.data(), pfds.size(), waiting ? 200 : 1000);
+
+        // Reap the workers, before their sockets are looked at, a reaped pid may be reused
+        pid_t pid;
+        while ((pid = waitpid(-1, NULL, WNOHANG)) > 0) {
+            for (size_t i = 0; i < workers.size(); i++) {
+                if (workers[i].pid == pid) {
+                    if (workers[i].sock >= 0) {
+                        close(workers[i].sock);
+                    }
+                    workers[i].pid = 0;
+                }
+            }
+        }
+
+        const time_t t = time(nullptr);
+        for (size_t i = 0; i < workers.size(); i++) {
+            Worker &worker = workers[i];
+            if (n > 0 && worker.pid > 0 && worker.sock >= 0 && pfds[2 + connections.size() + i].revents != 0) {
+                // The client went away, interrupt the worker like Control-C would, the compilers and the binary too
+                gpdebug("The client of worker {} went away, interrupting it\n", worker.pid);
+                kill(-worker.pid, SIGINT);
+                close(worker.sock);
+                worker.sock = -1;
+                worker.kill_time = t + 2;
+            }
+            if (worker.pid > 0 && worker.kill_time != 0 && t >= worker.kill_time) {
+                kill(-worker.pid, SIGKILL);
+                worker.kill_time = 0;
+            }
+        }
+        workers.erase(std::remove_if(workers.begin(), workers.end(), [](const Worker &w) { return w.pid == 0; }),
+                      workers.end());
+
+        // Receive the requests, the ones which are complete are handled
+        std::vector<Connection> receiving;
+        std::vector<std::pair<Connection, std::string>> received;
+        for (size_t i = 0; i < connections.size(); i++) {
+            Connection &conn = connections[i];
+            std::string payload;
+            const int result = n > 0 && pfds[2 + i].revents != 0 ? receive_request(conn, payload) : 0;
+            if (result > 0) {
+                received.emplace_back(conn, payload);
+            } else if (result < 0 || t >= conn.deadline) {
+                drop_connection(conn);
+            } else {
+                receiving.push_back(conn);
+            }
+        }
+        connections.swap(receiving);
+        for (auto &request : received) {
+            if (keep_running) {
+                keep_running = handle_request(request.first, request.second, listen_fd, learn_pipe, state,
+                                              connections, workers);
+            } else {
+                drop_connection(request.first);
+            }
+        }
+
+        if (n > 0 && (pfds[1].revents & POLLIN)) {
+            state.read_learned(learn_pipe[0]);
+        }
+
+        if (n > 0 && (pfds[0].revents & POLLIN)) {
+            accept_connection(listen_fd, connections);
+        }
+    }
+
+    for (auto &conn : connections) {
+        drop_connection(conn);
+    }
+    close(listen_fd);
+    unlink(socket_path.c_str());
+    gpinfo("rccd stopped\n");
+
+    return 0;
+}
+
+} // namespace rcc
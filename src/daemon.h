@@ -0,0 +1,41 @@
+#ifndef __RCC_DAEMON_H__
+#define __RCC_DAEMON_H__
+
+#include <string>
+
+namespace rcc {
+
+// The resident rcc daemon, `rccd`.
+//
+// Every rcc invocation pays for parsing argv, validating the cache directory and reading the template before it even
+// gets to a cache hit. The daemon keeps all of these in memory and serves thin clients over a Unix domain socket. A
+// client sends its argv, cwd, environment and standard file descriptors, and gets back either a binary to execute or
+// an exit status. If the daemon is not running, the client falls back to the in-process path.
+//
+// Each request is served by a forked worker, so the workers inherit the warm state of the daemon. The facts a worker
+// learns (which binary a command line runs, PCH test results) are reported back to the daemon through a pipe, so that
+// a repeated command line is answered by the daemon itself without forking.
+class Daemon {
+  public:
+    // The types of facts a worker reports back to the daemon, see learn().
+    enum LearnType : char { LEARN_EXEC = 'E', LEARN_PCH_TEST = 'P' };
+
+    // Check if the program is invoked as the daemon, i.e. the basename of argv[0] is `rccd`.
+    static bool is_daemon_name(const char *argv0);
+
+    // The main function of the daemon.
+    static int serve(int argc, char **argv);
+
+    // Forward the command line to the daemon if it's running. Return false if the daemon is not running, otherwise
+    // `exit_status` is set. If the daemon answers with a binary, this function does not return but executes it.
+    // Set the environment variable RCC_NO_DAEMON to always use the in-process path.
+    static bool forward(int argc, char **argv, int &exit_status);
+
+    // Report a fact learned by a worker to the daemon, so that the following requests can reuse it.
+    // Do nothing if not running inside a daemon worker.
+    static void learn(LearnType type, const std::string &key, const std::string &value);
+};
+
+} // namespace rcc
+
+#endif // __RCC_DAEMON_H__
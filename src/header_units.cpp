@@ -0,0 +1,226 @@
+#include "header_units.h"
+#include "compiler_support.h"
+#include "debug_fmt.h"
+#include "launcher.h"
+#include "lock.h"
+#include "paths.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <ctime>
+#include <fcntl.h>
+#include <fstream>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace rcc {
+
+static const time_t EXPIRE_SECONDS = 7 * 24 * 3600; // remove the header units which were not used for this long
+
+static const int PROBE_RUNS = 2; // the compilations of the test with the header unit and with the PCH, the best counts
+
+std::string HeaderUnits::get_key(const std::string &compiler, const std::vector<std::string> &flags) {
+    std::string to_hash = compiler_support::get_pch_fingerprint(compiler) + compiler;
+    for (const auto &flag : flags) {
+        to_hash += '\0';
+        to_hash += flag;
+    }
+    to_hash += "\nheader units";
+    return u128_to_string_base64x(hash128_string(to_hash));
+}
+
+Path HeaderUnits::get_units_dir(const std::string &key) {
+    return Paths::get_instance().get_sub_header_units_dir() / key;
+}
+
+static Path get_failed_path(const std::string &key) {
+    return Paths::get_instance().get_sub_header_units_dir() / (key + ".failed");
+}
+
+bool HeaderUnits::is_ready(const std::string &key) {
+    struct stat st;
+    return stat((get_units_dir(key) / "ready").c_str(), &st) == 0 && stat(get_failed_path(key).c_str(), &st) != 0;
+}
+
+void HeaderUnits::build_if_needed(const compiler_support &cs) {
+    const std::string key = cs.get_header_units_key();
+    struct stat st;
+    if (is_ready(key) || stat(get_failed_path(key).c_str(), &st) == 0) {
+        return;
+    }
+
+    // A build is already running, e.g. started by a concurrent rcc
+    FileLock probe;
+    if (!probe.lock(Paths::get_instance().get_sub_header_units_dir() / (key + ".lock"), false)) {
+        return;
+    }
+    probe.unlock();
+
+    start_build(cs, key);
+}
+
+void HeaderUnits::mark_failed(const std::string &key, const std::string &reason) {
+    gpdebug(fg(terminal_color::yellow) | emphasis::bold, "Header unit {} failed: {}\n", key, reason);
+    get_failed_path(key).write_file(reason + "\n");
+}
+
+std::vector<std::string> HeaderUnits::get_headers() {
+    std::ifstream file(Paths::get_instance().get_template_header_path().string());
+    std::vector<std::string> headers;
+    std::string line;
+    while (std::getline(file, line)) {
+        //* The headers are taken from the lines `#include <...>`, the commented ones and the C headers aside.
+        const size_t begin = line.find_first_not_of(" \t");
+        if (begin == std::string::npos || line.compare(begin, 8, "#include") != 0) {
+            continue;
+        }
+        const size_t open = line.find('<', begin);
+        const size_t close = line.find('>', open);
+        if (open == std::string::npos || close == std::string::npos) {
+            continue;
+        }
+        const std::string header = line.substr(open + 1, close - open - 1);
+        if (!ends_with(header, ".h") && header != "bits/stdc++.h" &&
+            std::find(headers.begin(), headers.end(), header) == headers.end()) {
+            headers.push_back(header);
+        }
+    }
+    return headers;
+}
+
+void HeaderUnits::start_build(const compiler_support &cs, const std::string &key) {
+    gpdebug(fg(terminal_color::yellow) | emphasis::bold, "Building the header unit {} in the background\n", key);
+
+    const pid_t pid = detach_background();
+    if (pid < 0) {
+        gpwarning("fork(): {}\n", strerror(errno));
+        return;
+    }
+    if (pid > 0) {
+        return;
+    }
+
+    //* The lock is held until the header unit is ready or failed, so a concurrent rcc never builds it twice.
+    FileLock lock;
+    struct stat st;
+    if (!lock.lock(Paths::get_instance().get_sub_header_units_dir() / (key + ".lock"), false) || is_ready(key) ||
+        stat(get_failed_path(key).c_str(), &st) == 0) {
+        _exit(0);
+    }
+
+    std::string reason;
+    if (!build(cs, key, reason)) {
+        mark_failed(key, reason);
+    }
+    _exit(0);
+}
+
+// Run a compilation `PROBE_RUNS` times, return the best time in milliseconds, or a negative value if it failed.
+static double time_probe(const std::vector<std::string> &args) {
+    double best = -1;
+    for (int i = 0; i < PROBE_RUNS; i++) {
+        const auto begin = now();
+        if (Command(args).redirect_output("/dev/null").run() != 0) {
+            return -1;
+        }
+        const double duration = duration_ms(begin);
+        best = best < 0 ? duration : std::min(best, duration);
+    }
+    return best;
+}
+
+bool HeaderUnits::build(const compiler_support &cs, const std::string &key, std::string &reason) {
+    const Paths &paths = Paths::get_instance();
+    const Path dir = get_units_dir(key);
+
+    // The leftovers of an interrupted build
+    std::error_code ec;
+    fs::remove_all(dir.get_path(), ec);
+    fs::create_directories(dir.get_path(), ec);
+    if (ec) {
+        reason = "can't create " + dir.string() + ": " + ec.message();
+        return false;
+    }
+
+    const std::vector<std::string> headers = get_headers();
+    if (headers.empty()) {
+        reason = "no standard header in the template header";
+        return false;
+    }
+    std::string units;
+    for (const auto &header : headers) {
+        units += "#include <" + header + ">\n";
+    }
+    const Path units_path = dir / "rcc_units.hpp";
+    units_path.write_file(units);
+
+    // The module mapper of g++, where the header unit is written and read from any working directory
+    (dir / "mapper").write_file(units_path.string() + " " + (dir / "rcc_units.gcm").string() + "\n");
+
+    if (Command(cs.get_header_unit_build_args(dir)).redirect_output("/dev/null").run() != 0) {
+        reason = "the compiler failed to build it";
+        return false;
+    }
+    (dir / "rcc_import.hpp").write_file("import \"" + units_path.string() + "\";\n");
+
+    //* The test of the template is compiled into an object, so the linker does not blur the comparison.
+    const Path test_path = paths.get_sub_templates_dir() / "test.cpp";
+    const Path obj_path = dir / "probe.o";
+    std::vector<std::string> units_args = {cs.get_compiler_name()};
+    const std::vector<std::string> flags = cs.get_pch_flags();
+    const std::vector<std::string> import_args = cs.get_header_unit_args(dir);
+    units_args.insert(units_args.end(), flags.begin(), flags.end());
+    units_args.push_back("-I" + paths.get_sub_templates_dir().string());
+    units_args.insert(units_args.end(), import_args.begin(), import_args.end());
+    units_args.insert(units_args.end(), {"-c", "-o", obj_path.string(), test_path.string()});
+
+    const double units_ms = time_probe(units_args);
+    const double pch_ms = time_probe(cs.get_compile_object_args(test_path, obj_path, dir / "probe.d"));
+    IGNORE_RESULT(remove(obj_path.c_str()));
+    IGNORE_RESULT(remove((dir / "probe.d").c_str()));
+    if (units_ms < 0) {
+        reason = "the test of the template failed to compile with it";
+        return false;
+    }
+    if (pch_ms >= 0 && units_ms >= pch_ms) {
+        reason = fmt::format("slower than the PCH, {:.0f} ms vs {:.0f} ms", units_ms, pch_ms);
+        return false;
+    }
+
+    (dir / "ready").write_file(fmt::format("{:.0f} {:.0f}\n", units_ms, pch_ms));
+    return true;
+}
+
+void HeaderUnits::prune() {
+    const time_t expire_time = time(nullptr) - EXPIRE_SECONDS;
+
+    //* The prelude is read by every compilation with the header unit, its access time is the last use.
+    std::error_code ec;
+    for (fs::directory_iterator it(Paths::get_instance().get_sub_header_units_dir().get_path(), ec), end;
+         !ec && it != end; it.increment(ec)) {
+        const Path dir = it->path();
+        struct stat st;
+        if (lstat(dir.c_str(), &st) != 0 || !S_ISDIR(st.st_mode)) {
+            continue;
+        }
+        time_t last_use = st.st_mtime;
+        if (stat((dir / "rcc_import.hpp").c_str(), &st) == 0) {
+            last_use = std::max(last_use, std::max(st.st_atime, st.st_mtime));
+        }
+        if (last_use >= expire_time) {
+            continue;
+        }
+
+        // A header unit which is being built
+        FileLock lock;
+        if (!lock.lock(Paths::get_instance().get_sub_header_units_dir() / (dir.filename() + ".lock"), false)) {
+            continue;
+        }
+        //! Caution: removes files
+        std::error_code remove_ec;
+        fs::remove_all(dir.get_path(), remove_ec);
+        gpdebug("Removed the header unit {}\n", dir.string());
+    }
+}
+
+} // namespace rcc
@@ -0,0 +1,61 @@
+#ifndef __RCC_HEADER_UNITS_H__
+#define __RCC_HEADER_UNITS_H__
+
+#include "path.h"
+#include <string>
+#include <vector>
+
+namespace rcc {
+
+class compiler_support;
+
+// The C++20 header unit of the standard headers of the template, an alternative to its PCH, see `--modules`.
+//
+// The standard headers which the template header includes are gathered into `header_units/<key>/rcc_units.hpp`, which
+// is compiled once into a header unit by a detached low-priority process. A compilation then imports it from a prelude
+// given with -include, `rcc_import.hpp`, before the template header is included. A header unit exports its macros, so
+// the include guards of the headers it holds are defined and the template header skips them. The generated code is the
+// same with the header unit and with the PCH, so a snippet can fall back to the PCH at any time.
+//
+// g++ 12 crashes on some code with the header units of the standard library, and a header unit is not always faster
+// than a PCH. So once built, the header unit compiles `test.cpp` of the templates with both, and is only used if it
+// compiled and was faster. A compilation which fails with it is compiled again with the PCH, and the header unit is
+// marked failed if that succeeds, see RCCode::wait_compile().
+//
+// The key is a hash of the compiler, the template header and the flags, so a header unit is never used with another
+// toolchain. The ones which were not used for a week are pruned.
+class HeaderUnits {
+  public:
+    // Get the key of the header unit of the compiler and the flags.
+    static std::string get_key(const std::string &compiler, const std::vector<std::string> &flags);
+
+    // Get the directory of the header unit of the key.
+    static Path get_units_dir(const std::string &key);
+
+    // Check if the header unit of the key is built and passed its test.
+    static bool is_ready(const std::string &key);
+
+    // Start building the header unit of the settings of the compiler in the background, unless it's built, being
+    // built or failed.
+    static void build_if_needed(const compiler_support &cs);
+
+    // Mark the header unit of the key failed, so that the PCH is used from then on.
+    static void mark_failed(const std::string &key, const std::string &reason);
+
+    // Get the standard headers which the template header includes, the ones of `bits/stdc++.h` aside.
+    static std::vector<std::string> get_headers();
+
+    // Remove the header units which were not used for a week, and the failure markers of the ones which are gone.
+    static void prune();
+
+  private:
+    // Build the header unit and test it in a detached low-priority process.
+    static void start_build(const compiler_support &cs, const std::string &key);
+
+    // Build the header unit into its directory, then compare it with the PCH. Return false if it's not usable.
+    static bool build(const compiler_support &cs, const std::string &key, std::string &reason);
+};
+
+} // namespace rcc
+
+#endif // __RCC_HEADER_UNITS_H__
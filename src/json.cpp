@@ -0,0 +1,252 @@
+#include "json.h"
+#include <cstdlib>
+
+namespace rcc {
+
+// A recursive descent parser following RFC 8259.
+class JsonValue::Parser {
+  public:
+    explicit Parser(const std::string &text) : text(text) {}
+
+    JsonValue parse_document() {
+        JsonValue value = parse_value(0);
+        skip_spaces();
+        if (pos != text.size()) {
+            fail("unexpected trailing characters");
+        }
+        return value;
+    }
+
+  private:
+    // Deeply nested input would overflow the stack otherwise
+    static const int MAX_DEPTH = 64;
+
+    [[noreturn]] void fail(const std::string &message) const {
+        throw std::runtime_error("JSON: " + message + " at offset " + std::to_string(pos));
+    }
+
+    void skip_spaces() {
+        while (pos < text.size() && (text[pos] == ' ' || text[pos] == '\t' || text[pos] == '\n' || text[pos] == '\r')) {
+            pos++;
+        }
+    }
+
+    void expect(char c) {
+        skip_spaces();
+        if (pos >= text.size() || text[pos] != c) {
+            fail(std::string("expected '") + c + "'");
+        }
+        pos++;
+    }
+
+    bool consume_literal(const char *literal) {
+        const std::string lit = literal;
+        if (text.compare(pos, lit.size(), lit) == 0) {
+            pos += lit.size();
+            return true;
+        }
+        return false;
+    }
+
+    JsonValue parse_value(int depth) {
+        if (depth > MAX_DEPTH) {
+            fail("too deeply nested");
+        }
+
+        skip_spaces();
+        if (pos >= text.size()) {
+            fail("unexpected end");
+        }
+
+        JsonValue value;
+        const char c = text[pos];
+        if (c == '{') {
+            pos++;
+            value.type = OBJECT;
+            skip_spaces();
+            if (pos < text.size() && text[pos] == '}') {
+                pos++;
+                return value;
+            }
+            while (true) {
+                skip_spaces();
+                if (pos >= text.size() || text[pos] != '"') {
+                    fail("expected a string key");
+                }
+                const std::string key = parse_string();
+                expect(':');
+                value.object[key] = parse_value(depth + 1);
+                skip_spaces();
+                if (pos < text.size() && text[pos] == ',') {
+                    pos++;
+                    continue;
+                }
+                expect('}');
+                return value;
+            }
+        } else if (c == '[') {
+            pos++;
+            value.type = ARRAY;
+            skip_spaces();
+            if (pos < text.size() && text[pos] == ']') {
+                pos++;
+                return value;
+            }
+            while (true) {
+                value.array.push_back(parse_value(depth + 1));
+                skip_spaces();
+                if (pos < text.size() && text[pos] == ',') {
+                    pos++;
+                    continue;
+                }
+                expect(']');
+                return value;
+            }
+        } else if (c == '"') {
+            value.type = STRING;
+            value.str = parse_string();
+        } else if (consume_literal("true")) {
+            value.type = BOOLEAN;
+            value.str = "true";
+        } else if (consume_literal("false")) {
+            value.type = BOOLEAN;
+            value.str = "false";
+        } else if (consume_literal("null")) {
+            value.type = NUL;
+        } else if (c == '-' || (c >= '0' && c <= '9')) {
+            value.type = NUMBER;
+            value.str = parse_number();
+        } else {
+            fail("unexpected character");
+        }
+        return value;
+    }
+
+    std::string parse_number() {
+        const size_t begin = pos;
+        if (text[pos] == '-') {
+            pos++;
+        }
+        auto digits = [&]() {
+            const size_t start = pos;
+            while (pos < text.size() && text[pos] >= '0' && text[pos] <= '9') {
+                pos++;
+            }
+            if (pos == start) {
+                fail("invalid number");
+            }
+        };
+        digits();
+        if (pos < text.size() && text[pos] == '.') {
+            pos++;
+            digits();
+        }
+        if (pos < text.size() && (text[pos] == 'e' || text[pos] == 'E')) {
+            pos++;
+            if (pos < text.size() && (text[pos] == '+' || text[pos] == '-')) {
+                pos++;
+            }
+            digits();
+        }
+        return text.substr(begin, pos - begin);
+    }
+
+    unsigned parse_hex4() {
+        if (pos + 4 > text.size()) {
+            fail("invalid unicode escape");
+        }
+        unsigned value = 0;
+        for (int i = 0; i < 4; i++) {
+            const char h = text[pos++];
+            value <<= 4;
+            if (h >= '0' && h <= '9') {
+                value |= h - '0';
+            } else if (h >= 'a' && h <= 'f') {
+                value |= h - 'a' + 10;
+            } else if (h >= 'A' && h <= 'F') {
+                value |= h - 'A' + 10;
+            } else {
+                fail("invalid unicode escape");
+            }
+        }
+        return value;
+    }
+
+    static void append_utf8(std::string &out, unsigned cp) {
+        if (cp < 0x80) {
+            out.push_back((char)cp);
+        } else if (cp < 0x800) {
+            out.push_back((char)(0xC0 | (cp >> 6)));
+            out.push_back((char)(0x80 | (cp & 0x3F)));
+        } else if (cp < 0x10000) {
+            out.push_back((char)(0xE0 | (cp >> 12)));
+            out.push_back((char)(0x80 | ((cp >> 6) & 0x3F)));
+            out.push_back((char)(0x80 | (cp & 0x3F)));
+        } else {
+            out.push_back((char)(0xF0 | (cp >> 18)));
+            out.push_back((char)(0x80 | ((cp >> 12) & 0x3F)));
+            out.push_back((char)(0x80 | ((cp >> 6) & 0x3F)));
+            out.push_back((char)(0x80 | (cp & 0x3F)));
+        }
+    }
+
+    std::string parse_string() {
+        pos++; // the opening quote
+        std::string out;
+        while (true) {
+            if (pos >= text.size()) {
+                fail("unterminated string");
+            }
+            const char c = text[pos++];
+            if (c == '"') {
+                return out;
+            }
+            if ((unsigned char)c < 0x20) {
+                fail("control character in string");
+            }
+            if (c != '\\') {
+                out.push_back(c);
+                continue;
+            }
+            if (pos >= text.size()) {
+                fail("unterminated string");
+            }
+            const char e = text[pos++];
+            switch (e) {
+            case '"': out.push_back('"'); break;
+            case '\\': out.push_back('\\'); break;
+            case '/': out.push_back('/'); break;
+            case 'b': out.push_back('\b'); break;
+            case 'f': out.push_back('\f'); break;
+            case 'n': out.push_back('\n'); break;
+            case 'r': out.push_back('\r'); break;
+            case 't': out.push_back('\t'); break;
+            case 'u': {
+                unsigned cp = parse_hex4();
+                // A surrogate pair
+                if (cp >= 0xD800 && cp <= 0xDBFF && text.compare(pos, 2, "\\u") == 0) {
+                    pos += 2;
+                    const unsigned low = parse_hex4();
+                    if (low < 0xDC00 || low > 0xDFFF) {
+                        fail("invalid surrogate pair");
+                    }
+                    cp = 0x10000 + ((cp - 0xD800) << 10) + (low - 0xDC00);
+                }
+                append_utf8(out, cp);
+                break;
+            }
+            default: fail("invalid escape");
+            }
+        }
+    }
+
+  private:
+    const std::string &text;
+    size_t pos{0};
+};
+
+JsonValue JsonValue::parse(const std::string &text) {
+    return Parser(text).parse_document();
+}
+
+} // namespace rcc
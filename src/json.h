@@ -0,0 +1,41 @@
+#ifndef __RCC_JSON_H__
+#define __RCC_JSON_H__
+
+#include <map>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace rcc {
+
+// A minimal JSON value, enough for the batch records, see Batch.
+// Numbers are kept as their text, there is no need to compute with them.
+class JsonValue {
+  public:
+    enum Type { NUL, BOOLEAN, NUMBER, STRING, ARRAY, OBJECT };
+
+    // Parse a JSON text, throw std::runtime_error on syntax errors.
+    static JsonValue parse(const std::string &text);
+
+    Type get_type() const { return type; }
+    bool is_string() const { return type == STRING; }
+    bool is_array() const { return type == ARRAY; }
+    bool is_object() const { return type == OBJECT; }
+
+    // The text of a string, number or boolean.
+    const std::string &get_string() const { return str; }
+    const std::vector<JsonValue> &get_array() const { return array; }
+    const std::map<std::string, JsonValue> &get_object() const { return object; }
+
+  private:
+    class Parser;
+
+    Type type{NUL};
+    std::string str;
+    std::vector<JsonValue> array;
+    std::map<std::string, JsonValue> object;
+};
+
+} // namespace rcc
+
+#endif // __RCC_JSON_H__
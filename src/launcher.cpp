@@ -0,0 +1,288 @@
+#include "launcher.h"
+#include "trace.h"
+#include "utils.h"
+#include <algorithm>
+#include <cerrno>
+#include <csignal>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <spawn.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+extern char **environ;
+
+namespace rcc {
+
+// The process groups started by Command::spawn() that have not been reaped yet.
+// A fixed-size array is used so that kill_all_processes() can be called inside a signal handler.
+static const size_t MAX_PROCESS_GROUPS = 16;
+static volatile pid_t process_groups[MAX_PROCESS_GROUPS] = {};
+
+static void register_process_group(pid_t pid) {
+    for (size_t i = 0; i < MAX_PROCESS_GROUPS; i++) {
+        if (process_groups[i] == 0) {
+            process_groups[i] = pid;
+            return;
+        }
+    }
+}
+
+static void unregister_process_group(pid_t pid) {
+    for (size_t i = 0; i < MAX_PROCESS_GROUPS; i++) {
+        if (process_groups[i] == pid) {
+            process_groups[i] = 0;
+        }
+    }
+}
+
+// Quote the argument for the shell only if needed, so the printed command stays readable.
+static std::string quote_for_print(const std::string &arg) {
+    if (arg.empty()) {
+        return "''";
+    }
+    for (char c : arg) {
+        if (!isalnum(static_cast<unsigned char>(c)) && strchr("_-+=/.,:@%", c) == NULL) {
+            return escapeshellarg(arg);
+        }
+    }
+    return arg;
+}
+
+std::string Command::to_string() const {
+    std::string str;
+    for (const auto &a : argv) {
+        if (!str.empty()) {
+            str += " ";
+        }
+        str += quote_for_print(a);
+    }
+    if (!stdin_path.empty()) {
+        str += " <" + quote_for_print(stdin_path.string());
+    }
+    if (!stdout_path.empty()) {
+        str += " >" + quote_for_print(stdout_path.string());
+    }
+    if (stderr_to_stdout) {
+        str += " 2>&1";
+    } else if (!stderr_path.empty()) {
+        str += " 2>" + quote_for_print(stderr_path.string());
+    }
+    return str;
+}
+
+std::vector<std::string> Command::build_env() const {
+    std::vector<std::string> env;
+    if (env_changes.empty()) {
+        return env;
+    }
+
+    for (char **e = environ; *e != NULL; e++) {
+        env.push_back(*e);
+    }
+
+    for (const auto &change : env_changes) {
+        const std::string prefix = change.name + "=";
+        env.erase(std::remove_if(env.begin(), env.end(),
+                                 [&](const std::string &e) { return starts_with(e, prefix); }),
+                  env.end());
+        if (!change.unset) {
+            env.push_back(prefix + change.value);
+        }
+    }
+    return env;
+}
+
+pid_t Command::spawn() const {
+    return spawn_impl(false);
+}
+
+pid_t Command::spawn_impl(bool default_interrupts) const {
+    if (argv.empty()) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    // Flush stdout and stderr before starting, so the output keeps its order.
+    fflush(stdout);
+    fflush(stderr);
+
+    posix_spawn_file_actions_t actions;
+    posix_spawnattr_t attr;
+    posix_spawn_file_actions_init(&actions);
+    posix_spawnattr_init(&attr);
+
+    if (!stdin_path.empty()) {
+        posix_spawn_file_actions_addopen(&actions, STDIN_FILENO, stdin_path.c_str(), O_RDONLY, 0);
+    }
+    if (!stdout_path.empty()) {
+        posix_spawn_file_actions_addopen(&actions, STDOUT_FILENO, stdout_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC,
+                                         0644);
+    }
+    if (stderr_to_stdout) {
+        posix_spawn_file_actions_adddup2(&actions, STDOUT_FILENO, STDERR_FILENO);
+    } else if (!stderr_path.empty()) {
+        posix_spawn_file_actions_addopen(&actions, STDERR_FILENO, stderr_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC,
+                                         0644);
+    }
+
+    short flags = 0;
+    if (own_process_group) {
+        flags |= POSIX_SPAWN_SETPGROUP;
+        posix_spawnattr_setpgroup(&attr, 0);
+    }
+    if (default_interrupts) {
+        sigset_t sigdefault;
+        sigemptyset(&sigdefault);
+        sigaddset(&sigdefault, SIGINT);
+        sigaddset(&sigdefault, SIGQUIT);
+        flags |= POSIX_SPAWN_SETSIGDEF;
+        posix_spawnattr_setsigdefault(&attr, &sigdefault);
+    }
+    posix_spawnattr_setflags(&attr, flags);
+
+    std::vector<char *> argv_c;
+    for (const auto &a : argv) {
+        argv_c.push_back(const_cast<char *>(a.c_str()));
+    }
+    argv_c.push_back(NULL);
+
+    const std::vector<std::string> env = build_env();
+    std::vector<char *> env_c;
+    for (const auto &e : env) {
+        env_c.push_back(const_cast<char *>(e.c_str()));
+    }
+    env_c.push_back(NULL);
+
+    pid_t pid;
+    //* posix_spawnp() searches the PATH like the shell does.
+    const auto time_begin = now();
+    int err = posix_spawnp(&pid, argv_c[0], &actions, &attr, argv_c.data(), env.empty() ? environ : env_c.data());
+    Trace::add("spawn", time_begin, now(), argv[0]);
+
+    posix_spawn_file_actions_destroy(&actions);
+    posix_spawnattr_destroy(&attr);
+
+    if (err != 0) {
+        errno = err;
+        return -1;
+    }
+
+    if (own_process_group) {
+        register_process_group(pid);
+    }
+    return pid;
+}
+
+int Command::run(struct rusage *usage) const {
+    // Ignore SIGINT and SIGQUIT while waiting like system() does, the child gets them instead.
+    struct sigaction ignore, old_int, old_quit;
+    memset(&ignore, 0, sizeof(ignore));
+    ignore.sa_handler = SIG_IGN;
+    sigemptyset(&ignore.sa_mask);
+    sigaction(SIGINT, &ignore, &old_int);
+    sigaction(SIGQUIT, &ignore, &old_quit);
+
+    int status = -1;
+    pid_t pid = spawn_impl(true);
+    if (pid > 0) {
+        status = wait_process(pid, usage);
+    }
+
+    const int saved_errno = errno;
+    sigaction(SIGINT, &old_int, nullptr);
+    sigaction(SIGQUIT, &old_quit, nullptr);
+    errno = saved_errno;
+
+    return status;
+}
+
+int Command::exec() const {
+    if (argv.empty()) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    // The stdio buffers are lost after exec, flush them first.
+    fflush(stdout);
+    fflush(stderr);
+
+    std::vector<char *> argv_c;
+    for (const auto &a : argv) {
+        argv_c.push_back(const_cast<char *>(a.c_str()));
+    }
+    argv_c.push_back(NULL);
+
+    const std::vector<std::string> env = build_env();
+    std::vector<char *> env_c;
+    for (const auto &e : env) {
+        env_c.push_back(const_cast<char *>(e.c_str()));
+    }
+    env_c.push_back(NULL);
+
+    execvpe(argv_c[0], argv_c.data(), env.empty() ? environ : env_c.data());
+    return -1;
+}
+
+int wait_process(pid_t pid, struct rusage *usage) {
+    int status;
+    pid_t ret;
+    while ((ret = wait4(pid, &status, 0, usage)) == -1 && errno == EINTR) {
+    }
+    unregister_process_group(pid);
+    return ret == -1 ? -1 : status;
+}
+
+pid_t detach_background() {
+    // Flush stdout and stderr before fork() to avoid duplicate output.
+    fflush(stdout);
+    fflush(stderr);
+
+    const pid_t pid = fork();
+    if (pid != 0) {
+        if (pid > 0) {
+            wait_process(pid);
+        }
+        return pid;
+    }
+
+    setsid();
+    if (fork() != 0) {
+        _exit(0);
+    }
+
+    //* fork() copies the descriptors whatever their O_CLOEXEC, and a flock belongs to the open file description. The
+    //* entry lock and the binary lease of the caller would be held until the background work ends. The mappings stay,
+    //* e.g. the one of the cache index.
+    close_range(3, ~0U, 0);
+
+    IGNORE_RESULT(setpriority(PRIO_PROCESS, 0, 10));
+    const int null_fd = open("/dev/null", O_RDWR);
+    if (null_fd >= 0) {
+        dup2(null_fd, STDIN_FILENO);
+        dup2(null_fd, STDOUT_FILENO);
+        dup2(null_fd, STDERR_FILENO);
+        close(null_fd);
+    }
+    return 0;
+}
+
+void kill_process(pid_t pid) {
+    if (pid <= 0) {
+        return;
+    }
+    kill(-pid, SIGKILL);
+    wait_process(pid);
+}
+
+void kill_all_processes() noexcept {
+    for (size_t i = 0; i < MAX_PROCESS_GROUPS; i++) {
+        if (process_groups[i] > 0) {
+            kill(-process_groups[i], SIGKILL);
+        }
+    }
+}
+
+} // namespace rcc
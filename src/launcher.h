@@ -0,0 +1,136 @@
+#ifndef __RCC_LAUNCHER_H__
+#define __RCC_LAUNCHER_H__
+
+#include "path.h"
+#include <string>
+#include <sys/resource.h>
+#include <sys/types.h>
+#include <vector>
+
+namespace rcc {
+
+// A command to be launched without a shell.
+//
+// The command is started by posix_spawn() with an argument vector, so there is no extra fork/exec of /bin/sh and no
+// quoting is needed. The string form from to_string() is for printing only.
+class Command {
+  public:
+    Command() {}
+    explicit Command(const std::vector<std::string> &argv) : argv(argv) {}
+
+    // Append an argument.
+    Command &arg(const std::string &a) {
+        argv.push_back(a);
+        return *this;
+    }
+
+    // Append arguments.
+    Command &args(const std::vector<std::string> &as) {
+        argv.insert(argv.end(), as.begin(), as.end());
+        return *this;
+    }
+
+    // Redirect the standard input from a file.
+    Command &redirect_stdin(const Path &path) {
+        stdin_path = path;
+        return *this;
+    }
+
+    // Redirect the standard output to a file, the file is truncated.
+    Command &redirect_stdout(const Path &path) {
+        stdout_path = path;
+        return *this;
+    }
+
+    // Redirect the standard error to a file, the file is truncated.
+    Command &redirect_stderr(const Path &path) {
+        stderr_path = path;
+        return *this;
+    }
+
+    // Redirect both the standard output and the standard error to a file, like `>file 2>&1`.
+    Command &redirect_output(const Path &path) {
+        stdout_path = path;
+        stderr_to_stdout = true;
+        return *this;
+    }
+
+    // Set an environment variable for the command.
+    Command &set_env(const std::string &name, const std::string &value) {
+        env_changes.push_back({name, value, false});
+        return *this;
+    }
+
+    // Remove an environment variable for the command.
+    Command &unset_env(const std::string &name) {
+        env_changes.push_back({name, "", true});
+        return *this;
+    }
+
+    // Put the command in its own process group, so that the whole process tree can be killed by kill_process().
+    Command &new_process_group() {
+        own_process_group = true;
+        return *this;
+    }
+
+    const std::vector<std::string> &get_argv() const { return argv; }
+
+    // The command as a shell command line, for printing only.
+    std::string to_string() const;
+
+    // Start the command, it flushes stdout and stderr before starting.
+    // Return the pid of the child process, or -1 on error.
+    pid_t spawn() const;
+
+    // Start the command and wait for it. SIGINT and SIGQUIT are ignored while waiting, like system() does.
+    // Return the status like system() does, or -1 on error. The resource usage is stored in `usage` if not null.
+    int run(struct rusage *usage = nullptr) const;
+
+    // Replace the current process with the command, so it inherits the pid, the signals and the exit status.
+    // The redirections and the process group are not applied. Only return on error with -1.
+    int exec() const;
+
+  private:
+    // Build the environment for the command, return an empty vector if the environment is unchanged.
+    std::vector<std::string> build_env() const;
+
+    // Start the command, reset SIGINT and SIGQUIT to the defaults in the child if `default_interrupts` is true.
+    pid_t spawn_impl(bool default_interrupts) const;
+
+  private:
+    struct EnvChange {
+        std::string name;
+        std::string value;
+        bool unset;
+    };
+
+    std::vector<std::string> argv;
+    Path stdin_path;
+    Path stdout_path;
+    Path stderr_path;
+    bool stderr_to_stdout{false};
+    std::vector<EnvChange> env_changes;
+    bool own_process_group{false};
+};
+
+// Wait for a child process started by Command::spawn() with wait4().
+// Return the status like system() does, or -1 on error. The resource usage is stored in `usage` if not null.
+int wait_process(pid_t pid, struct rusage *usage = nullptr);
+
+// Continue in a detached low-priority process, e.g. to build something in the background. Fork twice, so that the
+// process is neither a child of the program which replaces rcc nor in the session of the terminal, where Control-C
+// would kill it. Its standard streams are /dev/null, and the inherited descriptors are closed, so that it doesn't hold
+// the locks of the caller.
+// Return 0 in the detached process, the pid of the reaped intermediate child in the caller, or -1 on error.
+pid_t detach_background();
+
+// Kill the whole process group of a child process started in its own process group and reap it.
+void kill_process(pid_t pid);
+
+// Kill all the child processes started in their own process groups that are still running.
+// This is async-signal-safe, so it can be called inside a signal handler.
+void kill_all_processes() noexcept;
+
+} // namespace rcc
+
+#endif // __RCC_LAUNCHER_H__
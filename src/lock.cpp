@@ -0,0 +1,43 @@
+#include "lock.h"
+#include "paths.h"
+#include <cerrno>
+#include <fcntl.h>
+#include <sys/file.h>
+#include <unistd.h>
+
+namespace rcc {
+
+bool FileLock::lock(const Path &path, bool wait) {
+    unlock();
+
+    //* O_CLOEXEC: the lock must not be inherited by the compiler or the program that replaces rcc.
+    int new_fd = open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (new_fd < 0 && errno == ENOENT && Paths::restore_dir(path.parent_path())) {
+        new_fd = open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    }
+    if (new_fd < 0) {
+        return false;
+    }
+
+    int ret;
+    while ((ret = flock(new_fd, LOCK_EX | (wait ? 0 : LOCK_NB))) == -1 && errno == EINTR) {
+    }
+    if (ret != 0) {
+        const int saved_errno = errno;
+        close(new_fd);
+        errno = saved_errno;
+        return false;
+    }
+
+    fd = new_fd;
+    return true;
+}
+
+void FileLock::unlock() {
+    if (fd >= 0) {
+        close(fd); // closing the last descriptor releases the lock
+        fd = -1;
+    }
+}
+
+} // namespace rcc
@@ -0,0 +1,36 @@
+#ifndef __RCC_LOCK_H__
+#define __RCC_LOCK_H__
+
+#include "path.h"
+
+namespace rcc {
+
+// An exclusive advisory lock on a sidecar file, using flock().
+//
+// The lock is released by unlock(), by the destructor, or when the process exits or executes another program, so a
+// crashed process never leaves a stale lock behind. The sidecar file is never removed while in use, otherwise a
+// waiting process could lock a file which is no longer the one the others see.
+class FileLock {
+  public:
+    FileLock() {}
+    ~FileLock() { unlock(); }
+
+    FileLock(const FileLock &) = delete;
+    FileLock &operator=(const FileLock &) = delete;
+
+    // Lock the file, create it if it does not exist. Wait if another process holds the lock and `wait` is true.
+    // Return true if the lock is acquired.
+    bool lock(const Path &path, bool wait = true);
+
+    // Release the lock.
+    void unlock();
+
+    bool is_locked() const { return fd >= 0; }
+
+  private:
+    int fd{-1};
+};
+
+} // namespace rcc
+
+#endif // __RCC_LOCK_H__
@@ -0,0 +1,284 @@
+#include "objects.h"
+#include "debug_fmt.h"
+#include "launcher.h"
+#include "paths.h"
+#include "trace.h"
+#include "utils.h"
+#include <algorithm>
+#include <cstdio>
+#include <deque>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+namespace rcc {
+
+// A stale object which is being compiled, see ObjectCache::build().
+struct ObjectJob {
+    Path source;
+    Path obj_path;
+    Path dep_path;
+    Path tmp_obj_path;
+    Path tmp_dep_path;
+    Path log_path;
+    Command cmd;
+    pid_t pid{-1};
+};
+
+// Compare the modification times of two stat results, return true if `a` is newer than `b`.
+static bool is_newer(const struct stat &a, const struct stat &b) {
+    if (a.st_mtim.tv_sec != b.st_mtim.tv_sec) {
+        return a.st_mtim.tv_sec > b.st_mtim.tv_sec;
+    }
+    return a.st_mtim.tv_nsec > b.st_mtim.tv_nsec;
+}
+
+bool ObjectCache::scan() {
+    const Paths &paths = Paths::get_instance();
+
+    scanned = true;
+    changed = false;
+    sources.clear();
+    objects.clear();
+    stale.clear();
+    for (const auto &src : settings.get_additional_sources()) {
+        const Path source = fs::absolute(fs::path(src));
+
+        std::string content;
+        try {
+            content = source.read_file();
+        } catch (const std::exception &e) {
+            gperror("Failed to read {}: {}\n", src, e.what());
+            return false;
+        }
+
+        const std::string name = gen_object_name(source, content);
+        const Path obj_path = paths.get_sub_objects_dir() / (name + ".o");
+        sources.push_back(source);
+        objects.push_back(obj_path);
+        stale.push_back(!is_up_to_date(obj_path, paths.get_sub_objects_dir() / (name + ".d")));
+        if (!stale.back()) {
+            gpdebug("Using cached object {} ({})\n", obj_path.string(), src);
+        } else if (obj_path.exists()) {
+            changed = true;
+        }
+    }
+    return true;
+}
+
+bool ObjectCache::build() {
+    Trace::Span span("compile objects");
+
+    if (!scanned && !scan()) {
+        return false;
+    }
+
+    std::deque<ObjectJob> pending;
+    for (size_t i = 0; i < objects.size(); i++) {
+        if (!stale[i]) {
+            continue;
+        }
+
+        ObjectJob job;
+        job.source = sources[i];
+        job.obj_path = objects[i];
+        job.dep_path = objects[i];
+        job.dep_path.replace_extension(".d");
+
+        //* Compile to temporary files and rename them into place, so that a concurrent rcc never links a partial
+        //* object. The dependency file goes first, an object is only used together with its dependencies.
+        const std::string suffix = "." + std::to_string(getpid()) + ".tmp";
+        job.tmp_obj_path = job.obj_path.string() + suffix;
+        job.tmp_dep_path = job.dep_path.string() + suffix;
+        job.log_path = job.obj_path.string() + suffix + ".log";
+        job.cmd = Command(cs.get_compile_object_args(job.source, job.tmp_obj_path, job.tmp_dep_path));
+        if (isatty(fileno(stderr))) {
+            job.cmd.arg("-fdiagnostics-color=always");
+        }
+        job.cmd.redirect_output(job.log_path).new_process_group();
+        pending.push_back(job);
+    }
+
+    if (pending.empty()) {
+        return true;
+    }
+
+    //* The compiler would only report a file it can't create, so the directory is restored before, see
+    //* Paths::restore_dir(). It's a stat on a miss which compiles objects anyway.
+    Paths::restore_dir(Paths::get_instance().get_sub_objects_dir());
+
+    const auto ts = fg(terminal_color::yellow) | emphasis::bold;
+    gpdebug(ts, "Compiling {} object(s) of the additional sources\n", pending.size());
+
+    const auto time_begin = now();
+
+    // Run at most one compiler per CPU
+    long ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+    const size_t max_jobs = ncpus > 0 ? (size_t)ncpus : 1;
+
+    //* The jobs are waited for in the order they were started, a compiler which finishes early just waits a little
+    //* longer to be reaped. Waiting for any child would also reap the processes not started here.
+    std::deque<ObjectJob> running;
+    bool result = true;
+    while (!running.empty() || (result && !pending.empty())) {
+        while (result && !pending.empty() && running.size() < max_jobs) {
+            ObjectJob job = pending.front();
+            pending.pop_front();
+
+            gpdebug("{}\n", job.cmd.to_string());
+            job.pid = job.cmd.spawn();
+            if (job.pid < 0) {
+                gperror("posix_spawn(): {}\n", strerror(errno));
+                result = false;
+                break;
+            }
+            running.push_back(job);
+        }
+
+        if (running.empty()) {
+            break;
+        }
+
+        ObjectJob job = running.front();
+        running.pop_front();
+
+        // Stop at the first failure, the other compilers are killed
+        if (!result) {
+            kill_process(job.pid);
+            IGNORE_RESULT(remove(job.tmp_obj_path.c_str()));
+            IGNORE_RESULT(remove(job.tmp_dep_path.c_str()));
+            IGNORE_RESULT(remove(job.log_path.c_str()));
+            continue;
+        }
+
+        const int status = wait_process(job.pid);
+        if (status != -1 && WIFEXITED(status) && WEXITSTATUS(status) == 0) {
+            if (rename(job.tmp_dep_path.c_str(), job.dep_path.c_str()) != 0 ||
+                rename(job.tmp_obj_path.c_str(), job.obj_path.c_str()) != 0) {
+                gperror("Failed to move the object to {}: {}\n", job.obj_path.string(), strerror(errno));
+                result = false;
+            }
+        } else {
+            // Replay the compiler output
+            try {
+                const std::string output = job.log_path.read_file();
+                fflush(stdout);
+                fwrite(output.data(), 1, output.size(), stderr);
+            } catch (const std::exception &e) {
+                gpwarning("Failed to read the compiler output: {}\n", e.what());
+            }
+            gpwarning_ex("SRC FILE: file://{}\n", job.source.quote_if_needed());
+            gperror_ex(red_bold, "\nCOMPILATION FAILED!\n");
+            gpdebug("{}: {}\n", styled("COMPILE COMMAND", fg(color::saddle_brown) | emphasis::bold),
+                    job.cmd.to_string());
+            IGNORE_RESULT(remove(job.tmp_obj_path.c_str()));
+            IGNORE_RESULT(remove(job.tmp_dep_path.c_str()));
+            result = false;
+        }
+        IGNORE_RESULT(remove(job.log_path.c_str()));
+    }
+
+    if (result) {
+        stale.assign(stale.size(), false);
+        gpdebug("OBJECTS {}", styled("OK", green_bold));
+    } else {
+        gpdebug("OBJECTS {}", styled("FAILED", red_bold));
+    }
+    gpdebug_ex(", {}: {:.2f} ms\n", styled("TIME", ts), colored_duration(100, 600, duration_ms(time_begin)));
+
+    return result;
+}
+
+std::string ObjectCache::gen_object_name(const Path &source, const std::string &content) const {
+    // The compile arguments cover the compiler, the flags, the template header and the source location, which
+    // matters to the relative includes. The object and dependency paths are left as placeholders.
+    const std::vector<std::string> args = cs.get_compile_object_args(source, Path("@o"), Path("@d"));
+    std::string to_hash = content + "o" + vector_to_string(args, "\n");
+
+    // `-I.` makes the object depend on the working directory
+    if (std::find(args.begin(), args.end(), "-I.") != args.end()) {
+        to_hash += "b" + Paths::get_instance().get_cwd().string();
+    }
+
+    return u128_to_string_base64x(hash128_string(to_hash));
+}
+
+bool ObjectCache::is_up_to_date(const Path &obj_path, const Path &dep_path) {
+    struct stat obj_st;
+    if (stat(obj_path.c_str(), &obj_st) != 0) {
+        return false;
+    }
+
+    std::vector<std::string> deps;
+    if (!read_dep_file(dep_path, deps)) {
+        return false;
+    }
+
+    for (const auto &dep : deps) {
+        struct stat dep_st;
+        if (stat(dep.c_str(), &dep_st) != 0 || is_newer(dep_st, obj_st)) {
+            gpdebug("Object {} is stale: {} changed\n", obj_path.string(), dep);
+            return false;
+        }
+    }
+    return true;
+}
+
+bool ObjectCache::read_dep_file(const Path &dep_path, std::vector<std::string> &deps) {
+    //* Path::read_file() exits if the file can't be opened
+    if (!dep_path.exists()) {
+        return false;
+    }
+    std::string content;
+    try {
+        content = dep_path.read_file();
+    } catch (const std::exception &e) {
+        return false;
+    }
+
+    // The format is `target: prerequisite \<newline> prerequisite ...`, spaces in the names are escaped by `\`.
+    size_t pos = content.find(": ");
+    if (pos == std::string::npos) {
+        return false;
+    }
+
+    std::string dep;
+    for (size_t i = pos + 2; i < content.size(); i++) {
+        const char c = content[i];
+        if (c == '\\' && i + 1 < content.size()) {
+            const char next = content[i + 1];
+            if (next == '\n') { // line continuation
+                i++;
+                continue;
+            }
+            if (next == ' ' || next == '#' || next == '\\') {
+                dep.push_back(next);
+                i++;
+                continue;
+            }
+        }
+        if (c == '$' && i + 1 < content.size() && content[i + 1] == '$') {
+            dep.push_back('$');
+            i++;
+            continue;
+        }
+        if (c == ' ' || c == '\t' || c == '\n') {
+            if (!dep.empty()) {
+                deps.push_back(dep);
+                dep.clear();
+            }
+            // -MMD writes only one rule, the rest would be phony targets
+            if (c == '\n' && i + 1 < content.size() && content[i + 1] == '\n') {
+                break;
+            }
+            continue;
+        }
+        dep.push_back(c);
+    }
+    if (!dep.empty()) {
+        deps.push_back(dep);
+    }
+    return true;
+}
+
+} // namespace rcc
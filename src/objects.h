@@ -0,0 +1,63 @@
+#ifndef __RCC_OBJECTS_H__
+#define __RCC_OBJECTS_H__
+
+#include "compiler_support.h"
+#include "path.h"
+#include "settings.h"
+#include <string>
+#include <vector>
+
+namespace rcc {
+
+// The object files of the additional sources, i.e. `--compile-with`.
+//
+// Every additional source is compiled on its own into an object file under ~/.cache/rcc/cache/objects. The file is
+// named by the hash of the source content, the source location and the compile arguments, so a helper shared by many
+// snippets is compiled only once. An object is rebuilt if a header in its dependency file is newer than the object.
+// The final compilation then only compiles the generated code and links the objects.
+//
+// The object names are a part of the cache key of the binary, so a binary is never run with an edited helper. A
+// binary linked before one of its objects was rebuilt for a changed header is stale as well, see RCCode::is_cached().
+class ObjectCache {
+  public:
+    ObjectCache(const Settings &settings, compiler_support &cs) : settings(settings), cs(cs) {}
+
+    // Read the additional sources and name their objects without compiling them. Return false if one of them can't
+    // be read, the error is printed in that case.
+    bool scan();
+
+    // Compile the missing or stale objects in parallel, the sources are scanned first if they were not. Return false
+    // if one of them failed to compile, the compiler output is printed in that case.
+    bool build();
+
+    // The object files in the order of the additional sources, valid after scan().
+    const std::vector<Path> &get_objects() const { return objects; }
+
+    // Check if an object was compiled before and a header of its source changed since, valid after scan(). The
+    // binaries linked with it are stale then. A missing object, e.g. removed by the GC, is compiled again but does not
+    // make the binaries stale, its name tells the content.
+    bool has_changed() const { return changed; }
+
+  private:
+    // Generate the object file name of a source from its content and the compile arguments.
+    std::string gen_object_name(const Path &source, const std::string &content) const;
+
+    // Check if the object and all the files it depends on are there, and none of them is newer than the object.
+    static bool is_up_to_date(const Path &obj_path, const Path &dep_path);
+
+    // Read the prerequisites from a make-style dependency file written by -MMD.
+    static bool read_dep_file(const Path &dep_path, std::vector<std::string> &deps);
+
+  private:
+    const Settings &settings;
+    compiler_support &cs;
+    bool scanned{false};
+    bool changed{false};
+    std::vector<Path> sources; // absolute
+    std::vector<Path> objects;
+    std::vector<bool> stale; // the objects to compile, in the order of the additional sources
+};
+
+} // namespace rcc
+
+#endif // __RCC_OBJECTS_H__
@@ -1,6 +1,11 @@
 #include "paths.h"
 #include "debug_fmt.h"
+#include "trace.h"
+#include "utils.h"
+#include <fcntl.h>
 #include <iostream>
+#include <sys/stat.h>
+#include <unistd.h>
 
 namespace rcc {
 
@@ -42,6 +47,42 @@ Paths &Paths::get_instance() {
 }
 
 Paths::Paths() {
+    Trace::Span span("paths");
+    cache_dir = locate_cache_dir();
+    if (cache_dir.empty()) {
+        std::cerr << "Can't get $HOME" << std::endl;
+        exit(1);
+    }
+
+    sub_cache_dir = cache_dir / SUB_DIR_CACHE;
+    sub_templates_dir = cache_dir / SUB_DIR_TEMPLATES;
+    sub_permanent_dir = cache_dir / SUB_DIR_PERMANENT;
+    sub_libs_dir = cache_dir / SUB_DIR_LIBS;
+    sub_clang_pch_test_cache_dir = cache_dir / SUB_DIR_CLANG_PCH_TEST;
+    sub_pch_variants_dir = cache_dir / SUB_DIR_PCH_VARIANTS;
+    sub_header_units_dir = cache_dir / SUB_DIR_HEADER_UNITS;
+    sub_objects_dir = cache_dir / SUB_DIR_OBJECTS;
+
+    template_path = this->sub_templates_dir / "rcc_template.cpp";
+    template_header_path = this->sub_templates_dir / "rcc_template.hpp";
+    template_pch_path = this->sub_templates_dir / "rcc_template.hpp.gch";
+    daemon_socket_path = cache_dir / DAEMON_SOCKET_NAME;
+    cache_index_path = cache_dir / CACHE_INDEX_NAME;
+
+    if (!is_stamp_valid()) {
+        validate_cache_dir();
+        write_stamp();
+    }
+}
+
+const Path &Paths::get_cwd() const {
+    if (cwd.empty()) {
+        const_cast<Paths *>(this)->update_cwd();
+    }
+    return cwd;
+}
+
+void Paths::update_cwd() {
     // Save cwd
     char cwd[PATH_MAX];
     if (getcwd(cwd, PATH_MAX) == NULL) {
@@ -52,34 +93,66 @@ Paths::Paths() {
     this->cwd = std::string(cwd);
 
     gpmsgdump("CWD: {}\n", cwd);
+}
 
-    validate_cache_dir();
+Path Paths::get_stamp_path(const struct stat &root_st) const {
+    return cache_dir / (STAMP_PREFIX + std::to_string(RCC_LAYOUT_VERSION) + "-" + std::to_string(root_st.st_dev) +
+                        "-" + std::to_string(root_st.st_ino));
 }
 
-// Check the cache directory of rcc.
-void Paths::validate_cache_dir() {
-    gpmsgdump("Checking RCC cache directory:\n");
+bool Paths::is_stamp_valid() const {
+    struct stat root_st, stamp_st, header_st;
+    if (stat(cache_dir.c_str(), &root_st) != 0 || stat(get_stamp_path(root_st).c_str(), &stamp_st) != 0 ||
+        stamp_st.st_mtim.tv_sec != root_st.st_mtim.tv_sec || stamp_st.st_mtim.tv_nsec != root_st.st_mtim.tv_nsec) {
+        return false;
+    }
+    //* The template header lives in a sub directory, which the time of the root doesn't cover. Without it the full
+    //* check tells to reinstall rcc instead of a failed compile.
+    return stat(template_header_path.c_str(), &header_st) == 0;
+}
+
+void Paths::write_stamp() const {
+    //* The stale stamps are removed first, removing them and creating the stamp change the time of the root, so the
+    //* time is copied after it's created.
+    std::error_code ec;
+    for (fs::directory_iterator it(cache_dir.get_path(), ec), end; !ec && it != end; it.increment(ec)) {
+        if (starts_with(it->path().filename().string(), STAMP_PREFIX)) {
+            fs::remove(it->path(), ec);
+        }
+    }
+    struct stat root_st;
+    if (stat(cache_dir.c_str(), &root_st) != 0) {
+        return;
+    }
+    const Path stamp_path = get_stamp_path(root_st);
+    int fd = open(stamp_path.c_str(), O_WRONLY | O_CREAT | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        return; // validated every time then
+    }
+    if (stat(cache_dir.c_str(), &root_st) == 0) {
+        const struct timespec times[2] = {root_st.st_atim, root_st.st_mtim};
+        futimens(fd, times);
+    }
+    close(fd);
+    gpmsgdump("Wrote the validation stamp {}\n", stamp_path.string());
+}
 
+Path Paths::locate_cache_dir() {
     // Get rcc cache directory, default is $HOME/.cache/rcc
-    cache_dir = RCC_CACHE_DIR;
-    if (cache_dir.string().empty()) {
+    Path dir = RCC_CACHE_DIR;
+    if (dir.string().empty()) {
         const char *HOME = getenv("HOME");
         if (HOME == NULL) {
-            std::cerr << "Can't get $HOME" << std::endl;
-            exit(1);
+            return Path();
         }
-        cache_dir = fs::path(HOME) / ".cache/rcc";
+        dir = fs::path(HOME) / ".cache/rcc";
     }
+    return dir;
+}
 
-    sub_cache_dir = cache_dir / SUB_DIR_CACHE;
-    sub_templates_dir = cache_dir / SUB_DIR_TEMPLATES;
-    sub_permanent_dir = cache_dir / SUB_DIR_PERMANENT;
-    sub_libs_dir = cache_dir / SUB_DIR_LIBS;
-    sub_clang_pch_test_cache_dir = cache_dir / SUB_DIR_CLANG_PCH_TEST;
-
-    template_path = this->sub_templates_dir / "rcc_template.cpp";
-    template_header_path = this->sub_templates_dir / "rcc_template.hpp";
-    template_pch_path = this->sub_templates_dir / "rcc_template.hpp.gch";
+// Check the cache directory of rcc.
+void Paths::validate_cache_dir() {
+    gpmsgdump("Checking RCC cache directory:\n");
 
     // Check if the mandatory files or directories exist, if not, exit
     expect_exists(cache_dir.get_path());
@@ -92,6 +165,17 @@ void Paths::validate_cache_dir() {
     create_dir_if_not_exists(sub_cache_dir.get_path());
     create_dir_if_not_exists(sub_permanent_dir.get_path());
     create_dir_if_not_exists(sub_clang_pch_test_cache_dir.get_path());
+    create_dir_if_not_exists(sub_pch_variants_dir.get_path());
+    create_dir_if_not_exists(sub_header_units_dir.get_path());
+    create_dir_if_not_exists(sub_objects_dir.get_path());
+}
+
+bool Paths::restore_dir(const Path &dir) {
+    std::error_code ec;
+    if (fs::create_directories(dir.get_path(), ec)) {
+        gpdebug("Created the missing directory {}\n", dir.string());
+    }
+    return !ec;
 }
 
 void Paths::get_src_bin_full_path(const std::string &name, Path &src_path, Path &bin_path) const {
@@ -3,6 +3,7 @@
 
 #include "path.h"
 #include <string>
+#include <sys/stat.h>
 
 #ifndef RCC_CACHE_DIR
     // Store all temporary files in this directory, including auto-generated .cpp
@@ -19,18 +20,42 @@
 #define SUB_DIR_PERMANENT "permanent"
 #define SUB_DIR_LIBS "libs"
 #define SUB_DIR_CLANG_PCH_TEST "templates/clang_pch_test_cache"
+#define SUB_DIR_PCH_VARIANTS "templates/pch_variants"
+#define SUB_DIR_HEADER_UNITS "templates/header_units"
+#define SUB_DIR_OBJECTS "cache/objects"
+#define DAEMON_SOCKET_NAME "rccd.sock"
+#define CACHE_INDEX_NAME "cache.index"
+#define STAMP_PREFIX ".rcc-layout-v"
+
+// The version of the layout of the cache directory, bump it when a directory or a mandatory file is added, so that the
+// cache directory is checked again, see Paths.
+#define RCC_LAYOUT_VERSION 3
 
 namespace rcc {
 
 // Paths that are used by rcc.
 // This class is a singleton.
+//
+// The cache directory is fully checked, and the missing directories created, only when its validation stamp is stale.
+// The stamp is an empty file in the cache root, `.rcc-layout-v<version>-<device>-<inode>` of the root, whose
+// modification time is the one of the root. A directory added to or removed from the root changes the time of the
+// root, and a root replaced by another one, even restored with the same time, has another inode. The template header
+// is checked as well, so a startup is three stat() calls.
+// The current working directory is only looked up when it's needed.
 class Paths {
   public:
     // Get the singleton instance of Paths.
     static Paths &get_instance();
 
     // Get the current working directory.
-    const Path &get_cwd() const { return cwd; }
+    const Path &get_cwd() const;
+
+    // Update the current working directory after a chdir(), e.g. in a daemon worker.
+    void update_cwd();
+
+    // Locate the cache root directory without validating it.
+    // Usually ~/.cache/rcc. Return an empty path if it can't be located.
+    static Path locate_cache_dir();
 
     // Get the cache root directory. This is where the templates and compiled binaries are stored.
     // Usually ~/.cache/rcc.
@@ -56,6 +81,18 @@ class Paths {
     // Usually ~/.cache/rcc/templates/clang_pch_test_cache.
     const Path &get_sub_clang_pch_test_cache_dir() const { return sub_clang_pch_test_cache_dir; }
 
+    // Get the sub PCH variants directory. This is where the uses of the flag signatures are counted, see PchVariants.
+    // Usually ~/.cache/rcc/templates/pch_variants.
+    const Path &get_sub_pch_variants_dir() const { return sub_pch_variants_dir; }
+
+    // Get the sub header units directory. This is where the C++20 header units of the template are built, see
+    // HeaderUnits. Usually ~/.cache/rcc/templates/header_units.
+    const Path &get_sub_header_units_dir() const { return sub_header_units_dir; }
+
+    // Get the sub objects directory. This is where the object files of the additional sources are stored.
+    // Usually ~/.cache/rcc/cache/objects.
+    const Path &get_sub_objects_dir() const { return sub_objects_dir; }
+
     // Get the template cpp file path. User code is written to this file.
     // Usually ~/.cache/rcc/templates/rcc_template.cpp.
     const Path &get_template_file_path() const { return template_path; }
@@ -64,6 +101,14 @@ class Paths {
     // Usually ~/.cache/rcc/templates/rcc_template.hpp.
     const Path &get_template_header_path() const { return template_header_path; }
 
+    // Get the socket path of the rcc daemon.
+    // Usually ~/.cache/rcc/rccd.sock.
+    const Path &get_daemon_socket_path() const { return daemon_socket_path; }
+
+    // Get the path of the index of the cache entries, see CacheIndex.
+    // Usually ~/.cache/rcc/cache.index.
+    const Path &get_cache_index_path() const { return cache_index_path; }
+
     // Get the template pch file/directory path which contains the precompiled headers.
     // Usually ~/.cache/rcc/templates/rcc_template.hpp.pch.
     const Path &get_template_pch_path() const { return template_pch_path; }
@@ -78,6 +123,11 @@ class Paths {
                                          Path &bin_path,
                                          Path &desc_path) const;
 
+    // Create a sub directory again, after a file could not be created in it. The validation stamp only covers the
+    // cache root, see is_stamp_valid(), so a nested directory like templates/pch_variants which was removed is only
+    // noticed by its users. Return true if the directory exists.
+    static bool restore_dir(const Path &dir);
+
   private:
     // Private constructor to prevent instantiation.
     Paths();
@@ -85,17 +135,31 @@ class Paths {
     // Validate the root cache directory to ensure that everything is set up correctly.
     void validate_cache_dir();
 
+    // Check if the validation stamp is the one of the current cache root, see validate_cache_dir().
+    bool is_stamp_valid() const;
+
+    // Write the validation stamp after the cache root has been validated, and remove the stale ones.
+    void write_stamp() const;
+
+    // Get the path of the validation stamp of the cache root with the given status.
+    Path get_stamp_path(const struct stat &root_st) const;
+
   private:
-    Path cwd;
+    mutable Path cwd; // looked up by get_cwd()
     Path cache_dir;
     Path sub_cache_dir;
     Path sub_templates_dir;
     Path sub_permanent_dir;
     Path sub_libs_dir;
     Path sub_clang_pch_test_cache_dir;
+    Path sub_pch_variants_dir;
+    Path sub_header_units_dir;
+    Path sub_objects_dir;
     Path template_path;
     Path template_header_path;
     Path template_pch_path;
+    Path daemon_socket_path;
+    Path cache_index_path;
 };
 } // namespace rcc
 
@@ -0,0 +1,275 @@
+#include "pch_variants.h"
+#include "compiler_support.h"
+#include "debug_fmt.h"
+#include "launcher.h"
+#include "lock.h"
+#include "paths.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <ctime>
+#include <fcntl.h>
+#include <fstream>
+#include <set>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <tuple>
+#include <unistd.h>
+
+namespace rcc {
+
+static const time_t EXPIRE_SECONDS = 7 * 24 * 3600; // remove the variants which were not used for this long
+static const time_t LEFTOVER_SECONDS = 24 * 3600; // remove the files of the builds of removed variants this old
+
+static const char *const STATE_NAMES[] = {"counting", "failed"};
+
+std::string PchVariants::get_key(const Signature &signature) {
+    //* The fields are joined with characters which can't be in an argument, so "-D A" and "-DA" differ.
+    std::string to_hash = compiler_support::get_pch_fingerprint(signature.compiler) + signature.compiler;
+    for (const auto &flag : signature.flags) {
+        to_hash += '\0';
+        to_hash += flag;
+    }
+    to_hash += '\n';
+    for (const auto &inc : signature.includes) {
+        to_hash += '\0';
+        to_hash += inc;
+    }
+
+    // A chained PCH is only valid with the PCH it was built on
+    if (!signature.base.empty()) {
+        struct stat st;
+        to_hash += '\n' + signature.base.string();
+        if (stat(signature.base.c_str(), &st) == 0) {
+            to_hash += fmt::format(":{}:{}.{}", (long long)st.st_size, (long long)st.st_mtim.tv_sec,
+                                   (long long)st.st_mtim.tv_nsec);
+        }
+    }
+    return u128_to_string_base64x(hash128_string(to_hash));
+}
+
+Path PchVariants::get_variant_path(const std::string &compiler, const std::string &key) {
+    return Paths::get_instance().get_template_pch_path() / (compiler + ".variant." + key + ".gch");
+}
+
+std::string PchVariants::find(const Signature &signature) {
+    const std::string key = get_key(signature);
+    struct stat st;
+    return stat(get_variant_path(signature.compiler, key).c_str(), &st) == 0 && S_ISREG(st.st_mode) ? key : "";
+}
+
+template <typename F> bool PchVariants::update(const std::string &key, F modify) {
+    const Path path = Paths::get_instance().get_sub_pch_variants_dir() / (key + ".uses");
+    int fd = open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (fd < 0 && errno == ENOENT && Paths::restore_dir(path.parent_path())) {
+        fd = open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    }
+    if (fd < 0) {
+        return false;
+    }
+    int ret;
+    while ((ret = flock(fd, LOCK_EX)) == -1 && errno == EINTR) {
+    }
+    if (ret != 0) {
+        close(fd);
+        return false;
+    }
+
+    char buf[64];
+    const ssize_t n = pread(fd, buf, sizeof(buf) - 1, 0);
+    unsigned long long uses = 0;
+    State state = COUNTING;
+    if (n > 0) {
+        buf[n] = '\0';
+        char name[16];
+        if (sscanf(buf, "%llu %15s", &uses, name) == 2 && strcmp(name, STATE_NAMES[FAILED]) == 0) {
+            state = FAILED;
+        }
+    }
+
+    modify(uses, state);
+
+    //* The write updates the modification time, which is the last use of the variant, see prune().
+    const std::string content = std::to_string(uses) + " " + STATE_NAMES[state] + "\n";
+    bool result = pwrite(fd, content.data(), content.size(), 0) == (ssize_t)content.size() &&
+                  ftruncate(fd, content.size()) == 0;
+    close(fd); // releases the lock
+    return result;
+}
+
+void PchVariants::count_use(const Signature &signature, uint64_t threshold) {
+    const std::string key = get_key(signature);
+
+    bool build = false;
+    update(key, [&](unsigned long long &uses, State &state) {
+        uses++;
+        build = threshold > 0 && state == COUNTING && uses >= threshold;
+    });
+    gpdebug("PCH VARIANT: {} {} {}\n", key, vector_to_string(signature.flags),
+            vector_to_string(signature.includes, ", ", "<NONE>"));
+
+    if (build && find(signature).empty()) {
+        start_build(signature, key);
+    }
+}
+
+void PchVariants::start_build(const Signature &signature, const std::string &key) {
+    const Paths &paths = Paths::get_instance();
+
+    // A build is already running, e.g. started by a concurrent rcc
+    FileLock probe;
+    const Path lock_path = paths.get_sub_pch_variants_dir() / (key + ".lock");
+    if (!probe.lock(lock_path, false)) {
+        return;
+    }
+    probe.unlock();
+
+    gpdebug(fg(terminal_color::yellow) | emphasis::bold, "Building the PCH variant {} in the background\n", key);
+
+    const pid_t pid = detach_background();
+    if (pid < 0) {
+        gpwarning("fork(): {}\n", strerror(errno));
+        return;
+    }
+    if (pid > 0) {
+        return;
+    }
+
+    //* The lock is held until the variant is in place, so a concurrent rcc never builds it twice.
+    FileLock lock;
+    if (!lock.lock(lock_path, false) || !find(signature).empty()) {
+        _exit(0);
+    }
+
+    // The header of an include set, it's kept with the variant, clang++ checks the files a PCH was built from
+    Path header_path = paths.get_template_header_path();
+    bool result = true;
+    if (!signature.includes.empty()) {
+        header_path = paths.get_sub_pch_variants_dir() / (key + ".hpp");
+        std::ofstream header(header_path.string());
+        header << "#include \"" << paths.get_template_header_path().string() << "\"\n";
+        for (const auto &inc : signature.includes) {
+            header << "#include <" << inc << ">\n";
+        }
+        header.close();
+        result = !header.fail();
+    }
+
+    //* The dependencies are written for is_stale().
+    const Path tmp_path = paths.get_sub_pch_variants_dir() / (key + ".gch.tmp");
+    Command cmd;
+    cmd.arg(signature.compiler).args(signature.flags).arg(get_macro_flag(key));
+    if (!signature.base.empty()) {
+        cmd.args({"-include-pch", signature.base.string()});
+    }
+    cmd.args({"-MD", "-MF", (paths.get_sub_pch_variants_dir() / (key + ".d")).string()})
+        .args({"-x", "c++-header", header_path.string(), "-o", tmp_path.string()})
+        .redirect_output("/dev/null");
+    result = result && cmd.run() == 0;
+
+    if (result) {
+        // Make room for the new variant
+        prune(RCC_PCH_VARIANT_MAX > 0 ? RCC_PCH_VARIANT_MAX - 1 : 0);
+        result = rename(tmp_path.c_str(), get_variant_path(signature.compiler, key).c_str()) == 0;
+    }
+    if (!result) {
+        IGNORE_RESULT(remove(tmp_path.c_str()));
+        update(key, [](unsigned long long &, State &state) { state = FAILED; });
+    }
+    _exit(0);
+}
+
+bool PchVariants::is_stale(const std::string &key, time_t build_time) {
+    std::ifstream deps((Paths::get_instance().get_sub_pch_variants_dir() / (key + ".d")).string());
+    if (!deps.is_open()) {
+        return false;
+    }
+
+    //* The make-style rule is "<target>: <header> <header> \", the escaped spaces in the paths are not supported.
+    std::string token;
+    bool target = true;
+    while (deps >> token) {
+        if (target) {
+            target = !ends_with(token, ":");
+            continue;
+        }
+        struct stat st;
+        if (token != "\\" && (stat(token.c_str(), &st) != 0 || st.st_mtime > build_time)) {
+            gpdebug("PCH variant {} is stale, {} changed\n", key, token);
+            return true;
+        }
+    }
+    return false;
+}
+
+void PchVariants::remove_variant(const Path &variant_path, const std::string &key) {
+    const Path dir = Paths::get_instance().get_sub_pch_variants_dir();
+    //! Caution: removes files
+    if (remove(variant_path.c_str()) == 0) {
+        gpdebug("Removed the PCH variant {}\n", variant_path.string());
+    }
+    IGNORE_RESULT(remove((dir / (key + ".hpp")).c_str()));
+    IGNORE_RESULT(remove((dir / (key + ".d")).c_str()));
+}
+
+void PchVariants::prune(size_t max_variants) {
+    const Paths &paths = Paths::get_instance();
+    const time_t expire_time = time(nullptr) - EXPIRE_SECONDS;
+
+    // The variants with their last use and key, the most recent first
+    std::vector<std::tuple<time_t, Path, std::string>> variants;
+    std::error_code ec;
+    for (fs::directory_iterator it(paths.get_template_pch_path().get_path(), ec), end; !ec && it != end;
+         it.increment(ec)) {
+        const std::string name = it->path().filename().string();
+        const size_t begin = name.find(".variant.");
+        if (begin == std::string::npos || !ends_with(name, ".gch")) {
+            continue;
+        }
+        const std::string key = name.substr(begin + 9, name.size() - begin - 9 - 4);
+
+        struct stat st;
+        if (stat(it->path().c_str(), &st) != 0) {
+            continue;
+        }
+        if (is_stale(key, st.st_mtime)) {
+            remove_variant(it->path(), key);
+            continue;
+        }
+
+        //* A variant without a sidecar file was last used when it was built.
+        const Path uses_path = paths.get_sub_pch_variants_dir() / (key + ".uses");
+        IGNORE_RESULT(stat(uses_path.c_str(), &st));
+        variants.emplace_back(st.st_mtime, it->path(), key);
+    }
+    std::sort(variants.begin(), variants.end(),
+              [](const std::tuple<time_t, Path, std::string> &a, const std::tuple<time_t, Path, std::string> &b) {
+                  return std::get<0>(a) > std::get<0>(b);
+              });
+
+    //* A compiler which already opened a variant keeps reading it, removing it only affects the next compilations.
+    std::set<std::string> kept;
+    for (size_t i = 0; i < variants.size(); i++) {
+        if (i >= max_variants || std::get<0>(variants[i]) < expire_time) {
+            remove_variant(std::get<1>(variants[i]), std::get<2>(variants[i]));
+        } else {
+            kept.insert(std::get<2>(variants[i]));
+        }
+    }
+
+    // The headers and the dependency files of the variants which are gone, unless they are being built
+    const time_t leftover_time = time(nullptr) - LEFTOVER_SECONDS;
+    for (fs::directory_iterator it(paths.get_sub_pch_variants_dir().get_path(), ec), end; !ec && it != end;
+         it.increment(ec)) {
+        const Path path = it->path();
+        struct stat st;
+        if ((path.extension() != ".hpp" && path.extension() != ".d") || kept.count(path.stem()) != 0 ||
+            lstat(path.c_str(), &st) != 0 || st.st_mtime >= leftover_time) {
+            continue;
+        }
+        //! Caution: removes files
+        IGNORE_RESULT(remove(path.c_str()));
+    }
+}
+
+} // namespace rcc
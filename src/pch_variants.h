@@ -0,0 +1,93 @@
+#ifndef __RCC_PCH_VARIANTS_H__
+#define __RCC_PCH_VARIANTS_H__
+
+#include "path.h"
+#include <cstdint>
+#include <ctime>
+#include <string>
+#include <vector>
+
+#ifndef RCC_PCH_VARIANT_THRESHOLD
+    // Build a PCH variant for a flag signature after this many compilations with it, 0 disables the variants.
+    #define RCC_PCH_VARIANT_THRESHOLD 3
+#endif
+
+#ifndef RCC_PCH_VARIANT_MAX
+    // The number of PCH variants to keep, g++ tries them one by one when it looks for a PCH.
+    #define RCC_PCH_VARIANT_MAX 8
+#endif
+
+namespace rcc {
+
+// The PCH variants of the template header, built on demand for the signatures which the default PCHs don't match.
+//
+// A PCH is only used with the flags it was built with, e.g. a snippet compiled with -O2, another -std or a -D macro
+// can't use the default ones of template/Makefile. And the headers of --include or -fmt are not in them at all. Every
+// compilation with such a signature counts a use in a sidecar file `pch_variants/<key>.uses`, which holds
+// "<uses> <state>" and whose modification time is the last use. When the uses reach the threshold, the variant is built
+// by a detached low-priority process and moved into the PCH directory as `rcc_template.hpp.gch/<compiler>.variant.
+// <key>.gch`, where g++ finds it by itself and clang++ is given it.
+//
+// The variant of an include set is built from `pch_variants/<key>.hpp`, which includes the template header and the
+// headers of the set, so the includes of the generated code find their headers already there. g++ only takes one
+// PCH, so its variant holds the template header as well. clang++ chains it to the default PCH when it can use that.
+//
+// A variant defines the macro RCC_PCH_VARIANT as its key, and the compilations which use it define it the same way.
+// g++ does not check all the flags a PCH was built with, e.g. one built with -O1 is taken for -O2 and crashes it, the
+// macro keeps it from taking a variant for any other flags.
+//
+// The key is a hash of the compiler, the template header and the signature, so a variant is never used with another
+// toolchain. g++ does not check the headers a PCH was built from, so a variant whose headers changed since is removed
+// by prune(). The variants which are no longer used are pruned, so that the directory g++ scans stays short.
+class PchVariants {
+  public:
+    // What a PCH variant is built from.
+    struct Signature {
+        std::string compiler;
+        std::vector<std::string> flags; // the flags which the PCH has to be built with
+        std::vector<std::string> includes; // the system headers to precompile with the template header
+        Path base; // the PCH to chain the variant to, or an empty path
+    };
+
+    // Get the key of the variant of the signature.
+    static std::string get_key(const Signature &signature);
+
+    // Get the key of the variant of the signature, or an empty string if it's not built.
+    static std::string find(const Signature &signature);
+
+    // Get the path of the variant of the key.
+    static Path get_variant_path(const std::string &compiler, const std::string &key);
+
+    // Get the flag which defines the macro of the variant of the key.
+    static std::string get_macro_flag(const std::string &key) { return "-DRCC_PCH_VARIANT=" + key; }
+
+    // Count a compilation with the signature, and start building its variant once it was used `threshold` times.
+    // A `threshold` of 0 never builds a variant.
+    static void count_use(const Signature &signature, uint64_t threshold);
+
+    // Remove the variants whose headers changed since they were built, the ones which were not used for a week, then
+    // the least recently used ones beyond `max_variants`.
+    static void prune(size_t max_variants = RCC_PCH_VARIANT_MAX);
+
+  private:
+    enum State {
+        COUNTING, // the uses are counted, the variant is built once they reach the threshold
+        FAILED, // the variant failed to build, never try again with this toolchain
+    };
+
+    // Build the variant in a detached low-priority process.
+    static void start_build(const Signature &signature, const std::string &key);
+
+    // Check if a header the variant was built from changed since, by the dependency file of its build.
+    static bool is_stale(const std::string &key, time_t build_time);
+
+    // Remove a variant and the files it was built from.
+    static void remove_variant(const Path &variant_path, const std::string &key);
+
+    // Read, modify and write the sidecar file of the key under an exclusive lock. Return false on error.
+    template <typename F> static bool update(const std::string &key, F modify);
+};
+
+} // namespace rcc
+
+#endif // __RCC_PCH_VARIANTS_H__
@@ -1,9 +1,19 @@
 #include "rcc.h"
+#include "batch.h"
+#include "cache_gc.h"
+#include "cache_index.h"
 #include "code.h"
 #include "compiler_support.h"
+#include "daemon.h"
 #include "debug_fmt.h"
+#include "launcher.h"
+#include "lock.h"
+#include "objects.h"
 #include "paths.h"
+#include "pch_variants.h"
 #include "settings.h"
+#include "tier.h"
+#include "trace.h"
 #include "utils.h"
 #include <csignal>
 #include <iostream>
@@ -12,48 +22,64 @@ namespace rcc {
 
 static const std::string DEFAULT_PERMANENT_DESC = "No description provided";
 
-pid_t RCC::random_clean_cache() {
-    // 1/256 chances
-    //? Why not use the hash value of code as the seed?
-    //* The srand() and rand() is fast enough. And the same code has the same hash value.
-    if (rand() % 256 == 0) {
-        // Flush stdout and stderr before fork() to avoid duplicate output.
-        fflush(stdout);
-        fflush(stderr);
-
-        pid_t pid = fork();
-        if (pid == 0) { // in child process
-            const Paths &paths = Paths::get_instance();
-            // Find and remove src/bin files whose access time is 31 days ago
-            //! Caution: rm command
-            std::string find_rm_cmd =
-                format("find {} -type f \\( -name \"*.cpp\" -o -name \"*.bin\" \\) -atime +30 -delete",
-                       paths.get_sub_cache_dir().quote_if_needed());
-
-            const auto ts = fg(color::dark_red) | emphasis::bold;
-            gpdebug("{}: {}\n", styled("Removing old cache files", ts), find_rm_cmd);
-
-            if (system_s(find_rm_cmd) != 0) {
-                gperror("system(): {}\n", strerror(errno));
-                exit(1);
-            }
+RCC::DeferredRun *RCC::deferred_run = nullptr;
+
+// Remove a lock file unless another process holds it, a waiting process would lock a removed file otherwise, see
+// FileLock. Return false if it's held or can't be removed.
+static bool remove_unused_lock(const Path &path) {
+    FileLock probe;
+    if (!probe.lock(path, false)) {
+        return false;
+    }
+    //! Caution: removes files
+    //* The file is removed while it's locked, so nobody takes it in between.
+    if (remove(path.c_str()) != 0 && errno != ENOENT) {
+        gperror("Failed to remove {}: {}\n", path.string(), strerror(errno));
+        return false;
+    }
+    return true;
+}
 
-            // Leave this process to the init
-            exit(0);
-        } else if (pid < 0) {
-            gpwarning("fork(): {}\n", strerror(errno));
-            // Note: fork failed, continue anyway
+// Remove the files with the given extensions in a directory, like `rm -f dir/*.ext` but without a shell. The lock files
+// which are held are kept, see remove_unused_lock().
+// Return 0 on success, 1 on error.
+static int remove_files_by_extension(const Path &dir, const std::vector<std::string> &extensions) {
+    //! Caution: removes files
+    std::error_code ec;
+    int ret = 0;
+    for (fs::directory_iterator it(dir.get_path(), ec), end; !ec && it != end; it.increment(ec)) {
+        const Path path = it->path();
+        const std::string ext = path.extension();
+        if (std::find(extensions.begin(), extensions.end(), ext) == extensions.end()) {
+            continue;
+        }
+        if (ext == ".lock") {
+            if (!remove_unused_lock(path)) {
+                gpdebug("Kept {}, it's in use\n", path.string());
+            }
+            continue;
+        }
+        if (remove(path.c_str()) != 0 && errno != ENOENT) {
+            gperror("Failed to remove {}: {}\n", path.string(), strerror(errno));
+            ret = 1;
         }
-        return pid;
     }
-    return -1;
+    if (ec) {
+        gperror("Failed to list {}: {}\n", dir.string(), ec.message());
+        ret = 1;
+    }
+    return ret;
 }
 
 int RCC::clean_cache() {
-    //! Caution: rm command
-    const std::string sub_cache_dir = Paths::get_instance().get_sub_cache_dir().quote_if_needed();
-    std::string rm_cmd = "rm -f " + sub_cache_dir + "/*.cpp " + sub_cache_dir + "/*.bin";
-    return system_s(rm_cmd);
+    const Paths &paths = Paths::get_instance();
+    CacheIndex::get_instance().clear();
+
+    //* Everything goes, so the directory is scanned rather than the index. It finds the leftovers of interrupted
+    //* compilations, the entries which did not fit into the index and the `.hits` files of older versions as well.
+    int ret = remove_files_by_extension(paths.get_sub_cache_dir(), {".cpp", ".bin", ".lock", ".hits", ".fail", ".tmp"});
+    ret |= remove_files_by_extension(paths.get_sub_objects_dir(), {".o", ".d", ".tmp"});
+    return ret;
 }
 
 std::string RCC::gen_exec_cmd(const Settings &settings, const Path &bin_path) {
@@ -63,8 +89,37 @@ std::string RCC::gen_exec_cmd(const Settings &settings, const Path &bin_path) {
     return exec_cmd;
 }
 
+std::vector<std::string> RCC::gen_exec_argv(const Settings &settings, const Path &bin_path) {
+    std::vector<std::string> exec_argv = {bin_path.string()};
+    for (const auto &arg : settings.get_user_args()) {
+        exec_argv.push_back(arg);
+    }
+    return exec_argv;
+}
+
 int RCC::run_bin(const Settings &settings, const Path &cpp_path, const Path &bin_path) {
-    const std::string exec_cmd = RCC::gen_exec_cmd(settings, bin_path);
+    //* The running time is wanted by the debug output and by the trace.
+    const bool timed = debug_level >= DBG_LEVEL::DEBUG_ || Trace::is_enabled();
+
+    // Let the daemon client run the binary, unless the running time is wanted
+    if (deferred_run != nullptr && !timed) {
+        deferred_run->exec_argv = gen_exec_argv(settings, bin_path);
+        deferred_run->memoizable = is_hermetic(settings);
+        deferred_run->key_files = get_key_files(settings);
+        return 0;
+    }
+
+    const Command exec_cmd(gen_exec_argv(settings, bin_path));
+
+    // Nothing to do after the run unless the running time is wanted, so replace rcc with the binary.
+    //* The binary inherits our pid, signals and exit status, and there is no waiting parent.
+    if (!timed) {
+        // The GC leaves the binary alone while it runs
+        CacheGC::lease_for_exec(bin_path);
+        exec_cmd.exec();
+        gperror("exec(): {}: {}\n", bin_path.string(), strerror(errno));
+        return 1;
+    }
 
     /*------------------------------------------------------------------------*/
     // * Run the Executable
@@ -76,89 +131,178 @@ int RCC::run_bin(const Settings &settings, const Path &cpp_path, const Path &bin
         // This creates a hyperlink to the file
         gpdebug("SRC FILE: file://{}\n", cpp_path.quote_if_needed());
     }
-    gpdebug("EXECUTING: {}\n", styled(escapeforprint(exec_cmd), emphasis::underline));
+    gpdebug("EXECUTING: {}\n", styled(escapeforprint(exec_cmd.to_string()), emphasis::underline));
 
     const auto time_begin = now();
 
+    // The GC leaves the binary alone while it runs
+    const int lease_fd = CacheGC::lease(bin_path);
+
     const auto yellow_bold = fg(color::yellow) | emphasis::bold;
     gpdebug(yellow_bold, ">>>>>>>>>>>>>>>>>>>>>>>>>>>>\n");
-    int ret = system_s(exec_cmd);
+    int ret = exec_cmd.run();
+    if (lease_fd >= 0) {
+        close(lease_fd);
+    }
+    Trace::add("run", time_begin, now(), bin_path.filename());
     gpdebug(yellow_bold, "<<<<<<<<<<<<<<<<<<<<<<<<<<<<\n");
     gpdebug("RUNNING TIME: {:.2f} ms\n", duration_ms(time_begin));
 
-    if (ret == -1) { // System call failed. This is an error, e.g. fork() failed
-        gperror("system(): {}\n", strerror(errno));
+    return to_exit_status(ret);
+}
+
+int RCC::to_exit_status(int status) {
+    if (status == -1) { // System call failed. This is an error, e.g. fork() failed
+        gperror("posix_spawn(): {}\n", strerror(errno));
         return 1;
     }
 
     int exit_status = 1;
-    if (WIFEXITED(ret)) { // The process exited normally
-        exit_status = WEXITSTATUS(ret);
-    } else if (WIFSIGNALED(ret)) { // The process was terminated by a signal
-        gperror_ex(red_bold, "Killed by signal {}\n", WTERMSIG(ret));
+    if (WIFEXITED(status)) { // The process exited normally
+        exit_status = WEXITSTATUS(status);
+    } else if (WIFSIGNALED(status)) { // The process was terminated by a signal
+        gperror_ex(red_bold, "Killed by signal {}\n", WTERMSIG(status));
         return 1;
     } else { // The process was stopped by a signal or some other unexpected event
-        gperror_ex(red_bold, "Unexpected exit status {}\n", ret);
+        gperror_ex(red_bold, "Unexpected exit status {}\n", status);
         return 1;
     }
 
     return exit_status;
 }
 
-bool RCC::compile_file(const Settings &settings,
-                       const Path &cpp_path,
-                       const Path &bin_path,
-                       compiler_support &cs,
-                       bool silent) {
+Command RCC::gen_compile_cmd(const Path &cpp_path,
+                             const Path &bin_path,
+                             const std::vector<Path> &objects,
+                             compiler_support &cs,
+                             bool header_units) {
+    //* The additional sources are compiled by ObjectCache, only the generated code is compiled here.
     std::vector<Path> sources = {cpp_path};
-    for (auto &src : settings.get_additional_sources()) {
-        sources.emplace_back(src);
-    }
+    sources.insert(sources.end(), objects.begin(), objects.end());
 
-    const std::string compile_cmd = cs.get_compile_command(sources, bin_path) + (silent ? " >/dev/null 2>&1" : "");
-
-    gpdebug("{}\n", compile_cmd);
+    return Command(cs.get_compile_args(sources, bin_path, header_units));
+}
 
-    if (system_s(compile_cmd) != 0) {
-        if (!silent) {
-            const std::string exec_cmd = RCC::gen_exec_cmd(settings, bin_path);
-            if (isatty(fileno(stderr))) {
-                // This creates a hyperlink to the file in the terminal, only tested on zsh
-                gpwarning_ex("SRC FILE: \e]8;;file://{}\a{}\e]8;;\a\n", cpp_path.quote_if_needed(), "file");
-            } else {
-                // This creates a hyperlink to the file
-                gpwarning_ex("SRC FILE: file://{}\n", cpp_path.quote_if_needed());
-            }
-            gperror_ex(red_bold, "\nCOMPILATION FAILED!\n");
-            const auto ts = fg(color::saddle_brown) | emphasis::bold;
-            gpdebug("{}: {}\n", styled("COMPILE COMMAND", ts), compile_cmd);
-            gpdebug("{}: {}\n", styled("EXECUTE COMMAND", ts), exec_cmd);
-        }
-        return false;
+void RCC::report_compile_failure(const Settings &settings,
+                                 const Path &cpp_path,
+                                 const Path &bin_path,
+                                 const std::string &compile_cmd) {
+    const std::string exec_cmd = RCC::gen_exec_cmd(settings, bin_path);
+    if (isatty(fileno(stderr))) {
+        // This creates a hyperlink to the file in the terminal, only tested on zsh
+        gpwarning_ex("SRC FILE: \e]8;;file://{}\a{}\e]8;;\a\n", cpp_path.quote_if_needed(), "file");
+    } else {
+        // This creates a hyperlink to the file
+        gpwarning_ex("SRC FILE: file://{}\n", cpp_path.quote_if_needed());
     }
-    return true;
+    gperror_ex(red_bold, "\nCOMPILATION FAILED!\n");
+    const auto ts = fg(color::saddle_brown) | emphasis::bold;
+    gpdebug("{}: {}\n", styled("COMPILE COMMAND", ts), compile_cmd);
+    gpdebug("{}: {}\n", styled("EXECUTE COMMAND", ts), exec_cmd);
 }
 
-std::string RCC::gen_first_hash_filename(const Settings &settings, const std::string &code) {
+std::string RCC::gen_first_hash_filename(const Settings &settings,
+                                         const std::string &code,
+                                         const std::vector<std::string> &functions,
+                                         const std::vector<Path> &objects) {
     const std::string &compiler = settings.get_compiler();
+    //* The linker as asked for, "auto" is resolved only when the code is compiled, see get_linker_flag(). The linker
+    //* it resolves to does not change what the binary does, a new one is picked up by the next miss.
+    const std::string &linker = settings.get_linker();
 
     const std::string cxxflags = settings.get_std_cxxflags_as_string();
     const std::string additional_flags = settings.get_additional_flags_as_string();
-    const std::string additional_includes = settings.get_additional_includes_as_string();
     const std::string above_main = settings.get_above_main_as_string();
-    const std::string functions = settings.get_functions_as_string();
-    const std::string additional_sources = settings.get_additional_sources_as_string();
+
+    //* The fields which look at the files are the same for the original and the auto-wrapped code, so they are
+    //* computed once per process.
+    static std::string cached_context_input;
+    static std::string template_fingerprint;
+    static std::string additional_includes;
+    static std::string instances;
+    const std::string context_input = compiler + '\0' + cxxflags + '\0' + additional_flags + '\0' +
+                                      vector_to_string(settings.get_additional_includes(), "\n") + '\0' +
+                                      settings.get_permanent();
+    if (context_input != cached_context_input) {
+        template_fingerprint =
+            compiler_support::get_template_fingerprint(Paths::get_instance().get_template_file_path());
+
+        //* The library of the instantiations the binary is linked with, a binary linked with the shared library which
+        //* was removed or rebuilt is compiled again instead of failing to load it.
+        const auto cs = create_compiler_support(compiler, settings);
+        instances = cs->get_instances_identity();
+
+        //* An include is a local header if it exists, a system one otherwise, see compiler_support::gen_code().
+        additional_includes.clear();
+        for (const auto &inc : settings.get_additional_includes()) {
+            additional_includes += inc + (compiler_support::is_local_include(inc) ? "\"" : "<");
+        }
+
+        // The PCH variant of the include set, so that a binary is rebuilt when the toolchain its headers are
+        // precompiled with changes, see PchVariants
+        if (!additional_includes.empty()) {
+            if (!cs->get_pch_includes().empty()) {
+                additional_includes += '\n' + PchVariants::get_key(cs->get_pch_signature());
+            }
+        }
+        cached_context_input = context_input;
+    }
+
+    //* The objects are named by the content of the sources, a helper which is edited gets a new binary.
+    std::string additional_sources;
+    for (const auto &object : objects) {
+        additional_sources += object.filename() + '\n';
+    }
 
     // The string to hash, which determines the output file name.
-    // It is used to determine if we need to recompile the code or not.
-    const std::string to_hash = code + "a" + compiler + "b" + cxxflags + "a" + additional_flags + "c" +
-                                additional_includes + "k" + above_main + "e" + functions + "r" + additional_sources;
+    // It is used to determine if we need to recompile the code or not. It holds everything the full code is generated
+    // from, in the same order.
+    //* The fields are separated by '\0', so that moving text from one field to the next changes the hash.
+    const std::string to_hash = template_fingerprint + '\0' + additional_includes + '\0' + above_main + '\0' +
+                                vector_to_string(functions, "\n") + '\0' + code + '\0' + compiler + '\0' + linker +
+                                '\0' + cxxflags + '\0' + additional_flags + '\0' + additional_sources + '\0' +
+                                instances;
+
+    return u128_to_string_base64x(hash128_string(to_hash));
+}
 
-    return u64_to_string_base64x(fnv1a_64_hash_string(to_hash));
+bool RCC::is_hermetic(const Settings &settings) {
+    if (!settings.get_additional_sources().empty()) {
+        return false;
+    }
+    for (const auto &include : settings.get_additional_includes()) {
+        if (compiler_support::is_local_include(include)) {
+            return false;
+        }
+    }
+    for (const auto *flags : {&settings.get_cxxflags(), &settings.get_additional_flags()}) {
+        for (const auto &flag : *flags) {
+            if (starts_with(flag, "-I") || starts_with(flag, "-L") || starts_with(flag, "-l") ||
+                starts_with(flag, "-i") || starts_with(flag, "-Wl,") || starts_with(flag, "@") ||
+                starts_with(flag, "--sysroot")) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+std::vector<std::string> RCC::get_key_files(const Settings &settings) {
+    //* The PCH variant of an include set is a part of the key, so is what it's built from, see PchVariants::get_key().
+    std::vector<std::string> files = {Paths::get_instance().get_template_file_path().string()};
+    if (!settings.get_additional_includes().empty()) {
+        const std::vector<std::string> pch_files = compiler_support::get_pch_files(settings.get_compiler());
+        files.insert(files.end(), pch_files.begin(), pch_files.end());
+    }
+    // So is the library of the instantiations, whether it's there or not
+    const auto cs = create_compiler_support(settings.get_compiler(), settings);
+    files.push_back(cs->get_instances_library().string());
+    return files;
 }
 
 std::string RCC::gen_second_hash_identifier(const Settings &settings) {
     const std::string &compiler = settings.get_compiler();
+    const std::string &linker = settings.get_linker();
 
     const std::string cxxflags = settings.get_std_cxxflags_as_string();
     const std::string additional_flags = settings.get_additional_flags_as_string();
@@ -166,14 +310,14 @@ std::string RCC::gen_second_hash_identifier(const Settings &settings) {
     const std::string additional_sources = settings.get_additional_sources_as_string();
 
     // The hash of this string will be written into the cpp file, so that if one of the fields change, we can detect it
-    // and recompile the code. This is an insurance in case the first hash collides.
+    // and recompile the code. This is an insurance in case the first hash collides, see RCCode::is_cached().
     //* So in theory, if this program somehow runs the wrong binary, it means the two different inputs must have the
     //* same two hashes, and the same code, includes, above main, and functions, since these fields will go into the cpp
     //* file as well, and as what they were given.
-    const std::string to_hash = compiler + "n" + cxxflags + "i" + additional_flags + "n" + additional_includes + "i" +
-                                additional_sources;
+    const std::string to_hash = compiler + "l" + linker + "n" + cxxflags + "i" + additional_flags + "n" +
+                                additional_includes + "i" + additional_sources;
 
-    return u64_to_string_base64x(fnv1a_64_hash_string(to_hash));
+    return u128_to_string_base64x(hash128_string(to_hash));
 }
 
 std::string RCC::suggest_similar_permanent(const std::string &name) {
@@ -277,6 +421,57 @@ int RCC::list_permanents(const Settings &settings) {
     return 0;
 }
 
+int RCC::print_stats() {
+    const Paths &paths = Paths::get_instance();
+    CacheIndex &index = CacheIndex::get_instance();
+    if (!index.is_open()) {
+        gperror("The cache index {} is not available\n", paths.get_cache_index_path().string());
+        return 1;
+    }
+
+    struct Entry {
+        CacheIndex::Entry index;
+        Tier::Level level;
+    };
+    std::vector<Entry> entries;
+    uint64_t total_size = 0;
+    uint64_t total_hits = 0;
+    uint64_t total_cost_ms = 0;
+    size_t num_levels[Tier::FIXED + 1] = {};
+
+    for (const auto &index_entry : index.get_entries()) {
+        Entry entry{index_entry, static_cast<Tier::Level>(index_entry.tier)};
+
+        total_size += entry.index.size;
+        total_hits += entry.index.hits;
+        total_cost_ms += entry.index.cost_ms;
+        num_levels[entry.level]++;
+        entries.push_back(entry);
+    }
+
+    print("Cache: {} entries, {:.1f} MiB, {} hits, {:.1f} s of compilation\n", entries.size(), total_size / 1048576.0,
+          total_hits, total_cost_ms / 1000.0);
+    print("Tiers:");
+    for (int level = Tier::BASELINE; level <= Tier::FIXED; level++) {
+        print(" {} {}", Tier::level_to_string(static_cast<Tier::Level>(level)), num_levels[level]);
+    }
+    print("\n");
+
+    // The hottest entries first
+    std::sort(entries.begin(), entries.end(),
+              [](const Entry &a, const Entry &b) { return a.index.hits > b.index.hits; });
+    const size_t num_shown = std::min<size_t>(entries.size(), 10);
+    if (num_shown > 0) {
+        print("\n{:>8}  {:<9}  {:>8}  {:>8}  {}\n", "HITS", "TIER", "KiB", "COST ms", "NAME");
+    }
+    for (size_t i = 0; i < num_shown; i++) {
+        const Entry &entry = entries[i];
+        print("{:>8}  {:<9}  {:>8}  {:>8}  {}\n", entry.index.hits, Tier::level_to_string(entry.level),
+              (entry.index.size + 1023) / 1024, entry.index.cost_ms, entry.index.name);
+    }
+    return 0;
+}
+
 bool RCC::remove_file(Path &p) noexcept {
     try {
         // *Note: remove() does not throw if the file does not exist. It returns false in that case.
@@ -304,6 +499,13 @@ int RCC::remove_permanents(const Settings &settings) {
         success |= remove_file(bin_path);
         success |= remove_file(desc_path);
 
+        // The lock of the entry, unless a compilation of the same name holds it, see RCCode::lock_entry()
+        Path lock_path = bin_path;
+        lock_path.replace_extension(".lock");
+        if (lock_path.exists()) {
+            remove_unused_lock(lock_path);
+        }
+
         if (success) {
             ++num_removed;
             gpdebug("Removed '{}'\n", permanent);
@@ -322,11 +524,14 @@ RCC::AutoWrapResult RCC::gen_auto_wrap_code(const Settings &settings) {
     auto &codes = settings.get_codes();
 
     if (codes.empty()) {
-        return {false, {}}; // No code to wrap
+        return {false, {}, SnippetClassifier::STATEMENT}; // No code to wrap
     }
 
     auto &last_code = codes.back();
-    if (last_code.length() > 0 && last_code.back() != ';' && last_code.back() != '}') {
+    const auto kind = SnippetClassifier::classify(last_code);
+    gpdebug("LAST SNIPPET: {}\n", SnippetClassifier::kind_to_string(kind));
+
+    if (kind != SnippetClassifier::STATEMENT) {
         std::string code;
 
         for (size_t i = 0; i < codes.size() - 1; i++) {
@@ -334,10 +539,82 @@ RCC::AutoWrapResult RCC::gen_auto_wrap_code(const Settings &settings) {
         }
         code.append("cout << (" + last_code + ") << endl;");
 
-        return {true, code};
+        return {true, code, kind};
+    }
+
+    return {false, {}, kind}; // No need to wrap
+}
+
+bool RCC::gen_bundle_code(const Settings &settings,
+                          bool auto_wrap,
+                          std::string &code,
+                          std::vector<std::string> &functions) {
+    // The snippets given as code arguments are known by their indexes only
+    std::vector<std::pair<std::string, std::string>> snippets;
+    for (const auto &snippet : settings.get_codes()) {
+        snippets.push_back({"", snippet});
+    }
+    const auto &named_snippets = settings.get_named_snippets();
+    snippets.insert(snippets.end(), named_snippets.begin(), named_snippets.end());
+
+    functions = settings.get_functions();
+
+    //* Each snippet gets argc and argv of its own, argv[0] is the snippet selector, so that argv[1] is the first
+    //* argument of the snippet as if it was compiled alone.
+    bool wrapped = false;
+    std::string names, fns;
+    for (size_t i = 0; i < snippets.size(); i++) {
+        std::string body = snippets[i].second;
+        const auto kind = SnippetClassifier::classify(body);
+        if (kind == SnippetClassifier::EXPRESSION || (auto_wrap && kind == SnippetClassifier::UNSURE)) {
+            body = "cout << (" + body + ") << endl;";
+            wrapped = wrapped || kind == SnippetClassifier::UNSURE;
+        }
+        const std::string fn = "rcc_snippet_" + std::to_string(i);
+        functions.push_back("static int " + fn + "(int argc, char **argv) {\n    " + body + "\n    return 0;\n}");
+        names += "\"" + snippets[i].first + "\", ";
+        fns += fn + ", ";
+    }
+
+    code = "static const char *const rcc_snippet_names[] = {" + names + "};\n"
+           "    static int (*const rcc_snippets[])(int, char **) = {" + fns + "};\n"
+           "    const int rcc_num_snippets = " + std::to_string(snippets.size()) + ";\n"
+           "    int rcc_index = -1;\n"
+           "    if (argc >= 2) {\n"
+           "        for (int i = 0; i < rcc_num_snippets; i++) {\n"
+           "            if ((rcc_snippet_names[i][0] && strcmp(argv[1], rcc_snippet_names[i]) == 0) || to_string(i) == argv[1]) {\n"
+           "                rcc_index = i;\n"
+           "                break;\n"
+           "            }\n"
+           "        }\n"
+           "    }\n"
+           "    if (rcc_index < 0) {\n"
+           "        cerr << \"Usage: \" << argv[0] << \" INDEX|NAME [ARGS...], \" << rcc_num_snippets\n"
+           "             << \" snippets\" << endl;\n"
+           "        return 2;\n"
+           "    }\n"
+           "    return rcc_snippets[rcc_index](argc - 1, argv + 1);";
+    return wrapped;
+}
+
+RCCode *RCC::compile_in_parallel(RCCode &code_auto_wrap, RCCode &code_original) {
+    //? Why not just compile the auto-wrapped code first and then the original code?
+    //* For statement snippets the auto-wrapped code always fails, so compiling one after another doubles the
+    //* latency of every cache miss. Both compilations run at the same time instead.
+    const bool auto_wrap_started = code_auto_wrap.start_compile(true);
+    const bool original_started = code_original.start_compile(false);
+
+    //* The auto-wrapped code takes precedence, so the winner is known as soon as it finishes.
+    if (auto_wrap_started ? code_auto_wrap.wait_compile() : code_auto_wrap.compile(true)) {
+        code_original.cancel_compile();
+        return &code_auto_wrap;
+    }
+
+    if (original_started ? code_original.wait_compile() : code_original.compile(false)) {
+        return &code_original;
     }
 
-    return {false, {}}; // No need to wrap
+    return nullptr; // Both compilation failed
 }
 
 RCC::TryCodeResult RCC::try_code_permanent(const Settings &settings) {
@@ -364,10 +641,41 @@ RCC::TryCodeResult RCC::try_code_permanent(const Settings &settings) {
     // the identifier
     const std::string identifier = gen_second_hash_identifier(settings);
 
-    // original code
-    RCCodePermanent code_original(settings, paths, identifier, *cs, code, "original");
+    // A bundle has snippet functions and a dispatcher as the code
+    std::string bundle_code, bundle_auto_wrap_code;
+    std::vector<std::string> bundle_functions, bundle_auto_wrap_functions;
+    bool bundle_wrapped = false;
+    if (settings.get_flag_bundle()) {
+        gen_bundle_code(settings, false, bundle_code, bundle_functions);
+        bundle_wrapped = gen_bundle_code(settings, true, bundle_auto_wrap_code, bundle_auto_wrap_functions);
+    }
+
+    const auto auto_warp = settings.get_flag_bundle()
+                               ? AutoWrapResult{bundle_wrapped, bundle_auto_wrap_code,
+                                                bundle_wrapped ? SnippetClassifier::UNSURE : SnippetClassifier::STATEMENT}
+                               : gen_auto_wrap_code(settings);
+
+    // original code, an expression is compiled auto-wrapped first
+    const bool expression = auto_warp.kind == SnippetClassifier::EXPRESSION;
+    RCCodePermanent code_original(settings, paths, identifier, *cs,
+                                  settings.get_flag_bundle() ? bundle_code : (expression ? auto_warp.code : code),
+                                  expression ? "auto-wrapped" : "original");
+    if (settings.get_flag_bundle()) {
+        code_original.set_functions(bundle_functions);
+    }
     code_original.init_cpp_bin_paths();
 
+    // Don't let two processes create the same permanent at the same time
+    FileLock lock;
+    code_original.lock_entry(lock);
+
+    // the objects of the additional sources
+    ObjectCache objects(settings, *cs);
+    if (!objects.build()) {
+        return {TryCodeResult::COMPILE_FAILED, 1};
+    }
+    code_original.set_objects(objects.get_objects());
+
     /*------------------------------------------------------------------------*/
     // * Compile Anyway
 
@@ -375,19 +683,38 @@ RCC::TryCodeResult RCC::try_code_permanent(const Settings &settings) {
 
     // TODO: confirm overwrite, add option -f, --force
 
-    // Try to compile the auto-wrapped code first
-    const auto auto_warp = gen_auto_wrap_code(settings);
-    if (auto_warp.tried) {
-        RCCodePermanent code_auto_wrap(settings, paths, identifier, *cs, auto_warp.code, "auto-wrapped");
+    if (auto_warp.kind == SnippetClassifier::UNSURE) {
+        //* Both variants are compiled at the same time, so they can't share the permanent paths. The auto-wrapped
+        //* code is compiled in the cache directory and moved to the permanent paths if it wins.
+        RCCode code_auto_wrap(settings, paths, identifier, *cs, auto_warp.code, "auto-wrapped");
+        if (settings.get_flag_bundle()) {
+            code_auto_wrap.set_functions(bundle_auto_wrap_functions);
+        }
+        code_auto_wrap.set_objects(objects.get_objects());
         code_auto_wrap.init_cpp_bin_paths();
 
-        if (code_auto_wrap.compile(true)) {
+        RCCode *winner = compile_in_parallel(code_auto_wrap, code_original);
+        if (winner == &code_auto_wrap) {
+            compile_success = code_auto_wrap.move_to(code_original);
+        } else {
+            compile_success = winner != nullptr;
+        }
+    } else if (expression) {
+        //* The original code is compiled if the auto-wrapped one fails, see try_code_normal(). It's compiled in the
+        //* cache directory, so that the errors of the auto-wrapped code point to its source if both fail.
+        if (code_original.compile(true)) {
             compile_success = true;
+        } else {
+            RCCode code_fallback(settings, paths, identifier, *cs, code, "original");
+            code_fallback.set_objects(objects.get_objects());
+            code_fallback.init_cpp_bin_paths();
+            if (code_fallback.compile(true)) {
+                compile_success = code_fallback.move_to(code_original);
+            } else {
+                code_original.replay_failure();
+            }
         }
-    }
-
-    // If the auto-wrapped code failed to compile, try the original code
-    if (!compile_success && code_original.compile(false)) {
+    } else if (code_original.compile(false)) {
         compile_success = true;
     }
 
@@ -398,8 +725,13 @@ RCC::TryCodeResult RCC::try_code_permanent(const Settings &settings) {
     // If compilation succeeded, we need to update the description
     // * This means if the compilation failed, we do NOT update the description
     if (!desc_written) {
-        desc_path.write_file(settings.get_permanent_desc().empty() ? DEFAULT_PERMANENT_DESC
-                                                                   : settings.get_permanent_desc());
+        std::string desc = settings.get_permanent_desc();
+        if (desc.empty()) {
+            desc = settings.get_flag_bundle() ? fmt::format("Bundle of {} snippets", settings.get_codes().size() +
+                                                                                       settings.get_named_snippets().size())
+                                              : DEFAULT_PERMANENT_DESC;
+        }
+        desc_path.write_file(desc);
     }
 
     // Just compile the code, don't run it
@@ -418,41 +750,114 @@ RCC::TryCodeResult RCC::try_code_normal(const Settings &settings) {
     // the identifier
     const std::string identifier = gen_second_hash_identifier(settings);
 
+    // The objects of the additional sources are a part of the cache key, their sources are read but not compiled yet
+    ObjectCache objects(settings, *cs);
+    if (!objects.scan()) {
+        return {TryCodeResult::COMPILE_FAILED, 1};
+    }
+
     // the original code
     RCCode code_original(settings, paths, identifier, *cs, code, "original");
+    code_original.set_objects(objects.get_objects(), objects.has_changed());
     code_original.init_cpp_bin_paths();
 
     // Check if the original code is cached. If so, just run it
     if (code_original.is_cached()) {
         gpdebug(green_bold, "Running cached binary ({})\n", "original");
+        code_original.count_hit();
         return {TryCodeResult::SUCCESS, code_original.run_bin()};
     }
 
-    // Try to auto-wrap the code and try to compile it
+    // Try to auto-wrap the code
     const auto auto_warp = gen_auto_wrap_code(settings);
+    RCCode code_auto_wrap(settings, paths, identifier, *cs, auto_warp.code, "auto-wrapped");
     if (auto_warp.tried) {
-        RCCode code_auto_wrap(settings, paths, identifier, *cs, auto_warp.code, "auto-wrapped");
+        code_auto_wrap.set_objects(objects.get_objects(), objects.has_changed());
         code_auto_wrap.init_cpp_bin_paths();
 
         // If the auto-wrapped code is cached, just run it
         if (code_auto_wrap.is_cached()) {
             gpdebug(green_bold, "Running cached binary ({})\n", "auto-wrapped");
+            code_auto_wrap.count_hit();
             return {TryCodeResult::SUCCESS, code_auto_wrap.run_bin()};
         }
+    }
 
-        // If the auto-wrapped code compiles successfully, run it
-        if (code_auto_wrap.compile(true)) {
+    //* Only one process compiles the code, the others wait for it and run the binary it publishes. The lock of the
+    //* original code covers the auto-wrapped code as well. Without the lock, the compilation goes on anyway, the
+    //* binaries are published atomically.
+    FileLock lock;
+    if (code_original.lock_entry(lock)) {
+        // Another process may have compiled it while we were waiting
+        if (code_original.is_cached()) {
+            lock.unlock();
+            gpdebug(green_bold, "Running cached binary ({})\n", "original");
+            code_original.count_hit();
+            return {TryCodeResult::SUCCESS, code_original.run_bin()};
+        }
+        if (auto_warp.tried && code_auto_wrap.is_cached()) {
+            lock.unlock();
+            gpdebug(green_bold, "Running cached binary ({})\n", "auto-wrapped");
+            code_auto_wrap.count_hit();
             return {TryCodeResult::SUCCESS, code_auto_wrap.run_bin()};
         }
     }
 
-    // Compile and run the original code
-    if (code_original.compile(false)) {
-        return {TryCodeResult::SUCCESS, code_original.run_bin()};
+    // Skip the variants which are known to fail, replay the errors if nothing is left to compile
+    auto kind = auto_warp.kind;
+    code_original.use_failure_cache();
+    code_auto_wrap.use_failure_cache();
+    const bool auto_wrap_fails = auto_warp.tried && code_auto_wrap.is_known_failure();
+    if (kind == SnippetClassifier::UNSURE && auto_wrap_fails) {
+        kind = SnippetClassifier::STATEMENT;
+    }
+    const bool original_fails = code_original.is_known_failure();
+    if ((kind == SnippetClassifier::STATEMENT && original_fails) ||
+        (kind == SnippetClassifier::EXPRESSION && auto_wrap_fails && original_fails)) {
+        lock.unlock();
+        (kind == SnippetClassifier::EXPRESSION ? code_auto_wrap : code_original).replay_failure();
+        return {TryCodeResult::COMPILE_FAILED, 1};
+    }
+
+    // The variants link the same objects of the additional sources
+    if (!objects.build()) {
+        return {TryCodeResult::COMPILE_FAILED, 1};
+    }
+
+    RCCode *winner = nullptr;
+    if (kind == SnippetClassifier::UNSURE) {
+        // Compile both variants at the same time and run the winner
+        winner = compile_in_parallel(code_auto_wrap, code_original);
+    } else if (kind == SnippetClassifier::STATEMENT) {
+        // Compile and run the only variant, a statement can't compile auto-wrapped
+        if (code_original.compile(false)) {
+            winner = &code_original;
+        }
+    } else {
+        //* The classifier doesn't see the macros, e.g. `say(7)` is a statement with `#define say(x) cout << x;`.
+        //* The original code is compiled if the auto-wrapped one fails, the errors of the latter are shown if both do.
+        if (!auto_wrap_fails && code_auto_wrap.compile(true)) {
+            winner = &code_auto_wrap;
+        } else if (!original_fails && code_original.compile(true)) {
+            winner = &code_original;
+        } else {
+            code_auto_wrap.replay_failure();
+        }
     }
 
-    // Both the auto-wrapped code and the original code failed to compile
-    return {TryCodeResult::COMPILE_FAILED, 1};
+    // Let the waiting processes go before running, the program may run for a long time
+    lock.unlock();
+
+    if (winner == nullptr) {
+        // The code failed to compile
+        return {TryCodeResult::COMPILE_FAILED, 1};
+    }
+
+    // A new baseline entry, it counts hits from now on
+    winner->add_to_index();
+    Tier::set_level(winner->get_bin_path(), Tier::BASELINE);
+
+    return {TryCodeResult::SUCCESS, winner->run_bin()};
 }
 
 RCC::TryCodeResult RCC::try_code(const Settings &settings) {
@@ -485,11 +890,32 @@ RCC::TryCodeResult RCC::try_code(const Settings &settings) {
 // The main function of rcc.
 // Convenient for testing.
 int RCC::rcc_main(const Settings &settings) {
+    // If --print-cache-dir is set, print where the cache is, e.g. for the scripts which look into it
+    if (settings.get_flag_print_cache_dir()) {
+        print("{}\n", Paths::get_instance().get_cache_dir().string());
+        return 0;
+    }
+
     // Clean old cached files
     if (settings.get_clean_cache_flag()) { // clean cache manually
         clean_cache();
-    } else { // clean cache automatically, but not too often
-        random_clean_cache();
+    } else { // remove the old and the least valuable entries, a step at a time
+        Trace::Span span("cache gc");
+        CacheGC::collect(settings.get_cache_budget());
+    }
+
+    // If --batch is set, compile and run the snippets in the file
+    if (!settings.get_batch_file().empty()) {
+        if (settings.has_code()) {
+            gperror("No code can be given together with --batch.\n");
+            return 1;
+        }
+        return Batch::run(settings);
+    }
+
+    // If --stats is set, show the cache statistics
+    if (settings.get_flag_stats()) {
+        return print_stats();
     }
 
     // If --list-permanent is set, list all permanent programs
@@ -529,6 +955,8 @@ int RCC::rcc_main(const Settings &settings) {
 // Signal handler for SIGINT (Control-C) to exit the program gracefully.
 static void signal_handler(int s) {
     (void)s;
+    // Don't leave the background compilations running
+    rcc::kill_all_processes();
     std::cout << "Control-C detected, exiting..." << std::endl;
     std::exit(1);
 }
@@ -543,9 +971,9 @@ static void register_signal_handler() {
     sigaction(SIGINT, &sigIntHandler, nullptr);
 }
 
-int main(int argc, char **argv) {
-    using namespace rcc;
+namespace rcc {
 
+int rcc_entry(int argc, char **argv) {
     const auto time_begin = now();
 
     // Handle signals gracefully
@@ -557,13 +985,21 @@ int main(int argc, char **argv) {
     //* times, and get the same seed.
     srand((unsigned int)time(NULL) + (unsigned int)getpid());
 
+    Trace::start();
+
     // Parse arguments and set up settings
     Settings settings;
     int result;
-    if ((result = settings.parse_argv(argc, argv)) != 0) {
+    {
+        Trace::Span span("parse argv");
+        result = settings.parse_argv(argc, argv);
+    }
+    Trace::set_output(settings.get_trace_file());
+    if (result != 0) {
         const double duration_in_ms = duration_ms(time_begin);
         gpdebug("{}: {:.2f} ms\n", styled("OVERALL TIME", fg(terminal_color::yellow) | emphasis::bold),
                 colored_duration(20, 100, duration_in_ms));
+        Trace::finish();
         return result;
     }
 
@@ -573,5 +1009,25 @@ int main(int argc, char **argv) {
     gpdebug("{}: {:.2f} ms\n", styled("OVERALL TIME", fg(terminal_color::yellow) | emphasis::bold),
             colored_duration(80, 600, duration_in_ms));
 
+    Trace::finish();
     return exit_status;
 }
+
+} // namespace rcc
+
+int main(int argc, char **argv) {
+    using namespace rcc;
+
+    // Run as the daemon if invoked as `rccd`
+    if (Daemon::is_daemon_name(argv[0])) {
+        return Daemon::serve(argc, argv);
+    }
+
+    // Let the daemon serve the request if it's running, otherwise fall back to the in-process path
+    int exit_status;
+    if (Daemon::forward(argc, argv, exit_status)) {
+        return exit_status;
+    }
+
+    return rcc_entry(argc, argv);
+}
@@ -1,13 +1,18 @@
 #ifndef __RCC_H__
 #define __RCC_H__
 
+#include "classifier.h"
 #include "compiler_support.h"
+#include "launcher.h"
 #include "path.h"
 #include "settings.h"
 #include <string>
+#include <vector>
 
 namespace rcc {
 
+class RCCode;
+
 class RCC {
   public:
     // The main function of rcc.
@@ -17,26 +22,65 @@ class RCC {
     // Generate the execution command with the binary path and command line arguments.
     static std::string gen_exec_cmd(const Settings &settings, const Path &bin_path);
 
+    // Generate the argument vector to execute the binary with the command line arguments.
+    static std::vector<std::string> gen_exec_argv(const Settings &settings, const Path &bin_path);
+
+    // What a daemon worker needs to let the client run the binary, see defer_run_bin().
+    struct DeferredRun {
+        std::vector<std::string> exec_argv;
+        // The same command line runs the same binary as long as the key files don't change, unless the binary depends
+        // on local files, see is_hermetic() and get_key_files()
+        bool memoizable{false};
+        std::vector<std::string> key_files;
+    };
+
+    // Instead of running the binaries, only record what executes it in `run`.
+    // This is used by the daemon, so that the client can execute the binary itself. Pass nullptr to disable.
+    static void defer_run_bin(DeferredRun *run) { deferred_run = run; }
+
     // Run the binary executable, return the exit status of the executable, or 1 on error.
     static int run_bin(const Settings &settings, const Path &cpp_path, const Path &bin_path);
 
-    // Compile the file.
-    // Silent mode: no output of compiler errors, and no output after the compilation failed.
-    static bool compile_file(const Settings &settings,
-                             const Path &cpp_path,
-                             const Path &bin_path,
-                             compiler_support &cs,
-                             bool silent);
-
-    // Generate hash for the output filename.
-    static std::string gen_first_hash_filename(const Settings &settings, const std::string &code);
+    // Convert the status returned by Command::run() to an exit status, report the signal if the program was killed.
+    static int to_exit_status(int status);
+
+    // Generate the command to compile the file and link it with the objects of the additional sources, importing the
+    // header unit instead of the PCH if `header_units` is true.
+    static Command gen_compile_cmd(const Path &cpp_path,
+                                   const Path &bin_path,
+                                   const std::vector<Path> &objects,
+                                   compiler_support &cs,
+                                   bool header_units);
+
+    // Print the source file and the commands after the compilation failed.
+    static void report_compile_failure(const Settings &settings,
+                                       const Path &cpp_path,
+                                       const Path &bin_path,
+                                       const std::string &compile_cmd);
+
+    // Generate hash for the output filename from the code, the functions and the settings, the fingerprint of the
+    // template and the objects of the additional sources, which are named by their content, see ObjectCache. The full
+    // code is not needed, so that a cache hit does not expand the template.
+    static std::string gen_first_hash_filename(const Settings &settings,
+                                               const std::string &code,
+                                               const std::vector<std::string> &functions,
+                                               const std::vector<Path> &objects);
 
     // Generate hash for the identifier.
     static std::string gen_second_hash_identifier(const Settings &settings);
 
+    // Check if the code depends on nothing but itself and the toolchain, so that its compile result never changes
+    // unless the toolchain does. A local header, a helper source, a search path or a library may be fixed or installed
+    // later.
+    static bool is_hermetic(const Settings &settings);
+
+    // Get the files besides the command line which the cache key of a hermetic code depends on, see
+    // gen_first_hash_filename().
+    static std::vector<std::string> get_key_files(const Settings &settings);
+
   private:
-    // Delete old cached files with probability of 1/256.
-    pid_t random_clean_cache();
+    // See defer_run_bin().
+    static DeferredRun *deferred_run;
 
     // Clean up all cached sources and binaries.
     int clean_cache();
@@ -47,6 +91,9 @@ class RCC {
     // Run a permanent executable, return the return code of the executable or 1 if the executable does not exist.
     int run_permanent(const Settings &settings, const std::string &name);
 
+    // Show the cache entries, their hits and tiers, return 1 on error.
+    int print_stats();
+
     // List all permanent executables, return 1 on error.
     int list_permanents(const Settings &settings);
 
@@ -59,13 +106,23 @@ class RCC {
     struct AutoWrapResult {
         bool tried;
         std::string code;
+        // The auto-wrapped code is compiled first if it's EXPRESSION, both variants at once if it's UNSURE
+        SnippetClassifier::Kind kind;
     };
 
-    // If the last code snippet doesn't end with ';' or '}', then, wrap it in
-    // 'cout << ... << endl;' and try to compile and run it.
-    // This is for convenience, e.g. rcc '2+3*5'.
+    // If the last code snippet is an expression, then, wrap it in 'cout << ... << endl;' and compile and run it.
+    // This is for convenience, e.g. rcc '2+3*5'. See SnippetClassifier.
     AutoWrapResult gen_auto_wrap_code(const Settings &settings);
 
+    // Generate the code of a bundle, see `rcc bundle`. Every snippet goes into its own function, and the code of main()
+    // calls one of them by the index or the name given in argv[1]. The expression snippets are auto-wrapped, so are
+    // the UNSURE ones if `auto_wrap` is true. Return true if any UNSURE snippet is auto-wrapped, i.e. the bundles
+    // with and without `auto_wrap` differ.
+    bool gen_bundle_code(const Settings &settings,
+                         bool auto_wrap,
+                         std::string &code,
+                         std::vector<std::string> &functions);
+
     struct TryCodeResult {
         enum TryStatus { SUCCESS, COMPILE_FAILED, ERROR };
 
@@ -73,6 +130,11 @@ class RCC {
         int exit_status;
     };
 
+    // Compile the auto-wrapped code and the original code at the same time as separate compiler processes.
+    // The auto-wrapped code wins if both succeed, and the loser is killed as soon as the winner is known.
+    // Return the winner, or nullptr if both failed.
+    RCCode *compile_in_parallel(RCCode &code_auto_wrap, RCCode &code_original);
+
     // Try to compile and run code for permanent.
     TryCodeResult try_code_permanent(const Settings &settings);
 
@@ -83,6 +145,10 @@ class RCC {
     TryCodeResult try_code(const Settings &settings);
 };
 
+// Parse the command line and run rcc, this is the body of main().
+// It is also used by the daemon to serve a request.
+int rcc_entry(int argc, char **argv);
+
 } // namespace rcc
 
 #endif // __RCC_H__
@@ -61,7 +61,7 @@ void Settings::add_options_and_flags(CLI::App &app) {
             additional_flags.push_back("-L" + paths.get_sub_libs_dir().string());
             additional_flags.push_back("-lfmt");
         },
-        "Include the `fmt` library, which will increase compile time a lot");
+        "Include the `fmt` library, which increases the compile time until its headers are precompiled");
 
     //? Rename --include-all to --include-universal or --include-bits?
     app.add_flag_callback(
@@ -98,6 +98,57 @@ void Settings::add_options_and_flags(CLI::App &app) {
     app.add_flag_callback("--g++", [&]() { compiler = "g++"; }, "Use g++ as compiler");
 
     app.add_flag_callback("--clang++", [&]() { compiler = "clang++"; }, "Use clang++ as compiler")->excludes("--g++");
+
+    app.add_option("--linker", linker,
+                   "Linker to use, `auto` picks the fastest available one, `default` uses the compiler's default")
+        ->check(CLI::IsMember({"auto", "default", "mold", "lld", "gold", "bfd"}));
+
+    app.add_option("--batch", batch_file,
+                   "Compile and run the snippets in a file, one per line, either code or a JSON record like "
+                   "{\"code\": ..., \"includes\": [...], \"flags\": [...], \"args\": [...]}")
+        ->check(CLI::ExistingFile)
+        ->option_text("FILE");
+
+    app.add_option("-j,--jobs", jobs, "Number of concurrent compilations in batch mode, default to the number of CPUs")
+        ->check(CLI::PositiveNumber)
+        ->needs("--batch")
+        ->option_text("N");
+
+    app.add_option("--tier-threshold", tier_threshold,
+                   "Recompile a cached snippet with -O2 in the background after it ran N times, 0 to disable")
+        ->capture_default_str()
+        ->check(CLI::NonNegativeNumber)
+        ->option_text("N");
+
+    app.add_option("--pch-threshold", pch_threshold,
+                   "Build a PCH for flags the default PCH can't be used with after N compilations, 0 to disable")
+        ->capture_default_str()
+        ->check(CLI::NonNegativeNumber)
+        ->option_text("N");
+
+    app.add_flag("--stats", flag_stats, "Show the cache statistics and exit");
+
+    app.add_flag("--print-cache-dir", flag_print_cache_dir, "Print the cache directory and exit");
+
+    app.add_option("--cache-budget", cache_budget,
+                   "Size of the cache, e.g. 512M, the least valuable snippets are removed beyond it, 0 for no limit")
+        ->envname("RCC_CACHE_BUDGET")
+        ->transform(CLI::AsSizeValue(false))
+        ->option_text("SIZE");
+
+    app.add_flag("--paranoid", flag_paranoid,
+                 "Compare the cached source with the code byte-for-byte before running a cached binary");
+
+    app.add_flag("--modules", flag_modules,
+                 "Import the headers of the template as C++20 header units instead of the PCH, with -std=c++20 or "
+                 "later, where they compile faster")
+        ->envname("RCC_MODULES");
+
+    app.add_option("--trace", trace_file,
+                   "Append where the time goes, e.g. the cache lookup, the compile and the run, to a trace file in the "
+                   "Chrome trace format, for Perfetto or chrome://tracing")
+        ->envname("RCC_TRACE")
+        ->option_text("FILE");
 }
 
 void Settings::add_permanent_options(CLI::App &app) {
@@ -136,6 +187,38 @@ void Settings::add_permanent_subcommands(CLI::App &app) {
     create->add_option("NAME", permanent, "Name of the permanent code to create")->required();
     create->add_option("--desc", permanent_desc, "Description for the permanent code");
 
+    // Add bundle subcommand
+    CLI::App *bundle =
+        app.add_subcommand("bundle",
+                           "Create a permanent code from many snippets compiled together, each code argument is a "
+                           "snippet. Run one of them by index or name with `rcc run NAME -- SNIPPET [ARGS...]`")
+            ->parse_complete_callback([&]() { flag_bundle = true; })
+            ->allow_extras(false)
+            ->fallthrough(true);
+
+    bundle->add_option("NAME", permanent, "Name of the bundle to create")->required();
+    bundle->add_option("--desc", permanent_desc, "Description for the bundle");
+    bundle
+        ->add_option_function<std::string>(
+            "--snippet",
+            [&](const std::string &snippet) {
+                // NAME=CODE, the name has to be an identifier
+                const size_t eq = snippet.find('=');
+                const std::string name = snippet.substr(0, eq);
+                bool valid = eq != std::string::npos && !name.empty() && !std::isdigit((unsigned char)name[0]);
+                for (char c : name) {
+                    valid = valid && (std::isalnum((unsigned char)c) || c == '_');
+                }
+                if (!valid) {
+                    throw CLI::ValidationError("--snippet", "expected NAME=CODE with an identifier as NAME");
+                }
+                named_snippets.push_back({name, snippet.substr(eq + 1)});
+            },
+            "A named snippet of the bundle")
+        ->multi_option_policy(CLI::MultiOptionPolicy::TakeAll)
+        ->trigger_on_parse()
+        ->option_text("NAME=CODE");
+
     // Add run subcommand
     CLI::App *run = app.add_subcommand("run", "Run a permanent code, same as --run-permanent")
                         ->allow_extras(false)
@@ -157,6 +240,14 @@ void Settings::add_permanent_subcommands(CLI::App &app) {
 
     add_debug_flags(*list);
 
+    // Add stats subcommand
+    CLI::App *stats = app.add_subcommand("stats", "Show the cache statistics and exit, same as --stats")
+                          ->parse_complete_callback([&]() { flag_stats = true; })
+                          ->allow_extras(false)
+                          ->fallthrough(false);
+
+    add_debug_flags(*stats);
+
     // Add remove subcommand
     CLI::App *remove = app.add_subcommand("remove", "Remove permanent(s) and exit, same as --remove-permanent")
                            ->allow_extras(false)
@@ -248,6 +339,24 @@ int Settings::parse_argv(int argc, char **argv) {
     return 0;
 }
 
+std::vector<std::string> Settings::get_std_cxxflags() const {
+    std::vector<std::string> flags = {std};
+    flags.insert(flags.end(), cxxflags.begin(), cxxflags.end());
+    return flags;
+}
+
+bool Settings::is_unoptimized() const {
+    std::string level = "-O0";
+    for (const auto *flags : {&cxxflags, &additional_flags}) {
+        for (const auto &flag : *flags) {
+            if (starts_with(flag, "-O")) {
+                level = flag;
+            }
+        }
+    }
+    return level == "-O0";
+}
+
 std::string Settings::get_std_cxxflags_as_string() const {
     //? Should use a C++ standard like "-std=c++11"?
     //* This will be necessary on some lower version compilers. But this will
@@ -278,6 +387,10 @@ void Settings::debug_print() const {
 
     gpmsgdump("Settings:\n");
     gpmsgdump_c("compiler: {}\n", compiler);
+    gpmsgdump_c("linker: {}\n", linker);
+    gpmsgdump_c("tier_threshold: {}\n", tier_threshold);
+    gpmsgdump_c("pch_threshold: {}\n", pch_threshold);
+    gpmsgdump_c("batch_file: {}\n", batch_file.empty() ? "<NONE>" : batch_file);
     gpmsgdump_c("std: {}\n", std);
     gpmsgdump_c("cxxflags: {}\n", cxxflags.empty() ? "<NONE>" : cxxflags);
     gpmsgdump_c("additional_flags: {}\n", additional_flags.empty() ? "<NONE>" : additional_flags);
@@ -288,6 +401,11 @@ void Settings::debug_print() const {
     gpmsgdump_c("additional_sources: {}\n", vector_to_string(additional_sources, ", ", "<NONE>"));
     gpmsgdump_c("user_args_count: {}\n", user_args.size());
     gpmsgdump_c("clean_cache: {}\n", flag_clean_cache);
+    gpmsgdump_c("cache_budget: {}\n", cache_budget);
+    gpmsgdump_c("print_cache_dir: {}\n", flag_print_cache_dir);
+    gpmsgdump_c("paranoid: {}\n", flag_paranoid);
+    gpmsgdump_c("modules: {}\n", flag_modules);
+    gpmsgdump_c("trace_file: {}\n", trace_file);
 
     // TODO: print more settings
 }
@@ -1,7 +1,9 @@
 #ifndef __RCC_SETTINGS_H__
 #define __RCC_SETTINGS_H__
 
+#include "cache_gc.h"
 #include "libs/CLI11.hpp"
+#include "pch_variants.h"
 #include "utils.h"
 #include <string>
 #include <vector>
@@ -11,11 +13,21 @@
     #define RCC_CXX "g++"
 #endif
 
+#ifndef RCC_LINKER
+    // Use this linker to link the code, "auto" picks the fastest one available.
+    #define RCC_LINKER "auto"
+#endif
+
 #ifndef RCC_CXXSTD
     // Use this standard to compile the code, at least c++11.
     #define RCC_CXXSTD "c++17"
 #endif
 
+#ifndef RCC_TIER_THRESHOLD
+    // Promote a cache entry to an optimized build after this many hits, 0 disables the promotion, see Tier.
+    #define RCC_TIER_THRESHOLD 16
+#endif
+
 namespace rcc {
 
 class Settings {
@@ -25,6 +37,7 @@ class Settings {
 
     const std::string &get_compiler() const { return compiler; }
     const std::string &get_std() const { return std; }
+    const std::string &get_linker() const { return linker; }
     bool get_clean_cache_flag() const { return flag_clean_cache; }
     const std::vector<std::string> &get_additional_flags() const { return additional_flags; }
     const std::vector<std::string> &get_additional_includes() const { return additional_includes; }
@@ -40,7 +53,20 @@ class Settings {
     bool get_flag_list_permanent() const { return flag_list_permanent; }
     const std::vector<std::string> &get_remove_permanent() const { return remove_permanent; }
     bool get_flag_fetch_autocompletion_zsh() const { return flag_fetch_autocompletion_zsh; }
-
+    bool get_flag_bundle() const { return flag_bundle; }
+    const std::vector<std::pair<std::string, std::string>> &get_named_snippets() const { return named_snippets; }
+    const std::string &get_batch_file() const { return batch_file; }
+    int get_jobs() const { return jobs; }
+    int get_tier_threshold() const { return tier_threshold; }
+    int get_pch_threshold() const { return pch_threshold; }
+    bool get_flag_stats() const { return flag_stats; }
+    bool get_flag_print_cache_dir() const { return flag_print_cache_dir; }
+    bool get_flag_paranoid() const { return flag_paranoid; }
+    bool get_flag_modules() const { return flag_modules; }
+    uint64_t get_cache_budget() const { return cache_budget; }
+    const std::string &get_trace_file() const { return trace_file; }
+
+    std::vector<std::string> get_std_cxxflags() const;
     std::string get_std_cxxflags_as_string() const;
     std::string get_additional_flags_as_string() const { return vector_to_string(additional_flags); }
     std::string get_cli_args_as_string() const;
@@ -54,7 +80,10 @@ class Settings {
     char **get_argv() const { return argv; }
 
     // Check if at least one code snippet is present.
-    bool has_code() const { return !codes.empty(); }
+    bool has_code() const { return !codes.empty() || !named_snippets.empty(); }
+
+    // Check if the code is built without optimization, i.e. the last -O flag is -O0. See Tier.
+    bool is_unoptimized() const;
 
     // Check if the `bits/stdc++.h` header is included.
     // It is true if the "--include-all" option is used or if the `bits/stdc++.h` header is
@@ -64,10 +93,13 @@ class Settings {
     // Print the settings to standard error for debugging purposes.
     void debug_print() const;
 
-  private:
+    // Get the arguments that are going to pass to the program, anything after "--".
+    const std::vector<std::string> &get_user_args() const { return user_args; }
+
     // Locate the position of the "--" argument in the command line.
     static int locate_args(int argc, char **argv);
 
+  private:
     void add_debug_flags(CLI::App &app);
     void add_options_and_flags(CLI::App &app);
     void add_permanent_options(CLI::App &app);
@@ -80,6 +112,7 @@ class Settings {
 
     std::string compiler{RCC_CXX}; // the compiler to use
     std::string std{RCC_CXXSTD}; // the c++ standard to use, relates to "-std"
+    std::string linker{RCC_LINKER}; // the linker to use, relates to "--linker"
     // The c++ flags to use, default to a set of common flags.
     // ! Should be consistent with the flags to compile the PCH in template/Makefile.
     // * -W* flags have no effect when compiling PCH.
@@ -116,6 +149,22 @@ class Settings {
     std::vector<std::string> remove_permanent;
     bool flag_list_permanent{false};
     bool flag_fetch_autocompletion_zsh{false};
+    bool flag_bundle{false}; // whether the permanent is a bundle of snippets, relates to "bundle"
+    std::vector<std::pair<std::string, std::string>> named_snippets; // the named snippets of a bundle, relates to
+                                                                     // "--snippet"
+
+    std::string batch_file; // the file of snippets to compile and run, relates to "--batch"
+    int jobs{0}; // the number of concurrent compilations in batch mode, 0 means the number of CPUs, relates to "-j"
+
+    int tier_threshold{RCC_TIER_THRESHOLD}; // the hits to promote a cache entry, relates to "--tier-threshold"
+    int pch_threshold{RCC_PCH_VARIANT_THRESHOLD}; // the uses to build a PCH variant, relates to "--pch-threshold"
+    bool flag_stats{false}; // whether to show the cache statistics, relates to "--stats"
+    bool flag_print_cache_dir{false}; // whether to print the cache directory, relates to "--print-cache-dir"
+    uint64_t cache_budget{RCC_CACHE_BUDGET_MIB * 1048576ULL}; // the size of the cache in bytes, relates to
+                                                              // "--cache-budget"
+    bool flag_paranoid{false}; // whether to compare the cached code byte-for-byte on a hit, relates to "--paranoid"
+    bool flag_modules{false}; // whether to import the template headers as header units, relates to "--modules"
+    std::string trace_file; // the file to append the trace of the invocation to, relates to "--trace"
 
     // bool default_compiler_flags{true}; // true means no additional compiler flags are added
 };
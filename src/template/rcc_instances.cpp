@@ -0,0 +1,7 @@
+// The explicit instantiations of RCC_INSTANCES of the template header, built into a shared library by the Makefile.
+// The snippets compiled with RCC_EXTERN_TEMPLATES link it instead of instantiating them again.
+
+#include "rcc_template.hpp"
+
+#define RCC_INSTANCE(...) template class __VA_ARGS__;
+RCC_INSTANCES(RCC_INSTANCE)
@@ -55,6 +55,32 @@
 
 // IWYU pragma: end_keep
 
+// The specializations which the snippets use most, instantiated once in the shared library of rcc_instances.cpp.
+//* rcc defines RCC_EXTERN_TEMPLATES and links the library when the flags are compatible with it, the snippets only
+//* compile their own code then. Should be consistent with the headers above.
+#define RCC_INSTANCES(X)                    \
+    X(std::vector<int>)                     \
+    X(std::vector<long long>)               \
+    X(std::vector<double>)                  \
+    X(std::vector<std::string>)             \
+    X(std::vector<std::vector<int>>)        \
+    X(std::vector<std::pair<int, int>>)     \
+    X(std::map<int, int>)                   \
+    X(std::map<std::string, int>)           \
+    X(std::set<int>)                        \
+    X(std::set<std::string>)
+
+#ifdef RCC_EXTERN_TEMPLATES
+    #define RCC_EXTERN_INSTANCE(...) extern template class __VA_ARGS__;
+RCC_INSTANCES(RCC_EXTERN_INSTANCE)
+    #undef RCC_EXTERN_INSTANCE
+#endif
+
+//* g++ takes the first PCH of the directory it accepts, and rejects one which tested a macro the compilation defines.
+//* Testing it here makes the default PCHs give way to the PCH variant which the compilation defines RCC_PCH_VARIANT for.
+#ifdef RCC_PCH_VARIANT
+#endif
+
 #define FOR(l, r) for (int i = l; i < r; ++i)
 #define FORR(r, l) for (int i = r; i >= l; --i)
 
@@ -0,0 +1,45 @@
+#include "tier.h"
+#include "cache_index.h"
+
+namespace rcc {
+
+static const char *const LEVEL_NAMES[] = {"O0", "promoting", "O2", "failed", "fixed"};
+
+const char *Tier::level_to_string(Level level) {
+    return LEVEL_NAMES[level];
+}
+
+bool Tier::read(const Path &bin_path, Stats &stats) {
+    CacheIndex::Entry entry;
+    if (!CacheIndex::get_instance().lookup(CacheIndex::get_entry_name(bin_path), entry)) {
+        return false;
+    }
+    stats.hits = entry.hits;
+    stats.level = static_cast<Level>(entry.tier);
+    return true;
+}
+
+bool Tier::count_hit(const Path &bin_path, uint64_t threshold, Stats &stats) {
+    CacheIndex &index = CacheIndex::get_instance();
+    const std::string name = CacheIndex::get_entry_name(bin_path);
+
+    uint32_t tier = BASELINE;
+    if (!index.count_hit(name, stats.hits, tier)) {
+        return false;
+    }
+    stats.level = static_cast<Level>(tier);
+
+    //* Only the process which moves the entry from BASELINE to PROMOTING starts the promotion.
+    if (threshold > 0 && stats.level == BASELINE && stats.hits >= threshold &&
+        index.exchange_tier(name, BASELINE, PROMOTING)) {
+        stats.level = PROMOTING;
+        return true;
+    }
+    return false;
+}
+
+bool Tier::set_level(const Path &bin_path, Level level) {
+    return CacheIndex::get_instance().set_tier(CacheIndex::get_entry_name(bin_path), level);
+}
+
+} // namespace rcc
@@ -0,0 +1,46 @@
+#ifndef __RCC_TIER_H__
+#define __RCC_TIER_H__
+
+#include "path.h"
+#include <cstdint>
+#include <string>
+
+namespace rcc {
+
+// Tiered compilation of the cache entries.
+//
+// A cache entry is built with the fast-to-compile flags, i.e. -O0. Every run of a cached binary counts a hit in its
+// slot of the cache index, which holds the tier as well, see CacheIndex. When the hits reach the threshold, the same
+// code is recompiled with -O2 by a detached low-priority process, and the optimized binary replaces the cached one
+// atomically. A binary which is running is not affected, rename() leaves its inode alone.
+class Tier {
+  public:
+    enum Level {
+        BASELINE, // built with -O0, may be promoted
+        PROMOTING, // the optimized build is in progress
+        OPTIMIZED, // built with -O2
+        FAILED, // the optimized build failed, keep the baseline
+        FIXED, // built with the optimization flags of the user, never promoted
+    };
+
+    struct Stats {
+        uint64_t hits{0};
+        Level level{BASELINE};
+    };
+
+    // Read the stats of the cache entry of the binary. Return false if it's not in the index.
+    static bool read(const Path &bin_path, Stats &stats);
+
+    // Count a hit of the cache entry. If a baseline entry reaches `threshold` hits, it's marked as PROMOTING and true
+    // is returned, the caller has to start the promotion then. A `threshold` of 0 never promotes.
+    static bool count_hit(const Path &bin_path, uint64_t threshold, Stats &stats);
+
+    // Set the level of the cache entry, keep the hits. The entry has to be in the index.
+    static bool set_level(const Path &bin_path, Level level);
+
+    static const char *level_to_string(Level level);
+};
+
+} // namespace rcc
+
+#endif // __RCC_TIER_H__
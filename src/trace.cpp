@@ -0,0 +1,123 @@
+#include "trace.h"
+#include "debug_fmt.h"
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+
+namespace rcc {
+
+namespace {
+
+enum class TraceState {
+    DISABLED, // outside of an invocation, or no trace file
+    RECORDING, // the arguments are not parsed yet
+    ENABLED, // written to the trace file
+};
+
+struct TraceEvent {
+    const char *name;
+    Trace::TimePoint begin;
+    Trace::TimePoint end;
+    std::string detail;
+    pid_t tid;
+};
+
+TraceState state = TraceState::DISABLED;
+std::vector<TraceEvent> events;
+std::string output_path;
+Trace::TimePoint start_time;
+
+} // namespace
+
+// Escape a string for a JSON string literal.
+static std::string escape_json(const std::string &str) {
+    std::string escaped;
+    for (const char c : str) {
+        if (c == '"' || c == '\\') {
+            escaped += '\\';
+            escaped += c;
+        } else if (static_cast<unsigned char>(c) < 0x20) {
+            escaped += fmt::format("\\u{:04x}", static_cast<int>(c));
+        } else {
+            escaped += c;
+        }
+    }
+    return escaped;
+}
+
+// The microseconds since the epoch, the time unit of the trace events.
+static double to_us(const Trace::TimePoint &t) {
+    return std::chrono::duration<double, std::micro>(t.time_since_epoch()).count();
+}
+
+void Trace::start() {
+    events.clear();
+    start_time = now();
+    state = TraceState::RECORDING;
+}
+
+void Trace::set_output(const std::string &path) {
+    output_path = path;
+    state = path.empty() ? TraceState::DISABLED : TraceState::ENABLED;
+    if (state == TraceState::DISABLED) {
+        events.clear();
+    }
+}
+
+bool Trace::is_enabled() {
+    return state == TraceState::ENABLED;
+}
+
+void Trace::add(const char *name, TimePoint begin, TimePoint end, const std::string &detail, pid_t tid) {
+    if (state != TraceState::DISABLED) {
+        events.push_back({name, begin, end, detail, tid});
+    }
+}
+
+void Trace::finish() {
+    if (state != TraceState::ENABLED) {
+        state = TraceState::DISABLED;
+        return;
+    }
+    add("rcc", start_time, now());
+    state = TraceState::DISABLED;
+
+    const pid_t pid = getpid();
+    std::string text = fmt::format("{{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":{},\"tid\":{},"
+                                   "\"args\":{{\"name\":\"rcc {}\"}}}},\n",
+                                   pid, pid, pid);
+    for (const auto &e : events) {
+        text += fmt::format("{{\"name\":\"{}\",\"cat\":\"rcc\",\"ph\":\"X\",\"ts\":{:.3f},\"dur\":{:.3f},\"pid\":{},"
+                            "\"tid\":{}",
+                            e.name, to_us(e.begin), to_us(e.end) - to_us(e.begin), pid, e.tid != 0 ? e.tid : pid);
+        if (!e.detail.empty()) {
+            text += fmt::format(",\"args\":{{\"detail\":\"{}\"}}", escape_json(e.detail));
+        }
+        text += "},\n";
+    }
+    events.clear();
+
+    //* The concurrent invocations append to the same file, each one in a single write() under a lock.
+    const int fd = open(output_path.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        gpwarning("Failed to open the trace file {}: {}\n", output_path, strerror(errno));
+        return;
+    }
+    int ret;
+    while ((ret = flock(fd, LOCK_EX)) == -1 && errno == EINTR) {
+    }
+    struct stat st;
+    if (ret == 0 && fstat(fd, &st) == 0 && st.st_size == 0) {
+        text.insert(0, "[\n");
+    }
+    if (write(fd, text.data(), text.size()) != (ssize_t)text.size()) {
+        gpwarning("Failed to write the trace file {}: {}\n", output_path, strerror(errno));
+    }
+    close(fd);
+}
+
+} // namespace rcc
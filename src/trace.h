@@ -0,0 +1,57 @@
+#ifndef __RCC_TRACE_H__
+#define __RCC_TRACE_H__
+
+#include "utils.h"
+#include <string>
+#include <sys/types.h>
+
+namespace rcc {
+
+// A trace of where the time of an rcc invocation goes, in the Chrome trace event format, which Perfetto and
+// chrome://tracing open.
+//
+// The phases of an invocation are recorded as spans in memory, e.g. the argv parsing, the cache lookup, the compile
+// and the run, and appended to the trace file when it's over, so the file grows by a few lines per invocation and
+// collects the traces of many of them. The file is a JSON array which is never closed, both viewers accept that.
+//
+// The spans are recorded before the arguments are parsed, as --trace is not known yet then. Recording stops once they
+// are parsed if no trace file is given, so an invocation without a trace only pays for a few clock reads.
+class Trace {
+  public:
+    using TimePoint = decltype(now());
+
+    // The span of a phase, from its construction to its destruction.
+    class Span {
+      public:
+        explicit Span(const char *name, const std::string &detail = "") : name(name), detail(detail), begin(now()) {}
+        ~Span() { Trace::add(name, begin, now(), detail); }
+
+        Span(const Span &) = delete;
+        Span &operator=(const Span &) = delete;
+
+      private:
+        const char *name;
+        std::string detail;
+        TimePoint begin;
+    };
+
+    // Start the trace of an invocation. The spans recorded by the parent of a forked worker are dropped.
+    static void start();
+
+    // Set the trace file once the arguments are parsed, an empty path stops the recording.
+    static void set_output(const std::string &path);
+
+    // Check if the spans are written to a trace file.
+    static bool is_enabled();
+
+    // Record a span. The spans of a process are on one track, unless `tid` gives them their own one, e.g. the pid of
+    // a compiler running in the background, so that they can overlap.
+    static void add(const char *name, TimePoint begin, TimePoint end, const std::string &detail = "", pid_t tid = 0);
+
+    // Record the span of the whole invocation and append the spans to the trace file.
+    static void finish();
+};
+
+} // namespace rcc
+
+#endif // __RCC_TRACE_H__
@@ -1,6 +1,7 @@
 #include "utils.h"
 #include <algorithm>
 #include <cassert>
+#include <cstring>
 
 namespace rcc {
 
@@ -26,6 +27,177 @@ uint64_t fnv1a_64_hash_string(const std::string &str) {
     return hash;
 }
 
+/*----------------------------------------------------------------------------*/
+// * 128-bit hash
+
+namespace {
+
+const uint64_t PRIME32_1 = 0x9E3779B1U;
+const uint64_t PRIME32_2 = 0x85EBCA77U;
+const uint64_t PRIME32_3 = 0xC2B2AE3DU;
+const uint64_t PRIME64_1 = 0x9E3779B185EBCA87ULL;
+const uint64_t PRIME64_2 = 0xC2B2AE3D27D4EB4FULL;
+const uint64_t PRIME64_3 = 0x165667B19E3779F9ULL;
+const uint64_t PRIME64_4 = 0x85EBCA77C2B2AE63ULL;
+const uint64_t PRIME64_5 = 0x27D4EB2F165667C5ULL;
+
+const size_t SECRET_SIZE = 192;
+const size_t STRIPE_LEN = 64;
+const size_t ACC_NB = STRIPE_LEN / sizeof(uint64_t);
+const size_t SECRET_CONSUME_RATE = 8; // the secret moves 8 bytes forward per stripe
+const size_t STRIPES_PER_BLOCK = (SECRET_SIZE - STRIPE_LEN) / SECRET_CONSUME_RATE;
+const size_t BLOCK_LEN = STRIPE_LEN * STRIPES_PER_BLOCK;
+
+// The secret which keys the hash, generated by SplitMix64.
+struct Secret {
+    uint8_t bytes[SECRET_SIZE];
+
+    Secret() {
+        uint64_t state = PRIME64_5;
+        for (size_t i = 0; i < SECRET_SIZE; i += sizeof(uint64_t)) {
+            uint64_t z = (state += 0x9E3779B97F4A7C15ULL);
+            z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+            z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+            z ^= z >> 31;
+            memcpy(bytes + i, &z, sizeof(z));
+        }
+    }
+};
+
+const Secret SECRET;
+
+// The inputs are read as little-endian words, byte-swapped on big-endian hosts.
+inline uint64_t read64(const uint8_t *p) {
+    uint64_t v;
+    memcpy(&v, p, sizeof(v));
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    v = __builtin_bswap64(v);
+#endif
+    return v;
+}
+
+inline uint64_t read32(const uint8_t *p) {
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    v = __builtin_bswap32(v);
+#endif
+    return v;
+}
+
+// Multiply two 64-bit values to 128 bits and fold the halves together.
+inline uint64_t mul128_fold64(uint64_t a, uint64_t b) {
+    const unsigned __int128 product = (unsigned __int128)a * b;
+    return (uint64_t)product ^ (uint64_t)(product >> 64);
+}
+
+inline uint64_t avalanche(uint64_t h) {
+    h ^= h >> 37;
+    h *= 0x165667919E3779F9ULL;
+    h ^= h >> 32;
+    return h;
+}
+
+inline uint64_t mix16(const uint8_t *p, const uint8_t *secret) {
+    return mul128_fold64(read64(p) ^ read64(secret), read64(p + 8) ^ read64(secret + 8));
+}
+
+// Fold a stripe into the lanes. The loop has no dependency between the lanes, so it's vectorized.
+inline void accumulate_512(uint64_t *acc, const uint8_t *input, const uint8_t *secret) {
+    for (size_t i = 0; i < ACC_NB; i++) {
+        const uint64_t data = read64(input + 8 * i);
+        const uint64_t key = data ^ read64(secret + 8 * i);
+        acc[i ^ 1] += data; // keep the input bits which the multiply drops
+        acc[i] += (key & 0xFFFFFFFFULL) * (key >> 32);
+    }
+}
+
+inline void scramble(uint64_t *acc, const uint8_t *secret) {
+    for (size_t i = 0; i < ACC_NB; i++) {
+        acc[i] ^= acc[i] >> 47;
+        acc[i] ^= read64(secret + 8 * i);
+        acc[i] *= PRIME32_1;
+    }
+}
+
+inline uint64_t merge(const uint64_t *acc, const uint8_t *secret, uint64_t start) {
+    uint64_t result = start;
+    for (size_t i = 0; i < ACC_NB / 2; i++) {
+        result += mul128_fold64(acc[2 * i] ^ read64(secret + 16 * i), acc[2 * i + 1] ^ read64(secret + 16 * i + 8));
+    }
+    return avalanche(result);
+}
+
+Hash128 hash_short(const uint8_t *p, size_t len, const uint8_t *secret) {
+    uint64_t lo_in, hi_in;
+    if (len >= 8) {
+        lo_in = read64(p);
+        hi_in = read64(p + len - 8);
+    } else if (len >= 4) {
+        lo_in = read32(p);
+        hi_in = read32(p + len - 4);
+    } else if (len > 0) {
+        lo_in = (uint64_t)p[0] | ((uint64_t)p[len / 2] << 8) | ((uint64_t)p[len - 1] << 16);
+        hi_in = (lo_in << 32) | (lo_in >> 32);
+    } else {
+        lo_in = hi_in = 0;
+    }
+    const uint64_t low = mul128_fold64(lo_in ^ read64(secret), hi_in ^ read64(secret + 8)) + len * PRIME64_1;
+    const uint64_t high = mul128_fold64(hi_in ^ read64(secret + 16), lo_in ^ read64(secret + 24)) + len * PRIME64_2;
+    return {avalanche(low ^ read64(secret + 32)), avalanche(high ^ read64(secret + 40))};
+}
+
+Hash128 hash_medium(const uint8_t *p, size_t len, const uint8_t *secret) {
+    // 17 to 128 bytes, 16-byte chunks from both ends
+    uint64_t acc_lo = len * PRIME64_1;
+    uint64_t acc_hi = 0;
+    for (size_t i = 0; i < (len + 31) / 32; i++) {
+        acc_lo += mix16(p + 16 * i, secret + 32 * i);
+        acc_hi += mix16(p + len - 16 * (i + 1), secret + 32 * i + 16);
+    }
+    const uint64_t low = avalanche(acc_lo + acc_hi);
+    const uint64_t high = avalanche(acc_lo * PRIME64_1 + acc_hi * PRIME64_4 + len * PRIME64_2);
+    return {low, 0 - high};
+}
+
+Hash128 hash_long(const uint8_t *p, size_t len, const uint8_t *secret) {
+    uint64_t acc[ACC_NB] = {PRIME32_3, PRIME64_1, PRIME64_2, PRIME64_3, PRIME64_4, PRIME32_2, PRIME64_5, PRIME32_1};
+
+    const size_t nb_blocks = (len - 1) / BLOCK_LEN;
+    for (size_t n = 0; n < nb_blocks; n++) {
+        for (size_t s = 0; s < STRIPES_PER_BLOCK; s++) {
+            accumulate_512(acc, p + n * BLOCK_LEN + s * STRIPE_LEN, secret + s * SECRET_CONSUME_RATE);
+        }
+        scramble(acc, secret + SECRET_SIZE - STRIPE_LEN);
+    }
+
+    // The last partial block, and the last stripe which may overlap it
+    const size_t nb_stripes = ((len - 1) - nb_blocks * BLOCK_LEN) / STRIPE_LEN;
+    for (size_t s = 0; s < nb_stripes; s++) {
+        accumulate_512(acc, p + nb_blocks * BLOCK_LEN + s * STRIPE_LEN, secret + s * SECRET_CONSUME_RATE);
+    }
+    accumulate_512(acc, p + len - STRIPE_LEN, secret + SECRET_SIZE - STRIPE_LEN - 7);
+
+    return {merge(acc, secret + 11, len * PRIME64_1), merge(acc, secret + SECRET_SIZE - STRIPE_LEN - 11, ~(len * PRIME64_2))};
+}
+
+} // namespace
+
+Hash128 hash128(const void *data, size_t len) {
+    const uint8_t *p = static_cast<const uint8_t *>(data);
+    if (len <= 16) {
+        return hash_short(p, len, SECRET.bytes);
+    }
+    if (len <= 128) {
+        return hash_medium(p, len, SECRET.bytes);
+    }
+    return hash_long(p, len, SECRET.bytes);
+}
+
+std::string u128_to_string_base64x(const Hash128 &val) {
+    return u64_to_string_base64x(val.low) + u64_to_string_base64x(val.high);
+}
+
 std::string u64_to_string_base64x(uint64_t val) {
     static constexpr char base64x_chars[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZ"
                                             "abcdefghijklmnopqrstuvwxyz"
@@ -74,6 +246,35 @@ std::string &replace_all(std::string &str, const std::string &find, const std::s
     return str;
 }
 
+size_t safe_replacer::replace(std::string &str, const std::vector<std::pair<std::string, std::string>> &replaces) {
+    // Find all occurrences of the strings to be replaced and store their positions along with their indices in the
+    // replaces vector
+    std::vector<pos> positions;
+    for (size_t i = 0; i < replaces.size(); i++) {
+        size_t p = str.find(replaces[i].first);
+        while (p != std::string::npos) {
+            positions.push_back({p, i});
+            p = str.find(replaces[i].first, p + replaces[i].first.size());
+        }
+    }
+
+    // If no occurrences were found, return 0
+    if (positions.empty()) {
+        return 0;
+    }
+
+    // Sort positions by position in reverse order so that replacements do not interfere with each other
+    std::sort(positions.begin(), positions.end(), [](const pos &a, const pos &b) { return a.p > b.p; });
+
+    // Replace all occurrences in reverse order
+    for (auto &p : positions) {
+        str.replace(p.p, replaces[p.index].first.size(), replaces[p.index].second);
+    }
+
+    // Return the number of replacements made
+    return positions.size();
+}
+
 std::string escapeshellarg(const std::string &arg) {
     // If the argument contains single quotes, escape them
     // * Why use `'\\''` instead of `\\'`? Because the shell will interpret anything
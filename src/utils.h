@@ -8,6 +8,7 @@
 #include <cstdint>
 #include <cstdlib>
 #include <string>
+#include <utility>
 #include <vector>
 
 namespace rcc {
@@ -46,11 +47,35 @@ bool ends_with(const std::string &str, const std::string &suffix);
 // Hash a string using the FNV-1a algorithm.
 uint64_t fnv1a_64_hash_string(const std::string &str);
 
+// A 128-bit hash value, see hash128().
+struct Hash128 {
+    uint64_t low;
+    uint64_t high;
+
+    bool operator==(const Hash128 &other) const { return low == other.low && high == other.high; }
+    bool operator!=(const Hash128 &other) const { return !(*this == other); }
+};
+
+// Hash a buffer to 128 bits with a hash of the XXH3 family: 64-byte stripes are folded into eight 64-bit lanes with
+// 32x32->64 multiplies, which the compiler vectorizes, and the lanes are scrambled and merged at the end. It is many
+// times faster than FNV-1a on long inputs and practically collision-free. The output is not the same as the reference
+// XXH3, the secret is generated.
+Hash128 hash128(const void *data, size_t len);
+
+// Hash a string to 128 bits, see hash128().
+inline Hash128 hash128_string(const std::string &str) {
+    return hash128(str.data(), str.size());
+}
+
 // Convert an uint64_t to a string in a variant of base 64.
 // The resulting string will be 11 characters long.
 // Characters used are: A-Z, a-z, 0-9, +, _.
 std::string u64_to_string_base64x(uint64_t val);
 
+// Convert a 128-bit hash to a string in a variant of base 64, see u64_to_string_base64x().
+// The resulting string will be 22 characters long.
+std::string u128_to_string_base64x(const Hash128 &val);
+
 // Concatenate a vector of strings into one string with a separator.
 // If the vector is empty, return the default_for_empty string.
 std::string vector_to_string(const std::vector<std::string> &vec,
@@ -61,6 +86,20 @@ std::string vector_to_string(const std::vector<std::string> &vec,
 // Replace all occurrences of `find` in `str` with `replacement`.
 std::string &replace_all(std::string &str, const std::string &find, const std::string &replacement);
 
+// Replace the occurrences of several strings in one pass, so that a replacement is never searched for the other
+// strings, e.g. user code which contains a placeholder of the template.
+class safe_replacer {
+  public:
+    // Replace all occurrences of each `first` in `str` with its `second`. Return the number of replacements.
+    static size_t replace(std::string &str, const std::vector<std::pair<std::string, std::string>> &replaces);
+
+  private:
+    struct pos {
+        size_t p;
+        size_t index;
+    };
+};
+
 // Escape a string for use in a shell command as an argument.
 std::string escapeshellarg(const std::string &arg);
 
@@ -30,3 +30,57 @@ diff <(
 EOF
 ) <(echo "$out") || exit 1
 
+
+# Test auto-wrap of expressions which end like statements, e.g. with a lambda body
+
+out=$(rcc '[](int a){ return a*2; }(21)')
+
+diff <(
+    cat <<EOF
+42
+EOF
+) <(echo "$out") || exit 1
+
+# Test auto-wrap of a cast and a string with a ';'
+
+out=$(rcc 'cout << (double)7/2;' 'R"(a;b)"')
+
+diff <(
+    cat <<EOF
+3.5a;b
+EOF
+) <(echo "$out") || exit 1
+
+# Test a macro which completes the statement
+
+out=$(rcc --put-above-main '#define PRINT(x) cout << (x) << endl;' 'PRINT(7)')
+
+diff <(
+    cat <<EOF
+7
+EOF
+) <(echo "$out") || exit 1
+
+# Test a lowercase macro which completes the statement, it looks like an expression
+
+out=$(rcc --put-above-main '#define say(x) cout << (x) << endl;' 'say(7)')
+
+diff <(
+    cat <<EOF
+7
+EOF
+) <(echo "$out") || exit 1
+
+out=$(rcc --permanent auto_wrap_say --put-above-main '#define say(x) cout << (x) << endl;' 'say(8)' &&
+    rcc --run-permanent auto_wrap_say)
+rcc --remove-permanent auto_wrap_say >/dev/null
+
+diff <(
+    cat <<EOF
+8
+EOF
+) <(echo "$out") || exit 1
+
+# Test that an expression which fails either way shows the errors of the auto-wrapped code
+
+rcc 'undefined_name + 1' 2>&1 | grep -q "cout << (undefined_name + 1) << endl" || exit 1
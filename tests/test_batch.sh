@@ -0,0 +1,55 @@
+#!/bin/bash
+
+source utils.sh
+
+cache_dir=$(rcc --print-cache-dir)
+
+dir=$(mktemp -d)
+trap 'rm -rf "$dir"' EXIT
+
+cat >"$dir/batch.txt" <<'EOT'
+cout<<"first"<<endl;
+1+1
+
+{"code": "cout<<argv[1]<<argv[2]<<endl;", "args": ["entry"]}
+{"code": ["int x = 6;", "x*7"], "includes": ["vector"], "flags": ["-O1"]}
+cout<<"last"<<endl;
+EOT
+
+out=$(rcc --batch "$dir/batch.txt" -j 3 -- common)
+check_error "running a batch"
+
+diff <(
+    cat <<EOT
+first
+2
+commonentry
+42
+last
+EOT
+) <(echo "$out")
+check_error "checking the batch output in the input order"
+
+echo 'return 3;' >>"$dir/batch.txt"
+rcc --batch "$dir/batch.txt" >/dev/null
+check_error "checking the exit status of a batch" 3
+
+echo '{"code": 1}' >"$dir/bad.txt"
+rcc --batch "$dir/bad.txt" >/dev/null 2>&1
+check_error "checking an invalid batch record" 1
+
+# A worker which can't be started aborts the batch, the started ones are waited for and their outputs cleaned up
+for i in 1 2 3 4 5 6; do
+    echo "cout<<$i<<endl;"
+done >"$dir/many.txt"
+(
+    ulimit -n 8
+    RCC_NO_DAEMON=1 rcc --batch "$dir/many.txt" -j 6 >/dev/null 2>"$dir/err.txt"
+)
+check_error "checking a batch whose worker can't be started" 1
+
+grep -q "the batch is aborted" "$dir/err.txt"
+check_error "checking the message of an aborted batch"
+
+ls "$cache_dir"/cache/batch.* >/dev/null 2>&1
+check_error "checking that an aborted batch leaves no output behind" 2
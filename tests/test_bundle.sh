@@ -0,0 +1,24 @@
+#!/bin/bash
+
+source utils.sh
+
+name=rcc_test_bundle_$$
+trap 'rcc remove "$name" >/dev/null 2>&1' EXIT
+
+rcc bundle "$name" 'cout<<argc-1<<endl;' '6*7' --snippet upper='string s=argv[1]; for(auto&c:s)c=toupper(c); cout<<s<<endl;'
+check_error "creating a bundle"
+
+diff <(echo 2) <(rcc run "$name" -- 0 a b)
+check_error "running a bundle snippet by index"
+
+diff <(echo 42) <(rcc run "$name" -- 1)
+check_error "running an auto-wrapped bundle snippet"
+
+diff <(echo ABC) <(rcc run "$name" -- upper abc)
+check_error "running a bundle snippet by name"
+
+rcc run "$name" -- nope >/dev/null 2>&1
+check_error "running an unknown bundle snippet" 2
+
+rcc bundle "${name}_bad" --snippet '1x=1' >/dev/null 2>&1
+check_error "checking an invalid snippet name" 105
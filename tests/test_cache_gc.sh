@@ -0,0 +1,41 @@
+#!/bin/bash
+
+source utils.sh
+
+export RCC_NO_DAEMON=1
+rcc --clean-cache
+
+diff <(echo 1) <(rcc 'cout << 1 << endl;')
+check_error "compiling a snippet"
+
+# Over budget, but an entry which was just used is left alone
+rcc --debug --cache-budget 1K 'cout << 1 << endl;' 2>&1 | grep "GC: 0 entries removed" >/dev/null
+check_error "taking a GC step over budget"
+
+rcc --debug --cache-budget 1K 'cout << 1 << endl;' 2>&1 | grep "Compiling" >/dev/null
+check_error "keeping the entry in use" 1
+
+RCC_CACHE_BUDGET=1K rcc --debug 'cout << 1 << endl;' 2>&1 | grep "GC:" >/dev/null
+check_error "reading the budget from RCC_CACHE_BUDGET"
+
+# Under budget, nothing is done
+rcc --debug --cache-budget 1G 'cout << 1 << endl;' 2>&1 | grep "GC:" >/dev/null
+check_error "skipping the GC under budget" 1
+
+rcc --cache-budget lots 'cout << 1 << endl;' >/dev/null 2>&1
+check_error "rejecting an invalid budget" 105
+
+# The lease of a running binary is passed on to the program on the descriptor in RCC_LEASE_FD, and on no other one
+code='system("ls -l /proc/$PPID/fd | grep -c [.]bin; readlink /proc/$PPID/fd/${RCC_LEASE_FD:-none} | grep -c [.]bin");'
+diff <(printf "1\n1\n") <(rcc "$code")
+check_error "passing the lease on to the program"
+
+# A binary which runs as a child doesn't get it, rcc holds it
+diff <(printf "0\n0\n") <(rcc --debug "$code" 2>/dev/null)
+check_error "keeping the lease of a child"
+
+dir=$(mktemp -d)
+trap 'rm -rf "$dir"' EXIT
+echo "$code" >"$dir/batch.txt"
+diff <(printf "0\n0\n") <(rcc --batch "$dir/batch.txt")
+check_error "keeping the lease of a batch entry"
@@ -0,0 +1,39 @@
+#!/bin/bash
+
+source utils.sh
+
+cache_dir=$(rcc --print-cache-dir)
+
+export RCC_NO_DAEMON=1
+rcc --clean-cache
+
+code='cout << 7 << endl;'
+diff <(echo 7) <(rcc "$code")
+check_error "compiling a snippet"
+
+rcc stats | grep -q '^Cache: 1 entries'
+check_error "adding the compiled snippet to the index"
+
+# Concurrent hits are all counted
+for _ in $(seq 20); do
+    rcc --tier-threshold 0 "$code" >/dev/null &
+done
+wait
+rcc stats | grep -q '^ *20  O0 '
+check_error "counting concurrent hits"
+
+# An index which is lost is rebuilt from the cache directory
+rm "${cache_dir:?}"/cache.index
+rcc stats | grep -q '^Cache: 1 entries'
+check_error "importing the cache entries into a new index"
+
+# A binary which is removed behind our back is dropped from the index
+rm "${cache_dir:?}"/cache/*.bin
+diff <(echo 7) <(rcc "$code")
+check_error "recompiling a removed binary"
+rcc stats | grep -q '^Cache: 1 entries'
+check_error "keeping one entry per snippet"
+
+rcc --clean-cache
+rcc stats | grep -q '^Cache: 0 entries'
+check_error "cleaning the index"
@@ -0,0 +1,39 @@
+#!/bin/bash
+
+source utils.sh
+
+cache_dir=$(rcc --print-cache-dir)
+
+# Many processes start with the same snippet, only one of them compiles it
+RCC_NO_DAEMON=1 rcc --clean-cache
+
+tag="$$$(date +%s)"
+dir=$(mktemp -d)
+trap 'rm -rf "$dir"' EXIT
+
+for i in $(seq 1 8); do
+    RCC_NO_DAEMON=1 rcc "cout<<\"concurrent $tag\"<<endl;" --debug >"$dir/out.$i" 2>"$dir/err.$i" &
+done
+wait
+
+for i in $(seq 1 8); do
+    diff <(echo "concurrent $tag") "$dir/out.$i" >/dev/null || exit 1
+done
+check_error "checking the outputs of the concurrent processes"
+
+compiles=$(cat "$dir"/err.* | grep -c "COMPILATION")
+[ "$compiles" -eq 1 ]
+check_error "checking that the code is compiled once"
+
+ls "$cache_dir"/cache/*.tmp >/dev/null 2>&1
+check_error "checking that no temporary file is left" 2
+
+# A lock which is held survives --clean-cache, a process waiting on it would lock a removed file otherwise
+touch "$cache_dir"/cache/held_$tag.lock "$cache_dir"/cache/unused_$tag.lock
+flock "$cache_dir"/cache/held_$tag.lock sleep 3 &
+sleep 0.5
+RCC_NO_DAEMON=1 rcc --clean-cache
+[ -f "$cache_dir"/cache/held_$tag.lock ] && [ ! -f "$cache_dir"/cache/unused_$tag.lock ]
+check_error "checking that --clean-cache keeps the held locks"
+wait
+rm -f "${cache_dir:?}"/cache/held_$tag.lock
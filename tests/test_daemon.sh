@@ -0,0 +1,93 @@
+#!/bin/bash
+
+source utils.sh
+
+# Leave a daemon started by the user alone
+started=false
+if ! rccd --status >/dev/null 2>&1; then
+    rccd
+    check_error "rccd"
+    started=true
+fi
+
+out=$(rcc 'cout<<"Hello from the daemon"<<endl;')
+check_error "rcc through the daemon"
+
+diff <(echo "Hello from the daemon") <(echo "$out")
+check_error "checking output through the daemon"
+
+# Run it again, the daemon answers by itself this time
+out=$(rcc 'cout<<"Hello from the daemon"<<endl;' -- a b)
+diff <(echo "Hello from the daemon") <(echo "$out")
+check_error "checking cached output through the daemon"
+
+out=$(rcc 'cout<<argc<<argv[2]<<endl;' -- a 'b c')
+diff <(echo "3b c") <(echo "$out")
+check_error "checking arguments through the daemon"
+
+out=$(echo "stdin" | rcc 'string s; cin>>s; cout<<s<<endl;')
+diff <(echo "stdin") <(echo "$out")
+check_error "checking stdin through the daemon"
+
+rcc 'return 5;'
+check_error "checking exit status through the daemon" 5
+
+rcc 'int a = ;' >/dev/null 2>&1
+check_error "checking compile error through the daemon" 1
+
+# A binary which depends on a local file is looked up again every time
+dir=$(mktemp -d)
+echo 'int helper_value() { return 1; }' >"$dir/helper.cpp"
+for _ in 1 2; do
+    out=$(cd "$dir" && rcc --compile-with helper.cpp --put-above-main 'int helper_value();' 'cout<<helper_value()<<endl;')
+done
+diff <(echo "1") <(echo "$out")
+check_error "compiling with a helper through the daemon"
+
+echo 'int helper_value() { return 2; }' >"$dir/helper.cpp"
+out=$(cd "$dir" && rcc --compile-with helper.cpp --put-above-main 'int helper_value();' 'cout<<helper_value()<<endl;')
+diff <(echo "2") <(echo "$out")
+check_error "changing the helper through the daemon"
+rm -rf "$dir"
+
+# A client which connects and stalls doesn't hold up the others
+if command -v python3 >/dev/null; then
+    socket="$(rcc --print-cache-dir)/rccd.sock"
+    python3 -c 'import socket, sys, time
+s = socket.socket(socket.AF_UNIX)
+s.connect(sys.argv[1])
+time.sleep(5)' "$socket" &
+    stalled=$!
+    sleep 0.2
+    begin=${EPOCHREALTIME/./}
+    out=$(rcc 'cout<<"Hello from the daemon"<<endl;')
+    end=${EPOCHREALTIME/./}
+    kill $stalled 2>/dev/null
+    wait $stalled 2>/dev/null
+    [ "$out" = "Hello from the daemon" ] && [ $(((end - begin) / 1000)) -lt 1000 ]
+    check_error "serving a client while another one stalls"
+fi
+
+# A worker which runs the binary is interrupted when its client goes away
+dir=$(mktemp -d)
+rcc --debug "ofstream(\"$dir/pid\") << getpid() << endl; sleep(30);" >/dev/null 2>&1 &
+client=$!
+for _ in $(seq 100); do
+    [ -s "$dir/pid" ] && break
+    sleep 0.1
+done
+kill -9 $client
+wait $client 2>/dev/null
+pid=$(cat "$dir/pid")
+for _ in $(seq 50); do
+    kill -0 "$pid" 2>/dev/null || break
+    sleep 0.1
+done
+[ -n "$pid" ] && ! kill -0 "$pid" 2>/dev/null
+check_error "stopping the binary of a client which went away"
+rm -rf "$dir"
+
+if [ "$started" = true ]; then
+    rccd --stop
+    check_error "rccd --stop"
+fi
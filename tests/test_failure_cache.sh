@@ -0,0 +1,36 @@
+#!/bin/bash
+
+source utils.sh
+
+export RCC_NO_DAEMON=1
+rcc --clean-cache
+
+code='int x = ;'
+
+err1=$(rcc "$code" 2>&1)
+check_error "compiling a failing snippet" 1
+
+err2=$(rcc "$code" 2>&1)
+check_error "replaying a known failure" 1
+
+diff <(echo "$err1") <(echo "$err2")
+check_error "replaying the same diagnostics"
+
+rcc --debug "$code" 2>&1 | grep -q "known to fail"
+check_error "skipping the compilation of a known failure"
+
+CPATH=/nonexistent rcc --debug "$code" 2>&1 | grep -q "record of the original code is stale"
+check_error "invalidating the record on a toolchain change"
+
+# A failure which depends on a local header is never recorded
+dir=$(mktemp -d)
+trap 'rm -rf "$dir"' EXIT
+echo 'int broken =' >"$dir/local.h"
+cd "$dir" || exit 1
+
+rcc --include local.h 'cout << 1 << endl;' >/dev/null 2>&1
+check_error "compiling with a broken local header" 1
+
+echo 'int broken = 1;' >"$dir/local.h"
+diff <(echo 1) <(rcc --include local.h 'cout << 1 << endl;')
+check_error "compiling with the fixed local header"
@@ -0,0 +1,50 @@
+#!/bin/bash
+
+source utils.sh
+
+cache_dir=$(rcc --print-cache-dir)
+
+export RCC_NO_DAEMON=1
+rcc --clean-cache
+
+units_dir="$cache_dir/templates/header_units"
+#! Caution: removes files
+rm -rf "${units_dir:?}"/*
+
+# No PCH variant is built for the flags, it would be built in the background while the next tests run
+flags=(--g++ --modules -std=c++20 --pch-threshold 0)
+
+diff <(echo "1") <(rcc "${flags[@]}" 'cout << 1 << endl;')
+check_error "compiling with --modules before the header unit is built"
+
+# The header unit is built and compared with the PCH in the background, it's either ready or failed
+for _ in $(seq 300); do
+    ls "$units_dir"/*/ready "$units_dir"/*.failed 2>/dev/null | grep . >/dev/null && break
+    sleep 0.2
+done
+ls "$units_dir"/*/ready "$units_dir"/*.failed 2>/dev/null | grep . >/dev/null
+check_error "building the header unit"
+
+diff <(echo "a") <(rcc "${flags[@]}" 'map<int, string> m; m[1] = "a"; cout << m[1] << endl;')
+check_error "compiling with --modules after the header unit is built"
+
+# An error of the code is not compiled again with the PCH
+if ls "$units_dir"/*/ready >/dev/null 2>&1; then
+    ! rcc "${flags[@]}" --debug 'undefined_name += 1;' 2>&1 | grep -F "again with the PCH" >/dev/null
+    check_error "compiling an error with the header unit once"
+fi
+
+# A compilation which fails with the header unit is compiled again with the PCH
+if ls "$units_dir"/*/ready >/dev/null 2>&1; then
+    for gcm in "$units_dir"/*/rcc_units.gcm; do
+        : >"$gcm"
+    done
+    diff <(echo "2") <(rcc "${flags[@]}" 'cout << 2 << endl;')
+    check_error "falling back to the PCH"
+
+    ls "$units_dir"/*.failed >/dev/null 2>&1
+    check_error "marking the header unit failed"
+fi
+
+#! Caution: removes files
+rm -rf "${units_dir:?}"/*
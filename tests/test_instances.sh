@@ -0,0 +1,54 @@
+#!/bin/bash
+
+source utils.sh
+
+cache_dir=$(rcc --print-cache-dir)
+
+export RCC_NO_DAEMON=1
+rcc --clean-cache
+
+lib="$cache_dir/templates/librcc_instances.g++.c++17.so"
+[ -f "$lib" ]
+check_error "building the library of the instantiations"
+
+snippet='vector<string> v{"a"}; map<int, int> m; m[1] = 2; set<int> s{3}; cout << v[0] << m[1] << *s.begin() << endl;'
+
+diff <(echo "a23") <(rcc --g++ "$snippet")
+check_error "linking the instantiations"
+
+# The extern templates are declared in the default PCH, which the snippets linking the library keep using
+rcc --g++ -H "$snippet" 2>&1 | grep -E '^! .*\.default\.gch$' >/dev/null
+check_error "using the default PCH with the instantiations"
+
+diff <(echo "a23") <(rcc --g++ -D_GLIBCXX_DEBUG "$snippet")
+check_error "compiling with flags which change the containers"
+
+diff <(echo "a23") <(rcc --g++ -static "$snippet")
+check_error "linking the archive of the instantiations statically"
+
+# The permanent snippets link the archive, they keep running without the shared library
+rcc --g++ --permanent test_instances "$snippet" >/dev/null
+check_error "making the snippet permanent"
+! ldd "$cache_dir/permanent/test_instances.bin" | grep -F "$lib" >/dev/null
+check_error "linking the permanent snippet with the archive"
+diff <(echo "a23") <(cd / && rcc --run-permanent test_instances)
+check_error "running the permanent snippet"
+
+# A cached snippet linked with the shared library is compiled again when it's gone, instead of failing to load it
+diff <(echo "a23") <(rcc --g++ "$snippet")
+#! Caution: moves the library aside, and back
+mv "$lib" "$lib.moved"
+diff <(echo "a23") <(rcc --g++ "$snippet")
+status=$?
+diff <(echo "a23") <(cd / && rcc --run-permanent test_instances)
+status=$((status + $?))
+# Without the library the default flags don't count as a PCH variant
+! rcc --g++ --debug --pch-threshold 0 'cout << 42 << endl;' 2>&1 | grep -F "PCH VARIANT" >/dev/null
+status=$((status + $?))
+mv "$lib.moved" "$lib"
+[ $status -eq 0 ]
+check_error "compiling the cached snippet again without the library"
+
+diff <(echo "a23") <(rcc --g++ "$snippet")
+check_error "linking the library again once it's back"
+rcc --remove-permanent test_instances >/dev/null
@@ -0,0 +1,47 @@
+#!/bin/bash
+
+source utils.sh
+
+cache_dir=$(rcc --print-cache-dir)
+
+export RCC_NO_DAEMON=1
+
+rcc -d4 list 2>&1 >/dev/null | grep "Checking RCC cache directory" >/dev/null
+rcc -d4 list 2>&1 >/dev/null | grep "Checking RCC cache directory" >/dev/null
+check_error "skipping the check of the cache directory with a valid stamp" 1
+
+# A directory removed from the cache root is created again
+rm -rf "${cache_dir:?}"/permanent
+rcc -d4 list 2>&1 >/dev/null | grep "Checking RCC cache directory" >/dev/null
+check_error "checking the cache directory after it changed"
+test -d "$cache_dir"/permanent
+check_error "creating the removed directory"
+
+# A cache root replaced by a copy with the same time has another inode
+#! Caution: swaps the cache root with a copy of it
+mv "$cache_dir" "$cache_dir.old" && cp -al "$cache_dir.old" "$cache_dir"
+check_error "copying the cache root"
+rm -rf "${cache_dir:?}.old"
+rcc -d4 list 2>&1 >/dev/null | grep "Checking RCC cache directory" >/dev/null
+check_error "checking the cache directory after the root was replaced"
+
+# A missing template header is reported even with a valid stamp
+header="$cache_dir/templates/rcc_template.hpp"
+#! Caution: moves the template header aside, and back
+mv "$header" "$header.moved"
+rcc 'cout << 1 << endl;' 2>&1 | grep "mandatory file/directory does not exist" >/dev/null
+status=$?
+mv "$header.moved" "$header"
+[ $status -eq 0 ]
+check_error "reporting the missing template header"
+
+# A nested directory removed by hand is created again by its users, the stamp only covers the cache root
+rm -rf "${cache_dir:?}"/templates/pch_variants "${cache_dir:?}"/cache/objects
+dir=$(mktemp -d)
+trap 'rm -rf "$dir"' EXIT
+echo 'int layout_helper() { return 4; }' >"$dir/helper.cpp"
+diff <(echo 4) <(cd "$dir" && rcc -O1 --compile-with helper.cpp --put-above-main 'int layout_helper();' \
+    "cout << layout_helper() << \" $$\" << endl;" | cut -d' ' -f1)
+check_error "compiling after the nested directories were removed"
+test -d "$cache_dir"/templates/pch_variants && test -d "$cache_dir"/cache/objects
+check_error "creating the removed nested directories"
@@ -0,0 +1,70 @@
+#!/bin/bash
+
+source utils.sh
+
+# Work on copies, the helper is changed by this test
+dir=$(mktemp -d)
+trap 'rm -rf "$dir"' EXIT
+cat >"$dir/helper.h" <<EOT
+int helper_value();
+EOT
+cat >"$dir/helper.cpp" <<EOT
+#include "helper.h"
+#define HELPER_VALUE 1
+int helper_value() { return HELPER_VALUE; }
+EOT
+cd "$dir" || exit 1
+
+# The cached binaries are keyed by the source names, start from scratch
+RCC_NO_DAEMON=1 rcc --clean-cache
+
+out=$(RCC_NO_DAEMON=1 rcc --compile-with helper.cpp --include helper.h 'cout<<helper_value()<<endl;')
+diff <(echo "1") <(echo "$out")
+check_error "compiling the object of the additional source"
+
+# Another snippet links the cached object
+out=$(RCC_NO_DAEMON=1 rcc --compile-with helper.cpp --include helper.h 'cout<<helper_value()+1<<endl;' -d5 2>&1)
+echo "$out" | grep -q "Using cached object"
+check_error "reusing the cached object"
+
+# A changed source gets a new object
+sed -i 's/HELPER_VALUE 1/HELPER_VALUE 3/' helper.cpp
+out=$(RCC_NO_DAEMON=1 rcc --compile-with helper.cpp --include helper.h 'cout<<helper_value()+2<<endl;')
+diff <(echo "5") <(echo "$out")
+check_error "rebuilding the object after the source changed"
+
+# A changed header makes the object stale
+sleep 0.01
+echo "// changed" >>helper.h
+out=$(RCC_NO_DAEMON=1 rcc --compile-with helper.cpp --include helper.h 'cout<<helper_value()+3<<endl;' -d5 2>&1)
+echo "$out" | grep -q "is stale"
+check_error "rebuilding the object after the header changed"
+
+# The same snippet is not a cache hit after only the helper changed
+out=$(RCC_NO_DAEMON=1 rcc --compile-with helper.cpp --include helper.h 'cout<<helper_value()<<endl;')
+diff <(echo "3") <(echo "$out")
+check_error "compiling the snippet again after the helper changed"
+
+sed -i 's/HELPER_VALUE 3/HELPER_VALUE 4/' helper.cpp
+out=$(RCC_NO_DAEMON=1 rcc --compile-with helper.cpp --include helper.h 'cout<<helper_value()<<endl;')
+diff <(echo "4") <(echo "$out")
+check_error "compiling the snippet again after only the helper changed"
+
+# A header of the helper changes the object but not its name, the binary linked before is stale
+cat >value.h <<EOT
+#define HELPER_VALUE 6
+EOT
+sed -i 's/#define HELPER_VALUE 4/#include "value.h"/' helper.cpp
+out=$(RCC_NO_DAEMON=1 rcc --compile-with helper.cpp --include helper.h 'cout<<helper_value()<<endl;')
+diff <(echo "6") <(echo "$out")
+check_error "compiling the helper with a header"
+
+sleep 0.01
+echo "#define HELPER_VALUE 7" >value.h
+out=$(RCC_NO_DAEMON=1 rcc --compile-with helper.cpp --include helper.h 'cout<<helper_value()<<endl;')
+diff <(echo "7") <(echo "$out")
+check_error "compiling the snippet again after only a header of the helper changed"
+
+echo 'int broken( {' >>helper.cpp
+RCC_NO_DAEMON=1 rcc --compile-with helper.cpp --include helper.h 'cout<<helper_value()+4<<endl;' >/dev/null 2>&1
+check_error "checking compile error of the additional source" 1
@@ -0,0 +1,26 @@
+#!/bin/bash
+
+source utils.sh
+
+cache_dir=$(rcc --print-cache-dir)
+
+export RCC_NO_DAEMON=1
+rcc --clean-cache
+
+diff <(echo 42) <(rcc 'cout << 42 << endl;')
+check_error "compiling a snippet"
+
+# Tamper with the cached source, a hit only looks at the binary
+for f in "$cache_dir"/cache/*.cpp; do
+    echo "// tampered" >>"$f"
+done
+
+rcc --debug 'cout << 42 << endl;' 2>&1 | grep "Compiling" >/dev/null
+check_error "running the cached binary without reading the source back" 1
+
+# The paranoid mode compares the source and recompiles
+rcc --debug --paranoid 'cout << 42 << endl;' 2>&1 | grep "content does not match" >/dev/null
+check_error "detecting the mismatched source in paranoid mode"
+
+rcc --debug --paranoid 'cout << 42 << endl;' 2>&1 | grep "Compiling" >/dev/null
+check_error "running the recompiled binary in paranoid mode" 1
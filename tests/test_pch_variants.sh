@@ -0,0 +1,85 @@
+#!/bin/bash
+
+source utils.sh
+
+cache_dir=$(rcc --print-cache-dir)
+
+export RCC_NO_DAEMON=1
+rcc --clean-cache
+
+pch_dir="$cache_dir/templates/rcc_template.hpp.gch"
+
+# The variants of the previous tests may still be built in the background, they would be taken for the new ones
+for lock in "$cache_dir/templates/pch_variants"/*.lock; do
+    [ -e "$lock" ] && flock "$lock" true
+done
+before=$(ls "$pch_dir")
+
+# -O1 makes the default PCHs unusable, the macro gives the flags a signature of their own
+flags=(--g++ --pch-threshold 2 -O1 -DRCC_TEST_VARIANT)
+
+for i in 1 2; do
+    diff <(echo "$i") <(rcc "${flags[@]}" "cout << $i << endl;")
+done
+check_error "compiling with flags the default PCHs can't be used with"
+
+# The variant is built in the background
+for _ in $(seq 150); do
+    ls "$pch_dir" | grep '^g++\.variant\..*\.gch$' | grep -vxF "$before" >/dev/null && break
+    sleep 0.2
+done
+variant=$(ls "$pch_dir" | grep '^g++\.variant\..*\.gch$' | grep -vxF "$before")
+[ -n "$variant" ]
+check_error "building the PCH variant"
+
+# g++ prints the PCH it uses with "!"
+rcc "${flags[@]}" -H 'cout << 3 << endl;' 2>&1 | grep -F "! $pch_dir/$variant" >/dev/null
+check_error "using the PCH variant"
+
+rcc --g++ -H 'cout << 4 << endl;' 2>&1 | grep -E '^! .*\.default\.gch$' >/dev/null
+check_error "using the default PCH without the flags"
+
+# The headers of an include set are precompiled with the template header
+before=$(ls "$pch_dir")
+for i in 1 2; do
+    diff <(echo "$i.txt") <(rcc --g++ --pch-threshold 2 --include filesystem \
+        "cout << filesystem::path(\"rcc/$i.txt\").filename().string() << endl;")
+done
+check_error "compiling with an include set"
+
+for _ in $(seq 150); do
+    ls "$pch_dir" | grep '^g++\.variant\..*\.gch$' | grep -vxF "$before" >/dev/null && break
+    sleep 0.2
+done
+include_variant=$(ls "$pch_dir" | grep '^g++\.variant\..*\.gch$' | grep -vxF "$before")
+[ -n "$include_variant" ]
+check_error "building the PCH variant of the include set"
+
+# A new snippet with the same include set is a cache miss which uses the variant
+rcc --g++ --include filesystem -H 'cout << filesystem::path("a/b").filename() << endl;' 2>&1 |
+    grep -F "! $pch_dir/$include_variant" >/dev/null
+check_error "using the PCH variant of the include set"
+
+#! Caution: removes files
+rm -f "$pch_dir/$variant" "$pch_dir/$include_variant"
+
+# The background build doesn't hold the lock of the snippet which started it
+before=$(ls "$pch_dir")
+diff <(echo 5) <(rcc --g++ --pch-threshold 1 -O1 -DRCC_TEST_DETACH 'cout << 5 << endl;')
+building=false
+for lock in "$cache_dir/templates/pch_variants"/*.lock; do
+    flock -n "$lock" true || building=true
+done
+held=0
+for lock in "$cache_dir/cache"/*.lock; do
+    [ -e "$lock" ] && ! flock -n "$lock" true && held=$((held + 1))
+done
+[ "$building" = true ] && [ $held -eq 0 ]
+check_error "building the PCH variant without the lock of the snippet"
+
+for lock in "$cache_dir/templates/pch_variants"/*.lock; do
+    [ -e "$lock" ] && flock "$lock" true
+done
+detach_variant=$(ls "$pch_dir" | grep '^g++\.variant\..*\.gch$' | grep -vxF "$before")
+#! Caution: removes files
+[ -n "$detach_variant" ] && rm -f "$pch_dir/$detach_variant"
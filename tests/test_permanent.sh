@@ -2,6 +2,8 @@
 
 source utils.sh
 
+cache_dir=$(rcc --print-cache-dir)
+
 # Test permanent options
 
 rcc --permanent test_permanent --desc "This is a test permanent" 'cout<<"This is a test message for test_permanent"<<endl;'
@@ -24,6 +26,9 @@ check_error "rcc --remove-permanent"
 rcc list | grep test_permanent
 check_error "rcc list after remove" "1" true
 
+ls "$cache_dir"/permanent/test_permanent.lock >/dev/null 2>&1
+check_error "checking that rcc remove removes the lock" 2
+
 rcc create test_permanent --desc "This is a test permanent" 'cout<<"This is a test message for test_permanent"<<endl;'
 check_error "rcc create"
 
@@ -0,0 +1,28 @@
+#!/bin/bash
+
+source utils.sh
+
+cache_dir=$(rcc --print-cache-dir)
+
+export RCC_NO_DAEMON=1
+rcc --clean-cache
+
+diff <(echo 3) <(rcc 'cout << 3 << endl;')
+check_error "compiling a snippet"
+
+rcc --debug 'cout << 3 << endl;' 2>&1 | grep -E "Fingerprinting|Compiling" >/dev/null
+check_error "hitting the cache without reading the template" 1
+
+# A template which is touched is fingerprinted again, its content is the same
+touch "$cache_dir"/templates/rcc_template.cpp
+rcc --debug 'cout << 3 << endl;' 2>&1 | grep "Fingerprinting" >/dev/null
+check_error "fingerprinting the touched template"
+
+rcc --debug 'cout << 3 << endl;' 2>&1 | grep "Compiling" >/dev/null
+check_error "keeping the cache of the touched template" 1
+
+# The functions and the code are separate fields of the key
+diff <(echo 5) <(rcc --function 'int f() { return 5; }' 'cout << f() << endl;')
+check_error "compiling a snippet with a function"
+diff <(echo 5) <(rcc --function 'int f() { return 5; } int g() { return 6; }' 'cout << f() << endl;')
+check_error "compiling a snippet with another function"
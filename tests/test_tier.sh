@@ -0,0 +1,40 @@
+#!/bin/bash
+
+source utils.sh
+
+export RCC_NO_DAEMON=1
+rcc --clean-cache
+
+code='long s = 0; for (int i = 0; i < 1000; i++) { s += i; } cout << s << endl;'
+
+# The first run compiles, the next two are hits which reach the threshold
+for _ in 1 2 3; do
+    diff <(echo 499500) <(rcc --tier-threshold 2 "$code")
+done
+check_error "running a snippet up to the tier threshold"
+
+# The optimized build runs in the background
+for _ in $(seq 100); do
+    rcc stats | grep -q '^Tiers:.* O2 1' && break
+    sleep 0.2
+done
+rcc stats | grep -q '^Tiers:.* O2 1'
+check_error "promoting the hot snippet to -O2"
+
+diff <(echo 499500) <(rcc --tier-threshold 2 "$code")
+check_error "running the optimized binary"
+
+rcc stats | grep -q '^ *3  O2 '
+check_error "counting the hits of the optimized binary"
+
+# The optimization flags of the user are kept
+for _ in 1 2 3; do
+    rcc -O1 --tier-threshold 2 "$code" >/dev/null
+done
+rcc stats | grep -q '^ *2  fixed '
+check_error "keeping the optimization flags of the user"
+
+# The hits and the tier are kept in the cache index, there is no file per entry for them
+cache_dir=$(rcc --print-cache-dir)
+! ls "$cache_dir/cache"/*.hits >/dev/null 2>&1
+check_error "keeping the tiers in the cache index"
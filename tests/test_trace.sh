@@ -0,0 +1,30 @@
+#!/bin/bash
+
+source utils.sh
+
+export RCC_NO_DAEMON=1
+rcc --clean-cache
+
+trace=$(mktemp)
+rm -f "$trace"
+
+diff <(echo 42) <(rcc --trace "$trace" 'cout << 42 << endl;')
+check_error "compiling a snippet with a trace"
+
+diff <(echo 42) <(RCC_TRACE="$trace" rcc 'cout << 42 << endl;')
+check_error "running the cached snippet with a trace from the environment"
+
+grep '"name":"compile and link"' "$trace" >/dev/null
+check_error "tracing the compile"
+
+test "$(grep -c '"name":"run"' "$trace")" = 2
+check_error "tracing both runs"
+
+test "$(grep -c '"name":"rcc"' "$trace")" = 2
+check_error "appending the traces of both invocations"
+
+# A JSON array left open for the next invocation, one event per line
+test "$(head -n 1 "$trace")" = "[" && ! tail -n +2 "$trace" | grep -v '^{.*},$' >/dev/null
+check_error "writing one event per line"
+
+rm -f "$trace"
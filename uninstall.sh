@@ -1,4 +1,5 @@
 #!/bin/bash
 
+command -v rccd &>/dev/null && rccd --stop &>/dev/null
 rm -rf "$HOME/.cache/rcc"
-sudo rm -f "/usr/local/bin/rcc"
+sudo rm -f "/usr/local/bin/rcc" "/usr/local/bin/rccd"